@@ -0,0 +1,117 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/*
+ * Blits square RGBA sprites all over a large RGBA target, the way an atlas
+ * is composed, with a plain memcpy per row and with czblit_rows, cached and
+ * streaming. Streaming is skipped for short rows, so small sprites show the
+ * cached path alone and large ones the streaming kernel.
+ *
+ * Every variant gets an untimed warm-up pass, then the variants take turns
+ * going first over several rounds and the best round of each is reported,
+ * so none pays alone for page faults or a cold cache.
+ *
+ * usage: chizu_blit_bench [target size in pixels, default 8192]
+ */
+
+#include "czblit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BPP 4
+#define VARIANTS 3
+#define ROUNDS 5
+
+typedef void (*blit_func)(const unsigned char * src, unsigned sprite, unsigned char * dst, size_t dstpitch, int stream);
+
+static void blit_memcpy(const unsigned char * src, unsigned sprite, unsigned char * dst, size_t dstpitch, int stream) {
+    unsigned y = 0;
+    (void) stream;
+    for (y = 0; y < sprite; y++)
+        memcpy(dst + y * dstpitch, src + (size_t) y * sprite * BPP, (size_t) sprite * BPP);
+}
+
+static void blit_czblit(const unsigned char * src, unsigned sprite, unsigned char * dst, size_t dstpitch, int stream) {
+    czblit_rows(src, (size_t) sprite * BPP, dst, dstpitch, (size_t) sprite * BPP, sprite, stream);
+}
+
+static double run(blit_func f, const unsigned char * src, unsigned sprite, unsigned char * target, unsigned size, int stream) {
+    size_t pitch = (size_t) size * BPP;
+    unsigned x = 0, y = 0;
+    clock_t start = clock();
+    for (y = 0; y + sprite <= size; y += sprite)
+        for (x = 0; x + sprite <= size; x += sprite)
+            f(src, sprite, target + y * pitch + (size_t) x * BPP, pitch, stream);
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static const char * names[VARIANTS] = { "memcpy rows     ", "czblit          ", "czblit streaming" };
+static const blit_func funcs[VARIANTS] = { blit_memcpy, blit_czblit, blit_czblit };
+static const int streams[VARIANTS] = { 0, 0, 1 };
+
+int main(int argc, char ** argv) {
+    unsigned size = argc > 1 ? (unsigned) strtoul(argv[1], NULL, 10) : 8192;
+    size_t bytes = (size_t) size * size * BPP;
+    const unsigned sprites[2] = { 256, 4096 };
+    unsigned char * src = malloc((size_t) sprites[1] * sprites[1] * BPP);
+    unsigned char * target = malloc(bytes);
+    double best[VARIANTS];
+    size_t i = 0;
+    unsigned s = 0, r = 0, v = 0;
+    if (src == NULL || target == NULL || size < sprites[1]) {
+        printf("could not allocate a %ux%u target\n", size, size);
+        return 1;
+    }
+    for (i = 0; i < (size_t) sprites[1] * sprites[1] * BPP; i++)
+        src[i] = (unsigned char) i;
+    memset(target, 0, bytes);
+
+    printf("target %ux%u (%lu MiB), streaming kernel %s, streamed from %lu MiB\n", size, size, (unsigned long) (bytes >> 20),
+        czblit_kernel_name(), (unsigned long) (czblit_stream_bytes() >> 20));
+    for (s = 0; s < 2; s++) {
+        printf("%ux%u sprites\n", sprites[s], sprites[s]);
+        for (v = 0; v < VARIANTS; v++) {
+            run(funcs[v], src, sprites[s], target, size, streams[v]);
+            best[v] = 0;
+        }
+        for (r = 0; r < ROUNDS; r++) {
+            for (i = 0; i < VARIANTS; i++) {
+                double seconds = 0;
+                v = (unsigned) ((r + i) % VARIANTS);
+                seconds = run(funcs[v], src, sprites[s], target, size, streams[v]);
+                if (best[v] == 0 || seconds < best[v])
+                    best[v] = seconds;
+            }
+        }
+        for (v = 0; v < VARIANTS; v++)
+            printf("  %s %8.3f s %8.1f MiB/s\n", names[v], best[v], bytes / 1048576.0 / best[v]);
+    }
+
+    free(src);
+    free(target);
+    return 0;
+}
@@ -0,0 +1,35 @@
+# chizu_embed_atlas(<target> <name> [LZ4] [FORMAT <format>] IMAGES <image>...)
+#
+# Packs the images (relative to the current source dir) into an atlas when
+# building <target> and compiles it in: <name>.c defines the
+# chizu_embedded <name>_embedded and <name>.h has the sprite enum, rects and
+# lookup (see chizu_export_source and chizu_export_header). Both are
+# generated in the current binary dir, which is added to the include path.
+function(chizu_embed_atlas target name)
+    cmake_parse_arguments(CHIZU_EMBED "LZ4" "FORMAT" "IMAGES" ${ARGN})
+    set(base "${CMAKE_CURRENT_BINARY_DIR}/${name}")
+    set(options -H -e raw)
+    if (CHIZU_EMBED_LZ4)
+        set(options -H -e lz4)
+    endif()
+    if (CHIZU_EMBED_FORMAT)
+        list(APPEND options -f ${CHIZU_EMBED_FORMAT})
+    endif()
+
+    set(depends)
+    foreach(image ${CHIZU_EMBED_IMAGES})
+        list(APPEND depends "${CMAKE_CURRENT_SOURCE_DIR}/${image}")
+    endforeach()
+
+    add_custom_command(
+        OUTPUT "${base}.c" "${base}.h"
+        COMMAND chizu_e ${options} "${base}" ${CHIZU_EMBED_IMAGES}
+        DEPENDS chizu_e ${depends}
+        WORKING_DIRECTORY "${CMAKE_CURRENT_SOURCE_DIR}"
+        COMMENT "Packing atlas ${name}"
+        VERBATIM
+    )
+    target_sources(${target} PRIVATE "${base}.c" "${base}.h")
+    target_include_directories(${target} PRIVATE "${CMAKE_CURRENT_BINARY_DIR}")
+    target_link_libraries(${target} PRIVATE chizu)
+endfunction()
@@ -25,20 +25,83 @@ THE SOFTWARE.
 #include "chizu.h"
 #include "czsurface.h"
 #include "czmap.h"
+#include "czsdf.h"
+#include "czthread.h"
+#include "czalloc.h"
+#include "czepoch.h"
+#include "czpool.h"
+#include "czfile.h"
+#include "czindex.h"
+#include "czspec.h"
+#include "czcode.h"
+#include "czlz4.h"
+#include "czcache.h"
 #include <stdio.h>
 #include <string.h>
-#include <malloc.h>
+#include <stdlib.h>
 
 static char * chizu_internal_strdup(const char *s);
 
 /* data type declarations */
 
+#define CHIZU_MAX_PLANES 4
+#define CHIZU_MAX_DIRTY_RECTS 32
+#define CHIZU_SERIAL_COMPOSE_PIXELS (512 * 512)
+#define CHIZU_COMPOSE_BANDS_PER_CPU 4
+#define CHIZU_UNPUBLISHED ((unsigned) -1)
+#define CHIZU_STATE_VERSION 1
+#define CHIZU_STATE_ALIGN 4096
+#define CHIZU_SHARED_REVISION 1
+#define CHIZU_SHARED_NAME_BYTES 64 /* room reserved per subimage name, on average */
+
+/* only stable atlases (chizu_set_stable_layout) have other than CZDATA_PLACED */
+typedef enum czdata_state {
+    CZDATA_PLACED = 0,  /* packed anew */
+    CZDATA_RESERVED,    /* where a subimage was in the previous layout, not inserted (yet) */
+    CZDATA_KEPT,        /* inserted where it was, with the same pixels */
+    CZDATA_CHANGED,     /* inserted where it was, with other (or unknown) pixels */
+    CZDATA_MOVED,       /* inserted elsewhere, czdata::was holds the previous place */
+    CZDATA_SUPERSEDED   /* a reservation whose file moved, left in the map when freeing it failed */
+} czdata_state;
+
 typedef struct czdata {
     char * file;
     czsurface * surface;
+    czsize size;
+    czrect rect;
+    unsigned channel;
+    unsigned slot; /* index in the published layout, or CHIZU_UNPUBLISHED */
+    czdata_state state;
+    czrect was;           /* CZDATA_MOVED only */
+    unsigned waschannel;
     struct chizu * atlas;
 } czdata;
 
+typedef struct czsdfjob {
+    const char ** files;
+    czsurface ** surfaces;
+    unsigned downscale;
+    unsigned spread;
+} czsdfjob;
+
+typedef struct czcompose {
+    struct czdata ** sprites;
+    unsigned * bands;
+    unsigned count;
+    czsurface * target;
+} czcompose;
+
+typedef struct czspecdata {
+    czspec_entry * entries;
+    unsigned count, capacity;
+} czspecdata;
+
+/* a walk that skips reserved subimages */
+typedef struct czvisit {
+    czwalkfunc func;
+    void * priv;
+} czvisit;
+
 typedef struct czfuncdata {
     chizu_custom_export_func func;
     chizu_export_status status;
@@ -46,12 +109,137 @@ typedef struct czfuncdata {
 } czfuncdata;
 
 struct chizu {
-    czmap * map;
+    czmap * maps[CHIZU_MAX_PLANES];
+    unsigned planes;
     czsurface * target;
     czsize size;
+    unsigned channels;
+    czsurface_type type;
+    unsigned miplevels;
+    chizu_spec_format specformat;
     FILE * output;
+    czrect dirty[CHIZU_MAX_DIRTY_RECTS];
+    unsigned dirtycount;
+    unsigned count;
+    czthread_mutex lock;        /* maps, size changes, dirty rects */
+    czthread_rwlock targetlock; /* shared to blit into or read target, exclusive to replace it */
+    int locksready;
+    czepoch * epoch;
+    void * volatile layout;     /* the chizu_layout readers get */
+    chizu_sprite * sprites;     /* shared by layouts, appended past their count */
+    unsigned published, capacity;
+    czindex * index;            /* name to slot of published sprites */
+    unsigned long version;
+    czpool * pool;              /* started by the first chizu_insert_async */
+    czthread_mutex asynclock;   /* everything below and the futures */
+    czthread_cond asyncchange;  /* an async insert was packed or finished */
+    unsigned long submitted, packed;
+    unsigned pending;
+    struct czshared_header * shared; /* set for chizu_create_shared atlases, which never grow */
+    unsigned sharednames;            /* name bytes reserved by placed subimages */
+    unsigned sharedused;             /* name bytes written for published ones */
+    chizu_cache * cache;             /* decoded inputs, may be NULL */
+    int stable;                      /* grows without moving anything, see chizu_set_stable_layout */
+    czdata ** reserved;              /* the previous layout, in the maps until claimed */
+    unsigned reservedcount;
+    czindex * reservedindex;         /* name to reservation */
+    czsurface * previous;            /* the previous texture, may be NULL */
+};
+
+struct chizu_future {
+    chizu * atlas;
+    char * file;
+    chizu_insert_callback callback;
+    void * priv;
+    unsigned long ticket;   /* packing order */
+    volatile long done;
+    unsigned refs;          /* the caller and the job, under asynclock */
+    chizu_insert_status status;
+    chizu_rect rect;
+    unsigned handle;
+};
+
+/*
+ * State files: this header, the sprite table, the map records of every
+ * plane, the names (NUL terminated) and, at a page aligned offset, the
+ * target pixels. Everything is in the byte order and layout of the machine
+ * that wrote it; the file is a cache, not an interchange format.
+ */
+typedef struct czstate_header {
+    char magic[8];
+    unsigned version;
+    unsigned endian;
+    unsigned format;
+    unsigned planes;
+    unsigned miplevels;
+    unsigned width, height;
+    unsigned sprites;
+    unsigned nodes[CHIZU_MAX_PLANES];
+    unsigned names;
+    unsigned long long pixels;
+} czstate_header;
+
+typedef struct czstate_sprite {
+    unsigned x, y, w, h;
+    unsigned channel;
+    unsigned name;
+} czstate_sprite;
+
+/*
+ * Shared memory segments: this header, maxsprites chizu_shared_sprite
+ * records, namebytes of names and, at a page aligned offset, the target
+ * pixels. Records and names are append only and the published count only
+ * grows, so readers never see anything change under them.
+ */
+typedef struct czshared_header {
+    char magic[8];
+    unsigned revision;
+    unsigned endian;
+    unsigned format;
+    unsigned width, height;
+    unsigned maxsprites, namebytes;
+    unsigned long long sprites, names, pixels;
+    volatile long published;
+    volatile long ready;
+} czshared_header;
+
+/* the writer can change the header at any time, so readers keep what they validated */
+struct chizu_shared {
+    czfile * segment;
+    const czshared_header * header;
+    const chizu_shared_sprite * sprites;
+    const char * names;
+    const void * pixels;
+    unsigned maxsprites, namebytes;
+    unsigned width, height;
+    chizu_pixel_format format;
+};
+
+struct chizu_cache {
+    czcache * cache;
 };
 
+/* sprites of a spec being opened, not yet in any atlas */
+typedef struct czopen {
+    czdata ** datas;
+    unsigned count, capacity;
+} czopen;
+
+typedef struct czstate_load {
+    czdata ** datas;
+    unsigned char * used;
+    unsigned count;
+} czstate_load;
+
+static const char chizu_state_magic[8] = { 'C', 'H', 'I', 'Z', 'U', 'S', 'T', 0 };
+static const char chizu_shared_magic[8] = { 'C', 'H', 'I', 'Z', 'U', 'S', 'M', 0 };
+
+typedef struct czmipdata {
+    czsurface * level;
+    unsigned index;
+} czmipdata;
+
+
 
 
 /* internal forward declarations */
@@ -63,69 +251,364 @@ static void chizu_internal_free(chizu * cz);
 static void czdata_internal_free(czdata * d);
 static void czdata_internal_destroy(void * d);
 static void czdata_internal_rect_export(czrect r, void * d, void * priv);
-static void czdata_internal_custom_rect_blit(czrect r, void * d, void * priv);
+static void czdata_internal_relocate(czrect r, void * d, void * priv);
+static void czdata_internal_collect(czrect r, void * d, void * priv);
+static int czdata_internal_compare_y(const void * a, const void * b);
+static void chizu_internal_compose(czdata ** sprites, unsigned count, czsurface * target);
+static void chizu_internal_compose_band(unsigned index, void * priv);
 static void chizu_internal_custom_rect_export(czrect r, void * d, void * priv);
 static chizu_export_status chizu_internal_export_map(chizu * atlas, const char * spec);
-static czrect chizu_internal_lease_or_enlarge(chizu * atlas, unsigned width, unsigned height, void * data);
+static void czdata_internal_spec_entry(czrect r, void * d, void * priv);
+static chizu_export_status chizu_internal_export_binary_map(chizu * atlas, const char * spec);
+static czrect chizu_internal_lease_or_enlarge(chizu * atlas, unsigned width, unsigned height, czdata * data);
+static void chizu_internal_foreach(chizu * atlas, czwalkfunc func, void * priv);
+static unsigned chizu_internal_best_plane(chizu * atlas, unsigned width, unsigned height, unsigned align);
+static unsigned chizu_internal_mip_align(unsigned levels, unsigned width, unsigned height);
+static czsurface * chizu_internal_load(chizu * atlas, const char * file);
+static czsurface * chizu_internal_decode(const char * file, void * priv);
+static void czdata_internal_blit(czdata * data, czsurface * target, czrect r);
+static chizu_insert_status chizu_internal_insert_surface(chizu * atlas, const char * file, czsurface * surface, unsigned * handle);
+static chizu_insert_status chizu_internal_place(chizu * atlas, const char * file, czsurface * surface, czdata ** placed);
+static czdata * chizu_internal_claim(chizu * atlas, const char * file, czsurface * surface);
+static int chizu_internal_same_pixels(chizu * atlas, czdata * data);
+static void chizu_internal_unreserve(chizu * atlas, czdata * data);
+static void czdata_internal_visit(czrect r, void * d, void * priv);
+static void czdata_internal_delta(czrect r, void * d, void * priv);
+static void chizu_internal_finish_insert(chizu * atlas, czdata * data);
+static void chizu_internal_insert_job(void * priv);
+static void chizu_internal_future_unref(chizu_future * future);
+static void chizu_internal_mark_placed(chizu * atlas, czdata ** placed, unsigned count);
+static int chizu_internal_publish(chizu * atlas, chizu_sprite * sprites, unsigned capacity);
+static void czdata_internal_relayout(czrect r, void * d, void * priv);
+static void czdata_internal_sprite(czdata * data, chizu_sprite * sprite);
+static void chizu_internal_sdf_load(unsigned index, void * priv);
+static chizu_export_status chizu_internal_export_texture(chizu * atlas, const char * texture, czsurface_save_format format);
+static void czdata_internal_fit_coverage(czrect r, void * d, void * priv);
+static void chizu_internal_mark_dirty(chizu * atlas, czrect r);
+static unsigned long chizu_internal_merged_area(czrect a, czrect b, czrect * merged);
+static void chizu_internal_coalesce(chizu * atlas, unsigned max);
+static int chizu_internal_pixel_format(chizu * atlas, chizu_pixel_format * format);
+static unsigned chizu_internal_code_entries(chizu * atlas, czspec_entry * entries);
+static unsigned chizu_internal_format_bytes(chizu_pixel_format format);
+static unsigned czdata_internal_state_index(void * d, void * priv);
+static void * czdata_internal_state_data(unsigned index, void * priv);
+static void czdata_internal_restore_rect(czrect r, void * d, void * priv);
+static void czdata_internal_check_rect(czrect r, void * d, void * priv);
+static void czdata_internal_materialize(czrect r, void * d, void * priv);
+static int chizu_internal_restore(chizu * atlas, czfile * file, const czstate_header * header);
+static void chizu_internal_unmap(void * file);
+static char * chizu_internal_read_spec(const char * path, size_t * size);
+static int chizu_internal_open_binary(czopen * open, const void * data, const czspec_info * info);
+static int chizu_internal_open_text(czopen * open, char * text, int * packed);
+static unsigned chizu_internal_spec_line(const char * line, unsigned * values, unsigned count);
+static int chizu_internal_open_sprite(czopen * open, char * name, const unsigned * values);
+static int chizu_internal_adopt(chizu * atlas, czopen * open, czsurface * target);
+static void chizu_internal_share(chizu * atlas, czdata ** placed, unsigned count);
+static void chizu_internal_export_uv(const chizu_sprite * sprites, unsigned count, int vertical, int far, float scale, float inset, chizu_uv_format format, void * out);
+
+void chizu_set_allocator(chizu_malloc_func m, chizu_realloc_func r, chizu_free_func f, void * user) {
+    czalloc_set(m, r, f, user);
+}
 
 chizu * chizu_create() {
-    chizu * cz = chizu_internal_alloc();
+    return chizu_create_format(CHIZU_PIXEL_RGBA8);
+}
+
+chizu * chizu_create_format(chizu_pixel_format format) {
+    chizu * cz = NULL;
+    unsigned channels = 0;
+    czsurface_type type = CZSURFACE_UINT8;
+    switch (format) {
+        case CHIZU_PIXEL_RGBA8: channels = 4; break;
+        case CHIZU_PIXEL_RGB8: channels = 3; break;
+        case CHIZU_PIXEL_LA8: channels = 2; break;
+        case CHIZU_PIXEL_L8: channels = 1; break;
+        case CHIZU_PIXEL_RGBA16F: channels = 4; type = CZSURFACE_FLOAT16; break;
+        case CHIZU_PIXEL_RGBA32F: channels = 4; type = CZSURFACE_FLOAT32; break;
+        default: return NULL;
+    }
+
+    cz = chizu_internal_alloc();
+    if (cz == NULL)
+        return NULL;
+    if (czthread_mutex_init(&cz->lock) != 0) {
+        chizu_internal_free(cz);
+        return NULL;
+    }
+    if (czthread_rwlock_init(&cz->targetlock) != 0) {
+        czthread_mutex_destroy(&cz->lock);
+        chizu_internal_free(cz);
+        return NULL;
+    }
+    if (czthread_mutex_init(&cz->asynclock) != 0) {
+        czthread_rwlock_destroy(&cz->targetlock);
+        czthread_mutex_destroy(&cz->lock);
+        chizu_internal_free(cz);
+        return NULL;
+    }
+    if (czthread_cond_init(&cz->asyncchange) != 0) {
+        czthread_mutex_destroy(&cz->asynclock);
+        czthread_rwlock_destroy(&cz->targetlock);
+        czthread_mutex_destroy(&cz->lock);
+        chizu_internal_free(cz);
+        return NULL;
+    }
+    cz->locksready = 1;
+    cz->channels = channels;
+    cz->type = type;
+    cz->planes = 1;
     cz->size.w = 2;
     cz->size.h = 2;
 
-    cz->map = czmap_create(cz->size.w, cz->size.h);
-    if (cz->map == NULL) {
-        chizu_internal_free(cz);
+    cz->maps[0] = czmap_create(cz->size.w, cz->size.h);
+    cz->target = czsurface_create(cz->size.w, cz->size.h, cz->channels, cz->type);
+    cz->epoch = czepoch_create();
+    cz->index = czindex_create();
+    if (cz->maps[0] == NULL || cz->target == NULL || cz->epoch == NULL || cz->index == NULL
+            || !chizu_internal_publish(cz, NULL, 0)) {
+        chizu_destroy(cz);
         return NULL;
     }
     return cz;
 }
 
-chizu_insert_status chizu_insert(chizu * atlas, const char * file) {
-    czsize surfsize;
-    czdata * data = czdata_internal_alloc();
-    czsurface * surface = czsurface_load(file);
-    if (surface == NULL) {
-        czdata_internal_free(data);
+chizu * chizu_create_channel_packed() {
+    unsigned i = 0;
+    chizu * cz = chizu_create_format(CHIZU_PIXEL_RGBA8);
+    if (cz == NULL)
+        return NULL;
+
+    for (i = 1; i < CHIZU_MAX_PLANES; i++) {
+        cz->maps[i] = czmap_create(cz->size.w, cz->size.h);
+        if (cz->maps[i] == NULL) {
+            chizu_destroy(cz);
+            return NULL;
+        }
+        cz->planes++;
+    }
+    return cz;
+}
+
+chizu_insert_status chizu_insert_scaled(chizu ** atlases, const float * scales, unsigned count, const char * file) {
+    chizu_insert_status status = CHIZU_INSERT_OK;
+    czsurface * source = NULL, * scaled = NULL;
+    czsize size, scaledsize;
+    czpoint origin = { 0, 0 };
+    unsigned i = 0;
+    if (count == 0)
+        return CHIZU_INSERT_OK;
+
+    source = chizu_internal_load(atlases[0], file);
+    if (source == NULL)
         return CHIZU_INSERT_FILEOPEN_FAIL;
+
+    size = czsurface_size(source);
+    for (i = 0; i < count; i++) {
+        scaledsize.w = (unsigned) (size.w * scales[i] + 0.5f);
+        scaledsize.h = (unsigned) (size.h * scales[i] + 0.5f);
+        if (scaledsize.w == 0) scaledsize.w = 1;
+        if (scaledsize.h == 0) scaledsize.h = 1;
+
+        if (scaledsize.w == size.w && scaledsize.h == size.h) {
+            scaled = czsurface_create(size.w, size.h, czsurface_channels(source), czsurface_pixel_type(source));
+            if (scaled != NULL)
+                czsurface_blit(source, scaled, origin);
+        } else {
+            scaled = czsurface_resize(source, scaledsize.w, scaledsize.h);
+        }
+
+        if (scaled == NULL)
+            status = CHIZU_INSERT_FAIL;
+        else if (chizu_internal_insert_surface(atlases[i], file, scaled, NULL) != CHIZU_INSERT_OK)
+            status = CHIZU_INSERT_FAIL;
     }
-    surfsize = czsurface_size(surface);
-    data->file = chizu_internal_strdup(file);
-    data->atlas = atlas;
-    data->surface = surface;
 
-    chizu_internal_lease_or_enlarge(atlas, surfsize.w, surfsize.h, data);
-    return CHIZU_INSERT_OK;
+    czsurface_destroy(source);
+    return status;
 }
 
+void chizu_set_mipmaps(chizu * atlas, unsigned levels) {
+    czthread_mutex_lock(&atlas->lock);
+    atlas->miplevels = levels < CHIZU_MAX_MIPLEVELS ? levels : CHIZU_MAX_MIPLEVELS;
+    czthread_mutex_unlock(&atlas->lock);
+}
 
-chizu_export_status chizu_export(chizu * atlas, const char * spec, const char * texture, chizu_export_format format) {
-    /* create surface target */
-    atlas->target = czsurface_create(atlas->size.w, atlas->size.h);
-    if (atlas->target == NULL) {
-        return CHIZU_EXPORT_TEXTURE_FAIL;
+void chizu_set_spec_format(chizu * atlas, chizu_spec_format format) {
+    atlas->specformat = format;
+}
+
+chizu_cache * chizu_cache_open(const char * dir, unsigned long long limit) {
+    chizu_cache * cache = czalloc_malloc(sizeof(chizu_cache));
+    if (cache == NULL)
+        return NULL;
+    cache->cache = czcache_open(dir, limit);
+    if (cache->cache == NULL) {
+        czalloc_free(cache);
+        return NULL;
     }
+    return cache;
+}
 
-    chizu_export_status status = CHIZU_EXPORT_OK;
-    if (chizu_internal_export_map(atlas, spec) != CHIZU_EXPORT_OK) {
-        status = CHIZU_EXPORT_SPEC_FAIL;
+void chizu_cache_close(chizu_cache * cache) {
+    if (cache == NULL)
+        return;
+    czcache_close(cache->cache);
+    czalloc_free(cache);
+}
+
+void chizu_set_cache(chizu * atlas, chizu_cache * cache) {
+    atlas->cache = cache;
+}
+
+chizu_insert_status chizu_insert(chizu * atlas, const char * file) {
+    czsurface * surface = chizu_internal_load(atlas, file);
+    return chizu_internal_insert_surface(atlas, file, surface, NULL);
+}
+
+chizu_insert_status chizu_insert_handle(chizu * atlas, const char * file, unsigned * handle) {
+    czsurface * surface = chizu_internal_load(atlas, file);
+    return chizu_internal_insert_surface(atlas, file, surface, handle);
+}
+
+chizu_future * chizu_insert_async(chizu * atlas, const char * file, chizu_insert_callback callback, void * priv) {
+    chizu_future * future = czalloc_calloc(1, sizeof(chizu_future));
+    if (future == NULL)
+        return NULL;
+    future->file = chizu_internal_strdup(file);
+    if (future->file == NULL) {
+        czalloc_free(future);
+        return NULL;
+    }
+    future->atlas = atlas;
+    future->callback = callback;
+    future->priv = priv;
+    future->refs = 2;
+
+    /* tickets are handed out in the same order jobs enter the queue */
+    czthread_mutex_lock(&atlas->asynclock);
+    if (atlas->pool == NULL)
+        atlas->pool = czpool_create(czthread_cpu_count());
+    future->ticket = atlas->submitted;
+    if (atlas->pool == NULL || !czpool_submit(atlas->pool, chizu_internal_insert_job, future)) {
+        czthread_mutex_unlock(&atlas->asynclock);
+        czalloc_free(future->file);
+        czalloc_free(future);
+        return NULL;
     }
+    atlas->submitted++;
+    atlas->pending++;
+    czthread_mutex_unlock(&atlas->asynclock);
+    return future;
+}
+
+int chizu_future_done(const chizu_future * future) {
+    return (int) czthread_atomic_load((volatile long *) &future->done);
+}
+
+chizu_insert_status chizu_future_wait(chizu_future * future, chizu_rect * rect) {
+    chizu * atlas = future->atlas;
+    czthread_mutex_lock(&atlas->asynclock);
+    while (!future->done)
+        czthread_cond_wait(&atlas->asyncchange, &atlas->asynclock);
+    czthread_mutex_unlock(&atlas->asynclock);
+    if (rect != NULL)
+        *rect = future->rect;
+    return future->status;
+}
 
+void chizu_future_release(chizu_future * future) {
+    chizu * atlas = NULL;
+    if (future == NULL)
+        return;
+    atlas = future->atlas;
+    czthread_mutex_lock(&atlas->asynclock);
+    chizu_internal_future_unref(future);
+    czthread_mutex_unlock(&atlas->asynclock);
+}
+
+void chizu_wait_all(chizu * atlas) {
+    czthread_mutex_lock(&atlas->asynclock);
+    while (atlas->pending > 0)
+        czthread_cond_wait(&atlas->asyncchange, &atlas->asynclock);
+    czthread_mutex_unlock(&atlas->asynclock);
+}
+
+chizu_insert_status chizu_insert_sdf(chizu * atlas, const char * file, unsigned downscale, unsigned spread) {
+    chizu_insert_status status = CHIZU_INSERT_FAIL;
+    chizu_insert_sdf_many(atlas, &file, 1, downscale, spread, &status);
+    return status;
+}
+
+unsigned chizu_insert_sdf_many(chizu * atlas, const char ** files, unsigned count, unsigned downscale, unsigned spread, chizu_insert_status * statuses) {
+    czsdfjob job;
+    unsigned i = 0, inserted = 0;
+    chizu_insert_status status;
+    czdata ** placed = NULL;
+
+    job.files = files;
+    job.downscale = downscale;
+    job.spread = spread;
+    job.surfaces = czalloc_calloc(count, sizeof(czsurface *));
+    placed = czalloc_calloc(count, sizeof(czdata *));
+    if (job.surfaces == NULL || placed == NULL) {
+        czalloc_free(job.surfaces);
+        czalloc_free(placed);
+        return 0;
+    }
+
+    /* loading and the distance transform run in parallel, packing does not */
+    czthread_parallel_for(count, chizu_internal_sdf_load, &job);
+
+    czthread_mutex_lock(&atlas->lock);
+    for (i = 0; i < count; i++) {
+        status = chizu_internal_place(atlas, files[i], job.surfaces[i], &placed[inserted]);
+        if (status == CHIZU_INSERT_OK)
+            inserted++;
+        if (statuses != NULL)
+            statuses[i] = status;
+    }
+    czthread_mutex_unlock(&atlas->lock);
+
+    /* then all of them are blitted in one go */
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    chizu_internal_compose(placed, inserted, atlas->target);
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    chizu_internal_mark_placed(atlas, placed, inserted);
+
+    czalloc_free(placed);
+    czalloc_free(job.surfaces);
+    return inserted;
+}
+
+
+chizu_export_status chizu_export(chizu * atlas, const char * spec, const char * texture, chizu_export_format format) {
+    chizu_export_status status = CHIZU_EXPORT_OK;
     czsurface_save_format sf;
     switch (format) {
         case CHIZU_FORMAT_PNG: sf = CZSURFACE_FORMAT_PNG; break;
         case CHIZU_FORMAT_TGA: sf = CZSURFACE_FORMAT_TGA; break;
         case CHIZU_FORMAT_HDR: sf = CZSURFACE_FORMAT_HDR; break;
         case CHIZU_FORMAT_BMP: sf = CZSURFACE_FORMAT_BMP; break;
+        case CHIZU_FORMAT_KTX2: sf = CZSURFACE_FORMAT_KTX2; break;
+        case CHIZU_FORMAT_PNG_INDEXED: sf = CZSURFACE_FORMAT_PNG_INDEXED; break;
+        case CHIZU_FORMAT_INDEXED: sf = CZSURFACE_FORMAT_INDEXED; break;
         default: return CHIZU_EXPORT_FAIL;
     }
 
-    if (czsurface_save(atlas->target, texture, sf) != CZSURFACE_SAVE_OK) {
+    czthread_mutex_lock(&atlas->lock);
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    if (chizu_internal_export_map(atlas, spec) != CHIZU_EXPORT_OK) {
+        status = CHIZU_EXPORT_SPEC_FAIL;
+    }
+
+    if (chizu_internal_export_texture(atlas, texture, sf) != CHIZU_EXPORT_OK) {
         if (status == CHIZU_EXPORT_OK)
             status = CHIZU_EXPORT_TEXTURE_FAIL;
         else
             status = CHIZU_EXPORT_SPEC_AND_TEXTURE_FAIL;
     }
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    czthread_mutex_unlock(&atlas->lock);
 
     return status;
 }
@@ -134,22 +617,711 @@ chizu_export_status chizu_custom_export(chizu * atlas, chizu_custom_export_func
     czfuncdata data;
     data.func = f;
     data.data = priv;
-    czmap_foreach(atlas->map, chizu_internal_custom_rect_export, &data);
+    data.status = CHIZU_EXPORT_OK;
+    czthread_mutex_lock(&atlas->lock);
+    chizu_internal_foreach(atlas, chizu_internal_custom_rect_export, &data);
+    czthread_mutex_unlock(&atlas->lock);
     return data.status;
 }
 
 void chizu_pixel_data(chizu * atlas, chizu_receive_pixel_data_func f, void * priv) {
-    czsurface * output = czsurface_create(atlas->size.w, atlas->size.h);
-    if (f != NULL) {
-        void * pixels = czsurface_pixels(output);
-        czmap_foreach(atlas->map, czdata_internal_custom_rect_blit, output);
-        f(pixels, atlas->size.w, atlas->size.h, 32, priv);
+    if (f == NULL)
+        return;
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    f(czsurface_pixels(atlas->target), atlas->size.w, atlas->size.h, czsurface_bpp(atlas->target) * 8, priv);
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+}
+
+chizu_export_status chizu_read_pixels(chizu * atlas, const chizu_rect * area, void * pixels, unsigned pitch, const unsigned char * swizzle) {
+    czrect r;
+    unsigned i = 0;
+    chizu_export_status status = CHIZU_EXPORT_FAIL;
+    for (i = 0; swizzle != NULL && i < atlas->channels; i++)
+        if (swizzle[i] >= atlas->channels)
+            return CHIZU_EXPORT_FAIL;
+
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    r.x = 0;
+    r.y = 0;
+    r.w = atlas->size.w;
+    r.h = atlas->size.h;
+    if (area != NULL) {
+        r.x = area->x;
+        r.y = area->y;
+        r.w = area->w;
+        r.h = area->h;
+    }
+    if (r.x <= atlas->size.w && r.w <= atlas->size.w - r.x && r.y <= atlas->size.h && r.h <= atlas->size.h - r.y
+        && (unsigned long) pitch >= (unsigned long) r.w * czsurface_bpp(atlas->target)) {
+        czsurface_read_swizzled(atlas->target, r, pixels, pitch, swizzle);
+        status = CHIZU_EXPORT_OK;
+    }
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    return status;
+}
+
+unsigned chizu_dirty_rects(chizu * atlas, chizu_rect * rects, unsigned max) {
+    unsigned i = 0, count = 0;
+    if (max == 0)
+        return 0;
+    czthread_mutex_lock(&atlas->lock);
+    chizu_internal_coalesce(atlas, max);
+    for (i = 0; i < atlas->dirtycount; i++) {
+        rects[i].x = atlas->dirty[i].x;
+        rects[i].y = atlas->dirty[i].y;
+        rects[i].w = atlas->dirty[i].w;
+        rects[i].h = atlas->dirty[i].h;
+    }
+    count = atlas->dirtycount;
+    atlas->dirtycount = 0;
+    czthread_mutex_unlock(&atlas->lock);
+    return count;
+}
+
+unsigned chizu_lookup(chizu * atlas, const char * name) {
+    unsigned handle = CHIZU_NO_HANDLE;
+    czthread_mutex_lock(&atlas->lock);
+    handle = czindex_get(atlas->index, name);
+    czthread_mutex_unlock(&atlas->lock);
+    return handle;
+}
+
+int chizu_lookup_rect(chizu * atlas, unsigned handle, chizu_rect * rect) {
+    int found = 0;
+    czthread_mutex_lock(&atlas->lock);
+    if (handle < atlas->published) {
+        rect->x = atlas->sprites[handle].x;
+        rect->y = atlas->sprites[handle].y;
+        rect->w = atlas->sprites[handle].w;
+        rect->h = atlas->sprites[handle].h;
+        found = 1;
+    }
+    czthread_mutex_unlock(&atlas->lock);
+    return found;
+}
+
+/* one pass per array, over the contiguous table of published sprites */
+unsigned chizu_layout_export(chizu * atlas, const chizu_layout_arrays * arrays, unsigned first, unsigned max) {
+    const chizu_sprite * sprites = NULL;
+    unsigned count = 0, i = 0;
+    float inset = arrays->inset ? 0.5f : 0.0f;
+    czthread_mutex_lock(&atlas->lock);
+    if (first < atlas->published)
+        count = atlas->published - first < max ? atlas->published - first : max;
+    sprites = atlas->sprites + first;
+    if (arrays->x != NULL)
+        for (i = 0; i < count; i++) arrays->x[i] = sprites[i].x;
+    if (arrays->y != NULL)
+        for (i = 0; i < count; i++) arrays->y[i] = sprites[i].y;
+    if (arrays->w != NULL)
+        for (i = 0; i < count; i++) arrays->w[i] = sprites[i].w;
+    if (arrays->h != NULL)
+        for (i = 0; i < count; i++) arrays->h[i] = sprites[i].h;
+    if (arrays->page != NULL)
+        for (i = 0; i < count; i++) arrays->page[i] = (unsigned char) sprites[i].channel;
+    if (arrays->rotated != NULL)
+        memset(arrays->rotated, 0, count);
+    chizu_internal_export_uv(sprites, count, 0, 0, 1.0f / atlas->size.w, inset, arrays->uvformat, arrays->u0);
+    chizu_internal_export_uv(sprites, count, 1, 0, 1.0f / atlas->size.h, inset, arrays->uvformat, arrays->v0);
+    chizu_internal_export_uv(sprites, count, 0, 1, 1.0f / atlas->size.w, inset, arrays->uvformat, arrays->u1);
+    chizu_internal_export_uv(sprites, count, 1, 1, 1.0f / atlas->size.h, inset, arrays->uvformat, arrays->v1);
+    czthread_mutex_unlock(&atlas->lock);
+    return count;
+}
+
+chizu_export_status chizu_export_header(chizu * atlas, const char * path, const char * prefix) {
+    czspec_entry * entries = NULL;
+    FILE * out = NULL;
+    unsigned count = 0;
+    int ok = 0;
+    czthread_mutex_lock(&atlas->lock);
+    entries = czalloc_malloc((atlas->published > 0 ? atlas->published : 1) * sizeof(czspec_entry));
+    if (entries != NULL) {
+        count = chizu_internal_code_entries(atlas, entries);
+        out = fopen(path, "w");
+    }
+    if (out != NULL) {
+        ok = czcode_write_header(out, prefix, entries, count, atlas->size.w, atlas->size.h);
+        ok = fclose(out) == 0 && ok;
+    }
+    czthread_mutex_unlock(&atlas->lock);
+    czalloc_free(entries);
+    return ok ? CHIZU_EXPORT_OK : CHIZU_EXPORT_SPEC_FAIL;
+}
+
+chizu_export_status chizu_export_source(chizu * atlas, const char * path, const char * prefix, chizu_embed_compression compression) {
+    static const char * formats[] = {
+        "CHIZU_PIXEL_RGBA8", "CHIZU_PIXEL_RGB8", "CHIZU_PIXEL_LA8",
+        "CHIZU_PIXEL_L8", "CHIZU_PIXEL_RGBA16F", "CHIZU_PIXEL_RGBA32F"
+    };
+    chizu_pixel_format format;
+    czspec_entry * entries = NULL;
+    unsigned char * packed = NULL;
+    const void * data = NULL;
+    size_t size = 0;
+    FILE * out = NULL;
+    unsigned count = 0;
+    int ok = 0;
+    if (!chizu_internal_pixel_format(atlas, &format) || (compression != CHIZU_EMBED_RAW && compression != CHIZU_EMBED_LZ4))
+        return CHIZU_EXPORT_FAIL;
+
+    czthread_mutex_lock(&atlas->lock);
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    data = czsurface_pixels(atlas->target);
+    size = (size_t) atlas->size.w * atlas->size.h * czsurface_bpp(atlas->target);
+    if (compression == CHIZU_EMBED_LZ4) {
+        packed = czalloc_malloc(czlz4_bound(size));
+        size = packed != NULL ? czlz4_compress(data, size, packed) : 0;
+        data = packed;
+    }
+    entries = czalloc_malloc((atlas->published > 0 ? atlas->published : 1) * sizeof(czspec_entry));
+    if (data != NULL && size > 0 && entries != NULL) {
+        count = chizu_internal_code_entries(atlas, entries);
+        out = fopen(path, "w");
+    }
+    if (out != NULL) {
+        ok = czcode_write_source(out, prefix, entries, count, atlas->size.w, atlas->size.h, formats[format],
+            compression == CHIZU_EMBED_LZ4 ? "CHIZU_EMBED_LZ4" : "CHIZU_EMBED_RAW", data, size);
+        ok = fclose(out) == 0 && ok;
+    }
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    czthread_mutex_unlock(&atlas->lock);
+    czalloc_free(entries);
+    czalloc_free(packed);
+    return ok ? CHIZU_EXPORT_OK : CHIZU_EXPORT_SPEC_FAIL;
+}
+
+int chizu_embedded_pixels(const chizu_embedded * embedded, void * pixels) {
+    size_t size = (size_t) embedded->width * embedded->height * chizu_internal_format_bytes(embedded->format);
+    if (size == 0)
+        return 0;
+    if (embedded->compression == CHIZU_EMBED_LZ4)
+        return czlz4_decompress(embedded->data, embedded->size, pixels, size);
+    if (embedded->compression != CHIZU_EMBED_RAW || embedded->size != size)
+        return 0;
+    memcpy(pixels, embedded->data, size);
+    return 1;
+}
+
+unsigned chizu_future_handle(chizu_future * future) {
+    chizu_future_wait(future, NULL);
+    return future->handle;
+}
+
+int chizu_layout_register(chizu * atlas) {
+    return czepoch_register(atlas->epoch);
+}
+
+void chizu_layout_unregister(chizu * atlas, int reader) {
+    czepoch_unregister(atlas->epoch, reader);
+}
+
+const chizu_layout * chizu_layout_acquire(chizu * atlas, int reader) {
+    czepoch_enter(atlas->epoch, reader);
+    return (const chizu_layout *) czthread_atomic_load_ptr(&atlas->layout);
+}
+
+void chizu_layout_release(chizu * atlas, int reader) {
+    czepoch_exit(atlas->epoch, reader);
+}
+
+/*
+ * Only published sprites are saved. Sprites still being inserted keep
+ * their (now unused) space in the saved maps, so they must be inserted
+ * again after loading.
+ */
+chizu_export_status chizu_save_state(chizu * atlas, const char * path) {
+    czstate_header header;
+    czstate_sprite sprite;
+    czmap_record * records = NULL;
+    chizu_pixel_format format;
+    unsigned i = 0, plane = 0, total = 0;
+    size_t pixelbytes = 0, written = 0;
+    unsigned long long offset = 0;
+    char zero[64] = { 0 };
+    int ok = 1;
+    FILE * out = NULL;
+
+    if (!chizu_internal_pixel_format(atlas, &format))
+        return CHIZU_EXPORT_FAIL;
+    out = fopen(path, "wb");
+    if (out == NULL)
+        return CHIZU_EXPORT_FAIL;
+
+    czthread_mutex_lock(&atlas->lock);
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, chizu_state_magic, sizeof(header.magic));
+    header.version = CHIZU_STATE_VERSION;
+    header.endian = 0x01020304;
+    header.format = (unsigned) format;
+    header.planes = atlas->planes;
+    header.miplevels = atlas->miplevels;
+    header.width = atlas->size.w;
+    header.height = atlas->size.h;
+    header.sprites = atlas->published;
+    for (plane = 0; plane < atlas->planes; plane++) {
+        header.nodes[plane] = czmap_node_count(atlas->maps[plane]);
+        if (header.nodes[plane] > total)
+            total = header.nodes[plane];
+    }
+    for (i = 0; i < atlas->published; i++)
+        header.names += (unsigned) strlen(atlas->sprites[i].name) + 1;
+    offset = sizeof(header) + (unsigned long long) header.sprites * sizeof(czstate_sprite) + header.names;
+    for (plane = 0; plane < atlas->planes; plane++)
+        offset += (unsigned long long) header.nodes[plane] * sizeof(czmap_record);
+    header.pixels = (offset + CHIZU_STATE_ALIGN - 1) & ~(unsigned long long) (CHIZU_STATE_ALIGN - 1);
+
+    records = czalloc_malloc(total * sizeof(czmap_record));
+    ok = records != NULL && fwrite(&header, sizeof(header), 1, out) == 1;
+
+    for (i = 0; ok && i < atlas->published; i++) {
+        sprite.x = atlas->sprites[i].x;
+        sprite.y = atlas->sprites[i].y;
+        sprite.w = atlas->sprites[i].w;
+        sprite.h = atlas->sprites[i].h;
+        sprite.channel = atlas->sprites[i].channel;
+        sprite.name = (unsigned) written;
+        written += strlen(atlas->sprites[i].name) + 1;
+        ok = fwrite(&sprite, sizeof(sprite), 1, out) == 1;
+    }
+    for (plane = 0; ok && plane < atlas->planes; plane++) {
+        czmap_flatten(atlas->maps[plane], records, czdata_internal_state_index, NULL);
+        ok = fwrite(records, sizeof(czmap_record), header.nodes[plane], out) == header.nodes[plane];
+    }
+    for (i = 0; ok && i < atlas->published; i++)
+        ok = fwrite(atlas->sprites[i].name, strlen(atlas->sprites[i].name) + 1, 1, out) == 1;
+    while (ok && offset < header.pixels) {
+        size_t pad = header.pixels - offset > sizeof(zero) ? sizeof(zero) : (size_t) (header.pixels - offset);
+        ok = fwrite(zero, 1, pad, out) == pad;
+        offset += pad;
+    }
+    pixelbytes = (size_t) atlas->size.w * atlas->size.h * czsurface_bpp(atlas->target);
+    if (ok)
+        ok = fwrite(czsurface_pixels(atlas->target), 1, pixelbytes, out) == pixelbytes;
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    czthread_mutex_unlock(&atlas->lock);
+
+    czalloc_free(records);
+    if (fclose(out) != 0)
+        ok = 0;
+    return ok ? CHIZU_EXPORT_OK : CHIZU_EXPORT_FAIL;
+}
+
+chizu * chizu_load_state(const char * path) {
+    czfile * file = czfile_map(path);
+    const czstate_header * header = NULL;
+    chizu * atlas = NULL;
+    if (file == NULL)
+        return NULL;
+    header = (const czstate_header *) czfile_data(file);
+    if (czfile_size(file) < sizeof(czstate_header)
+            || memcmp(header->magic, chizu_state_magic, sizeof(header->magic)) != 0
+            || header->version != CHIZU_STATE_VERSION || header->endian != 0x01020304
+            || (header->planes != 1 && (header->planes != CHIZU_MAX_PLANES || header->format != CHIZU_PIXEL_RGBA8))
+            || header->miplevels > CHIZU_MAX_MIPLEVELS) {
+        czfile_unmap(file);
+        return NULL;
+    }
+
+    atlas = header->planes > 1 ? chizu_create_channel_packed() : chizu_create_format((chizu_pixel_format) header->format);
+    if (atlas == NULL) {
+        czfile_unmap(file);
+        return NULL;
+    }
+    if (!chizu_internal_restore(atlas, file, header)) {
+        czfile_unmap(file);
+        chizu_destroy(atlas);
+        return NULL;
+    }
+    return atlas;
+}
+
+/*
+ * Opens an exported atlas to append to it: the layout comes from the spec,
+ * text or binary, the pixels from the texture, decoded once. Free space
+ * between the sprites is found again, so new inserts fill it before the
+ * atlas grows, and only they are reported by chizu_dirty_rects.
+ */
+chizu * chizu_open(const char * spec, const char * texture) {
+    czopen open;
+    czspec_info info;
+    czsurface * target = NULL;
+    chizu * atlas = NULL;
+    char * text = NULL;
+    size_t size = 0;
+    unsigned i = 0;
+    int binary = 0, packed = 0, ok = 0;
+
+    open.datas = NULL;
+    open.count = 0;
+    open.capacity = 0;
+    text = chizu_internal_read_spec(spec, &size);
+    target = czsurface_load(texture, 0, CZSURFACE_UINT8);
+    if (text != NULL && target != NULL) {
+        binary = czspec_open(text, size, &info);
+        if (binary) {
+            packed = info.packed;
+            ok = info.width == czsurface_size(target).w && info.height == czsurface_size(target).h
+                && chizu_internal_open_binary(&open, text, &info);
+        } else {
+            ok = chizu_internal_open_text(&open, text, &packed);
+        }
+    }
+    czalloc_free(text);
+
+    /* channel packed atlases are saved as RGBA, everything else as its own format */
+    if (ok && packed) {
+        atlas = czsurface_channels(target) == 4 ? chizu_create_channel_packed() : NULL;
+    } else if (ok) {
+        switch (czsurface_channels(target)) {
+            case 1: atlas = chizu_create_format(CHIZU_PIXEL_L8); break;
+            case 2: atlas = chizu_create_format(CHIZU_PIXEL_LA8); break;
+            case 3: atlas = chizu_create_format(CHIZU_PIXEL_RGB8); break;
+            case 4: atlas = chizu_create_format(CHIZU_PIXEL_RGBA8); break;
+            default: break;
+        }
+    }
+    if (atlas != NULL && chizu_internal_adopt(atlas, &open, target)) {
+        chizu_set_spec_format(atlas, binary ? CHIZU_SPEC_BINARY : CHIZU_SPEC_TEXT);
+        czalloc_free(open.datas);
+        return atlas;
     }
+
+    if (atlas != NULL)
+        chizu_destroy(atlas);
+    czsurface_destroy(target);
+    for (i = 0; i < open.count; i++)
+        czdata_internal_destroy(open.datas[i]);
+    czalloc_free(open.datas);
+    return NULL;
+}
+
+/*
+ * Reserves the places subimages had in the previous layout. Inserting one
+ * with the same name and size claims its reservation, so it stays where it
+ * was; everything else is packed in the space left, and growing the atlas
+ * moves nothing. Only for new, empty atlases; 0 leaves the atlas as it was.
+ */
+int chizu_set_stable_layout(chizu * atlas, const char * spec, const char * texture) {
+    czopen open;
+    czspec_info info;
+    czmap * maps[CHIZU_MAX_PLANES] = { NULL, NULL, NULL, NULL };
+    czmap_placement * placements = NULL;
+    czsurface * target = NULL, * previous = NULL;
+    czindex * index = NULL;
+    czsize size = { 2, 2 };
+    char * text = NULL;
+    size_t bytes = 0;
+    unsigned i = 0, plane = 0, count = 0;
+    int ok = 0, packed = 0;
+
+    if (atlas->shared != NULL || atlas->stable || atlas->count > 0)
+        return 0;
+    open.datas = NULL;
+    open.count = 0;
+    open.capacity = 0;
+    text = chizu_internal_read_spec(spec, &bytes);
+    if (text != NULL && czspec_open(text, bytes, &info)) {
+        size.w = info.width;
+        size.h = info.height;
+        ok = chizu_internal_open_binary(&open, text, &info);
+    } else if (text != NULL) {
+        ok = chizu_internal_open_text(&open, text, &packed);
+    }
+    czalloc_free(text);
+
+    /* text specs do not tell the size, but it only has to hold every subimage */
+    for (i = 0; ok && i < open.count; i++) {
+        czrect r = open.datas[i]->rect;
+        ok = open.datas[i]->channel < atlas->planes;
+        if (r.x + r.w > size.w)
+            size.w = r.x + r.w;
+        if (r.y + r.h > size.h)
+            size.h = r.y + r.h;
+    }
+    size.w = chizu_internal_next_power_of_2(size.w);
+    size.h = chizu_internal_next_power_of_2(size.h);
+    if (ok) {
+        placements = czalloc_malloc((open.count > 0 ? open.count : 1) * sizeof(czmap_placement));
+        index = czindex_create();
+        target = czsurface_create(size.w, size.h, atlas->channels, atlas->type);
+        ok = placements != NULL && index != NULL && target != NULL;
+    }
+    for (plane = 0; ok && plane < atlas->planes; plane++) {
+        for (i = 0, count = 0; i < open.count; i++) {
+            if (open.datas[i]->channel != plane)
+                continue;
+            placements[count].rect = open.datas[i]->rect;
+            placements[count++].data = open.datas[i];
+        }
+        ok = (maps[plane] = czmap_build(size.w, size.h, placements, count)) != NULL;
+    }
+    for (i = 0; ok && i < open.count; i++)
+        ok = czindex_put(index, open.datas[i]->file, i);
+    czalloc_free(placements);
+    if (!ok) {
+        for (plane = 0; plane < CHIZU_MAX_PLANES; plane++)
+            if (maps[plane] != NULL)
+                czmap_destroy(maps[plane], NULL);
+        for (i = 0; i < open.count; i++)
+            czdata_internal_destroy(open.datas[i]);
+        czalloc_free(open.datas);
+        czindex_destroy(index);
+        czsurface_destroy(target);
+        return 0;
+    }
+
+    /* without the previous pixels every kept subimage counts as changed */
+    if (texture != NULL)
+        previous = czsurface_load(texture, atlas->planes > 1 ? 4 : atlas->channels, atlas->type);
+    for (i = 0; i < open.count; i++) {
+        open.datas[i]->atlas = atlas;
+        open.datas[i]->slot = CHIZU_UNPUBLISHED;
+        open.datas[i]->state = CZDATA_RESERVED;
+    }
+
+    czthread_mutex_lock(&atlas->lock);
+    czthread_rwlock_write_lock(&atlas->targetlock);
+    for (plane = 0; plane < atlas->planes; plane++) {
+        czmap_destroy(atlas->maps[plane], czdata_internal_destroy);
+        atlas->maps[plane] = maps[plane];
+    }
+    czsurface_destroy(atlas->target);
+    atlas->target = target;
+    atlas->size = size;
+    czthread_rwlock_write_unlock(&atlas->targetlock);
+    atlas->stable = 1;
+    atlas->reserved = open.datas;
+    atlas->reservedcount = open.count;
+    atlas->reservedindex = index;
+    atlas->previous = previous;
+    chizu_internal_publish(atlas, atlas->sprites, atlas->capacity);
+    czthread_mutex_unlock(&atlas->lock);
+    return 1;
+}
+
+/*
+ * One line per subimage that differs from the previous layout: added ones,
+ * moved ones (their size changed, or their place was taken), changed ones
+ * (same place, other pixels) and removed ones, at the place they had.
+ */
+chizu_export_status chizu_export_delta(chizu * atlas, const char * path) {
+    unsigned plane = 0;
+    int ok = 1;
+    FILE * out = fopen(path, "w");
+    if (out == NULL)
+        return CHIZU_EXPORT_FAIL;
+    czthread_mutex_lock(&atlas->lock);
+    atlas->output = out;
+    for (plane = 0; plane < atlas->planes; plane++)
+        czmap_foreach(atlas->maps[plane], czdata_internal_delta, NULL);
+    atlas->output = NULL;
+    czthread_mutex_unlock(&atlas->lock);
+    ok = !ferror(out);
+    if (fclose(out) != 0)
+        ok = 0;
+    return ok ? CHIZU_EXPORT_OK : CHIZU_EXPORT_FAIL;
+}
+
+chizu * chizu_create_shared(const char * name, chizu_pixel_format format, unsigned width, unsigned height, unsigned maxsprites) {
+    chizu * atlas = NULL;
+    czfile * segment = NULL;
+    czshared_header * header = NULL;
+    czsurface * target = NULL;
+    czmap * map = NULL;
+    unsigned long long size = 0, pixelbytes = 0;
+    if (width == 0 || height == 0 || maxsprites == 0 || maxsprites > ~0u / CHIZU_SHARED_NAME_BYTES)
+        return NULL;
+    atlas = chizu_create_format(format);
+    if (atlas == NULL)
+        return NULL;
+
+    pixelbytes = (unsigned long long) width * height * czsurface_bpp(atlas->target);
+    size = sizeof(czshared_header) + (unsigned long long) maxsprites * sizeof(chizu_shared_sprite)
+        + (unsigned long long) maxsprites * CHIZU_SHARED_NAME_BYTES;
+    size = (size + CHIZU_STATE_ALIGN - 1) & ~(unsigned long long) (CHIZU_STATE_ALIGN - 1);
+    if (size + pixelbytes != (size_t) (size + pixelbytes)
+            || (segment = czfile_create_shared(name, (size_t) (size + pixelbytes))) == NULL) {
+        chizu_destroy(atlas);
+        return NULL;
+    }
+
+    header = (czshared_header *) czfile_data(segment);
+    memcpy(header->magic, chizu_shared_magic, sizeof(header->magic));
+    header->revision = CHIZU_SHARED_REVISION;
+    header->endian = 0x01020304;
+    header->format = (unsigned) format;
+    header->width = width;
+    header->height = height;
+    header->maxsprites = maxsprites;
+    header->namebytes = maxsprites * CHIZU_SHARED_NAME_BYTES;
+    header->sprites = sizeof(czshared_header);
+    header->names = header->sprites + (unsigned long long) maxsprites * sizeof(chizu_shared_sprite);
+    header->pixels = size;
+
+    /* the target is the segment, and unmaps it when destroyed */
+    map = czmap_create(width, height);
+    target = czsurface_wrap((unsigned char *) header + header->pixels, width, height,
+                           atlas->channels, atlas->type, chizu_internal_unmap, segment);
+    if (map == NULL || target == NULL) {
+        if (map != NULL)
+            czmap_destroy(map, NULL);
+        czfile_unmap(segment);
+        chizu_destroy(atlas);
+        return NULL;
+    }
+    czmap_destroy(atlas->maps[0], NULL);
+    atlas->maps[0] = map;
+    czsurface_destroy(atlas->target);
+    atlas->target = target;
+    atlas->size.w = width;
+    atlas->size.h = height;
+    atlas->shared = header;
+    chizu_internal_publish(atlas, NULL, 0);
+    czthread_atomic_store(&header->ready, 1);
+    return atlas;
+}
+
+chizu_shared * chizu_attach_shared(const char * name) {
+    chizu_shared * shared = NULL;
+    const czshared_header * header = NULL;
+    const unsigned char * base = NULL;
+    czshared_header copy;
+    unsigned long long size = 0;
+    unsigned bytes = 0;
+    czfile * segment = czfile_open_shared(name);
+    if (segment == NULL)
+        return NULL;
+    header = (const czshared_header *) czfile_data(segment);
+    base = (const unsigned char *) header;
+    size = czfile_size(segment);
+    if (size < sizeof(czshared_header) || !czthread_atomic_load((volatile long *) &header->ready)) {
+        czfile_unmap(segment);
+        return NULL;
+    }
+
+    /* checks and uses one copy of the header, whatever the writer does meanwhile */
+    memcpy(&copy, header, sizeof(copy));
+    bytes = chizu_internal_format_bytes((chizu_pixel_format) copy.format);
+    if (memcmp(copy.magic, chizu_shared_magic, sizeof(copy.magic)) != 0
+            || copy.revision != CHIZU_SHARED_REVISION || copy.endian != 0x01020304 || bytes == 0
+            || copy.sprites < sizeof(czshared_header) || copy.sprites % sizeof(unsigned) != 0
+            || copy.sprites + (unsigned long long) copy.maxsprites * sizeof(chizu_shared_sprite) > copy.names
+            || copy.names + copy.namebytes > copy.pixels || copy.pixels > size
+            || (unsigned long long) copy.width * copy.height > (size - copy.pixels) / bytes
+            || (shared = czalloc_malloc(sizeof(chizu_shared))) == NULL) {
+        czfile_unmap(segment);
+        return NULL;
+    }
+    shared->segment = segment;
+    shared->header = header;
+    shared->sprites = (const chizu_shared_sprite *) (base + copy.sprites);
+    shared->names = (const char *) base + copy.names;
+    shared->pixels = base + copy.pixels;
+    shared->maxsprites = copy.maxsprites;
+    shared->namebytes = copy.namebytes;
+    shared->width = copy.width;
+    shared->height = copy.height;
+    shared->format = (chizu_pixel_format) copy.format;
+    return shared;
+}
+
+unsigned long chizu_shared_version(chizu_shared * shared) {
+    return (unsigned long) czthread_atomic_load((volatile long *) &shared->header->published);
+}
+
+const chizu_shared_sprite * chizu_shared_layout(chizu_shared * shared, unsigned * count) {
+    unsigned long published = chizu_shared_version(shared);
+    *count = published < shared->maxsprites ? (unsigned) published : shared->maxsprites;
+    return shared->sprites;
+}
+
+/* an empty name for offsets outside the names, or names running past them */
+const char * chizu_shared_name(chizu_shared * shared, const chizu_shared_sprite * sprite) {
+    unsigned offset = sprite->name;
+    if (offset >= shared->namebytes || memchr(shared->names + offset, 0, shared->namebytes - offset) == NULL)
+        return "";
+    return shared->names + offset;
+}
+
+const void * chizu_shared_pixels(chizu_shared * shared, unsigned * width, unsigned * height, chizu_pixel_format * format) {
+    if (width != NULL) *width = shared->width;
+    if (height != NULL) *height = shared->height;
+    if (format != NULL) *format = shared->format;
+    return shared->pixels;
+}
+
+void chizu_detach_shared(chizu_shared * shared) {
+    if (shared == NULL)
+        return;
+    czfile_unmap(shared->segment);
+    czalloc_free(shared);
+}
+
+int chizu_spec_open(chizu_spec * spec, const void * data, size_t size) {
+    czspec_info info;
+    if (!czspec_open(data, size, &info))
+        return 0;
+    spec->data = data;
+    spec->count = info.count;
+    spec->width = info.width;
+    spec->height = info.height;
+    spec->packed = info.packed;
+    return 1;
+}
+
+unsigned chizu_spec_find(const chizu_spec * spec, const char * name) {
+    unsigned index = czspec_find(spec->data, name);
+    return index == CZSPEC_MISSING ? CHIZU_NO_HANDLE : index;
+}
+
+int chizu_spec_rect(const chizu_spec * spec, unsigned index, chizu_rect * rect, unsigned * channel) {
+    czspec_entry entry;
+    if (index >= spec->count)
+        return 0;
+    czspec_entry_at(spec->data, index, &entry);
+    rect->x = entry.x;
+    rect->y = entry.y;
+    rect->w = entry.w;
+    rect->h = entry.h;
+    if (channel != NULL)
+        *channel = entry.channel;
+    return 1;
+}
+
+unsigned chizu_spec_name(const chizu_spec * spec, unsigned index, char * name, unsigned size) {
+    if (index >= spec->count) {
+        if (size > 0)
+            name[0] = 0;
+        return 0;
+    }
+    return czspec_name(spec->data, index, name, size);
 }
 
 void chizu_destroy(chizu * atlas) {
-    czmap_destroy(atlas->map, czdata_internal_destroy);
+    unsigned i = 0;
+    if (atlas->pool != NULL) {
+        chizu_wait_all(atlas);
+        czpool_destroy(atlas->pool);
+    }
+    for (i = 0; i < atlas->planes; i++)
+        if (atlas->maps[i] != NULL)
+            czmap_destroy(atlas->maps[i], czdata_internal_destroy);
     czsurface_destroy(atlas->target);
+    czalloc_free(atlas->layout);
+    czalloc_free(atlas->sprites);
+    czepoch_destroy(atlas->epoch);
+    czindex_destroy(atlas->index);
+    czalloc_free(atlas->reserved);
+    czindex_destroy(atlas->reservedindex);
+    czsurface_destroy(atlas->previous);
+    if (atlas->locksready) {
+        czthread_cond_destroy(&atlas->asyncchange);
+        czthread_mutex_destroy(&atlas->asynclock);
+        czthread_rwlock_destroy(&atlas->targetlock);
+        czthread_mutex_destroy(&atlas->lock);
+    }
     chizu_internal_free(atlas);
 }
 
@@ -168,45 +1340,151 @@ static unsigned chizu_internal_next_power_of_2(unsigned n) {
 }
 
 static chizu * chizu_internal_alloc() {
-    chizu * cz = calloc(sizeof(chizu), 1);
+    chizu * cz = czalloc_calloc(sizeof(chizu), 1);
     return cz;
 }
 
 static czdata * czdata_internal_alloc() {
-    czdata * d = calloc(sizeof(czdata), 1);
+    czdata * d = czalloc_calloc(sizeof(czdata), 1);
     return d;
 }
 
 static void chizu_internal_free(chizu * cz) {
-    free(cz);
+    czalloc_free(cz);
 }
 
 static void czdata_internal_free(czdata * d) {
-    free(d);
+    czalloc_free(d);
 }
 
 static void czdata_internal_destroy(void * d) {
     czdata * data = (czdata *) d;
     if (d == NULL)
         return;
-    free(data->file);
+    czalloc_free(data->file);
     czsurface_destroy(data->surface);
     czdata_internal_free(data);
 }
 
 static void czdata_internal_rect_export(czrect r, void * d, void * priv) {
     czdata * data = (czdata *) d;
-    czpoint dst = { r.x, r.y };
     FILE * out = data->atlas->output;
-    fprintf(out, "%s %d %d %d %d\n", data->file, r.x, r.y, r.w, r.h);
-    czsurface_blit(data->surface, data->atlas->target, dst);
+    if (data->atlas->planes > 1)
+        fprintf(out, "%s %d %d %d %d %d\n", data->file, r.x, r.y, data->size.w, data->size.h, data->channel);
+    else
+        fprintf(out, "%s %d %d %d %d\n", data->file, r.x, r.y, data->size.w, data->size.h);
 }
 
-static void czdata_internal_custom_rect_blit(czrect r, void * d, void * priv) {
-    czsurface * output = (czsurface *) priv;
+static void czdata_internal_delta(czrect r, void * d, void * priv) {
     czdata * data = (czdata *) d;
+    FILE * out = data->atlas->output;
+    const char * change = "added";
+    if (data->state == CZDATA_KEPT || data->state == CZDATA_SUPERSEDED)
+        return;
+    if (data->state == CZDATA_RESERVED)
+        change = "removed";
+    else if (data->state == CZDATA_CHANGED)
+        change = "changed";
+    else if (data->state == CZDATA_MOVED)
+        change = "moved";
+    if (data->atlas->planes > 1)
+        fprintf(out, "%s %s %d %d %d %d %d", change, data->file, r.x, r.y, data->size.w, data->size.h, data->channel);
+    else
+        fprintf(out, "%s %s %d %d %d %d", change, data->file, r.x, r.y, data->size.w, data->size.h);
+
+    /* moved ones also tell where they were, so no removed line is needed */
+    if (data->state == CZDATA_MOVED && data->atlas->planes > 1)
+        fprintf(out, " %d %d %d %d %d", data->was.x, data->was.y, data->was.w, data->was.h, data->waschannel);
+    else if (data->state == CZDATA_MOVED)
+        fprintf(out, " %d %d %d %d", data->was.x, data->was.y, data->was.w, data->was.h);
+    fputc('\n', out);
+}
+
+/* sprites move when the maps are enlarged, so they are blitted again into the new target */
+static void czdata_internal_relocate(czrect r, void * d, void * priv) {
+    czdata * data = (czdata *) d;
+    data->rect = r;
+    czdata_internal_blit(data, (czsurface *) priv, r);
+}
+
+/* same as relocate, but leaves blitting for chizu_internal_compose */
+static void czdata_internal_collect(czrect r, void * d, void * priv) {
+    czcompose * compose = (czcompose *) priv;
+    czdata * data = (czdata *) d;
+    data->rect = r;
+    compose->sprites[compose->count++] = data;
+}
+
+static int czdata_internal_compare_y(const void * a, const void * b) {
+    const czdata * da = *(const czdata * const *) a;
+    const czdata * db = *(const czdata * const *) b;
+    if (da->rect.y != db->rect.y)
+        return da->rect.y < db->rect.y ? -1 : 1;
+    if (da->rect.x != db->rect.x)
+        return da->rect.x < db->rect.x ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Blits sprites into target at their rects. Sprites are sorted top to
+ * bottom and cut in bands of about the same number of pixels, each band
+ * blitted by whichever thread takes it. Leases never overlap (sprites of
+ * channel packed atlases share pixels but not bytes), so no locking is
+ * needed.
+ */
+static void chizu_internal_compose(czdata ** sprites, unsigned count, czsurface * target) {
+    czcompose compose;
+    unsigned long total = 0, budget = 0, acc = 0;
+    unsigned i = 0, bands = 0;
+
+    for (i = 0; i < count; i++)
+        total += (unsigned long) sprites[i]->size.w * sprites[i]->size.h;
+    bands = czthread_cpu_count() * CHIZU_COMPOSE_BANDS_PER_CPU;
+    if (bands > count)
+        bands = count;
+
+    compose.sprites = sprites;
+    compose.target = target;
+    compose.bands = NULL;
+    if (total >= CHIZU_SERIAL_COMPOSE_PIXELS && bands > 1)
+        compose.bands = czalloc_malloc((bands + 1) * sizeof(unsigned));
+    if (compose.bands == NULL) {
+        for (i = 0; i < count; i++)
+            czdata_internal_blit(sprites[i], target, sprites[i]->rect);
+        return;
+    }
+
+    qsort(sprites, count, sizeof(czdata *), czdata_internal_compare_y);
+    budget = total / bands;
+    compose.count = 0;
+    compose.bands[0] = 0;
+    for (i = 0; i < count; i++) {
+        acc += (unsigned long) sprites[i]->size.w * sprites[i]->size.h;
+        if (acc >= budget && compose.count + 1 < bands) {
+            compose.bands[++compose.count] = i + 1;
+            acc = 0;
+        }
+    }
+    if (compose.bands[compose.count] != count)
+        compose.bands[++compose.count] = count;
+
+    czthread_parallel_for(compose.count, chizu_internal_compose_band, &compose);
+    czalloc_free(compose.bands);
+}
+
+static void chizu_internal_compose_band(unsigned index, void * priv) {
+    czcompose * compose = (czcompose *) priv;
+    unsigned i = 0;
+    for (i = compose->bands[index]; i < compose->bands[index + 1]; i++)
+        czdata_internal_blit(compose->sprites[i], compose->target, compose->sprites[i]->rect);
+}
+
+static void czdata_internal_blit(czdata * data, czsurface * target, czrect r) {
     czpoint dst = { r.x, r.y };
-    czsurface_blit(data->surface, output, dst);
+    if (data->atlas->planes > 1)
+        czsurface_blit_channel(data->surface, target, dst, data->channel);
+    else
+        czsurface_blit(data->surface, target, dst);
 }
 
 
@@ -217,58 +1495,1105 @@ static void chizu_internal_custom_rect_export(czrect r, void * d, void * priv) {
     exportdata.subfile = data->file;
     exportdata.x = r.x;
     exportdata.y = r.y;
-    exportdata.w = r.w;
-    exportdata.h = r.h;
-    funcdata->status = funcdata->func(&exportdata, priv);
+    exportdata.w = data->size.w;
+    exportdata.h = data->size.h;
+    exportdata.channel = data->channel;
+    funcdata->status = funcdata->func(&exportdata, funcdata->data);
     if (funcdata->status != CHIZU_EXPORT_OK)
         funcdata->status = CHIZU_EXPORT_FAIL;
 }
 
 
 static chizu_export_status chizu_internal_export_map(chizu * atlas, const char * spec) {
+    if (atlas->specformat == CHIZU_SPEC_BINARY)
+        return chizu_internal_export_binary_map(atlas, spec);
     atlas->output = fopen(spec, "w+");
     if (atlas->output == NULL) {
         return CHIZU_EXPORT_SPEC_FAIL;
     }
-    czmap_foreach(atlas->map, czdata_internal_rect_export, NULL);
+    chizu_internal_foreach(atlas, czdata_internal_rect_export, NULL);
     fclose(atlas->output);
     atlas->output = NULL;
     return CHIZU_EXPORT_OK;
 }
 
-static czrect chizu_internal_lease_or_enlarge(chizu * atlas, unsigned width, unsigned height, void * data) {
+static void czdata_internal_spec_entry(czrect r, void * d, void * priv) {
+    czspecdata * specdata = (czspecdata *) priv;
+    czdata * data = (czdata *) d;
+    czspec_entry * entry = NULL;
+    if (specdata->count >= specdata->capacity)
+        return;
+    entry = &specdata->entries[specdata->count++];
+    entry->name = data->file;
+    entry->x = r.x;
+    entry->y = r.y;
+    entry->w = data->size.w;
+    entry->h = data->size.h;
+    entry->channel = data->channel;
+}
+
+static chizu_export_status chizu_internal_export_binary_map(chizu * atlas, const char * spec) {
+    czspecdata specdata;
+    int ok = 0;
+    specdata.count = 0;
+    specdata.capacity = atlas->count;
+    specdata.entries = czalloc_malloc((atlas->count > 0 ? atlas->count : 1) * sizeof(czspec_entry));
+    if (specdata.entries == NULL)
+        return CHIZU_EXPORT_SPEC_FAIL;
+    chizu_internal_foreach(atlas, czdata_internal_spec_entry, &specdata);
+
+    atlas->output = fopen(spec, "wb");
+    if (atlas->output != NULL) {
+        ok = czspec_write(atlas->output, specdata.entries, specdata.count, atlas->size.w, atlas->size.h, atlas->planes > 1);
+        ok = fclose(atlas->output) == 0 && ok;
+        atlas->output = NULL;
+    }
+    czalloc_free(specdata.entries);
+    return ok ? CHIZU_EXPORT_OK : CHIZU_EXPORT_SPEC_FAIL;
+}
+
+/*
+ * Saves the target and, if asked for, its mip levels: all in one file for
+ * KTX2 or as numbered files otherwise.
+ */
+static chizu_export_status chizu_internal_export_texture(chizu * atlas, const char * texture, czsurface_save_format format) {
+    chizu_export_status status = CHIZU_EXPORT_OK;
+    czsurface * levels[CHIZU_MAX_MIPLEVELS + 1];
+    czmipdata mip;
+    unsigned count = 1, i = 0;
+    size_t length = strlen(texture);
+    const char * ext = strrchr(texture, '.');
+    char * name = NULL;
+    int srgb = atlas->planes == 1 && atlas->type == CZSURFACE_UINT8;
+
+    levels[0] = atlas->target;
+    for (mip.index = 1; mip.index <= atlas->miplevels && mip.index <= CHIZU_MAX_MIPLEVELS; mip.index++) {
+        mip.level = czsurface_downsample(levels[mip.index - 1], srgb);
+        if (mip.level == NULL) {
+            status = CHIZU_EXPORT_TEXTURE_FAIL;
+            break;
+        }
+        /* planes of channel packed atlases are independent masks, not color and alpha */
+        if (atlas->planes == 1)
+            chizu_internal_foreach(atlas, czdata_internal_fit_coverage, &mip);
+        levels[count++] = mip.level;
+    }
+
+    if (status == CHIZU_EXPORT_OK && format == CZSURFACE_FORMAT_KTX2) {
+        if (czsurface_save_ktx2(levels, count, texture, srgb) != CZSURFACE_SAVE_OK)
+            status = CHIZU_EXPORT_TEXTURE_FAIL;
+    } else if (status == CHIZU_EXPORT_OK) {
+        /* level N goes between the base name and the extension */
+        if (ext == NULL || strchr(ext, '/') != NULL || strchr(ext, '\\') != NULL)
+            ext = texture + length;
+        name = czalloc_malloc(length + 16);
+        if (name == NULL || czsurface_save(levels[0], texture, format) != CZSURFACE_SAVE_OK)
+            status = CHIZU_EXPORT_TEXTURE_FAIL;
+        for (i = 1; i < count && status == CHIZU_EXPORT_OK; i++) {
+            sprintf(name, "%.*s.%u%s", (int) (ext - texture), texture, i, ext);
+            if (czsurface_save(levels[i], name, format) != CZSURFACE_SAVE_OK)
+                status = CHIZU_EXPORT_TEXTURE_FAIL;
+        }
+        czalloc_free(name);
+    }
+
+    for (i = 1; i < count; i++)
+        czsurface_destroy(levels[i]);
+    return status;
+}
+
+static void czdata_internal_fit_coverage(czrect r, void * d, void * priv) {
+    czmipdata * mip = (czmipdata *) priv;
+    czdata * data = (czdata *) d;
+    czrect scaled;
+    float coverage = 0;
+
+    /* past its alignment the sprite shares texels with its neighbours */
+    if ((1u << mip->index) > chizu_internal_mip_align(data->atlas->miplevels, data->size.w, data->size.h))
+        return;
+    coverage = czsurface_coverage(data->atlas->target, r, 0.5f);
+    scaled.x = r.x >> mip->index;
+    scaled.y = r.y >> mip->index;
+    scaled.w = r.w >> mip->index;
+    scaled.h = r.h >> mip->index;
+    czsurface_fit_coverage(mip->level, scaled, 0.5f, coverage);
+}
+
+static czrect chizu_internal_lease_or_enlarge(chizu * atlas, unsigned width, unsigned height, czdata * data) {
     czrect resultrect;
-    unsigned inc = 0;
-    czmap * newmap = NULL;
-    resultrect = czmap_lease(atlas->map, width, height, data);
-    if (!czrect_is_empty(resultrect))
-        return resultrect;
+    unsigned inc = 0, plane = 0;
+    unsigned align = chizu_internal_mip_align(atlas->miplevels, width, height);
+    czmap * newmaps[CHIZU_MAX_PLANES];
+    czsurface * newtarget = NULL;
+    chizu_sprite * newsprites = NULL;
+    czsize newsize = atlas->size;
+    czrect whole = { 0, 0, 0, 0 };
+    czcompose compose;
+
+    /* aligned leases keep sprites apart in the levels where they still span a texel */
+    width = (width + align - 1) & ~(align - 1);
+    height = (height + align - 1) & ~(align - 1);
+    plane = chizu_internal_best_plane(atlas, width, height, align);
+    if (plane < atlas->planes) {
+        data->channel = plane;
+        resultrect = czmap_lease_aligned(atlas->maps[plane], width, height, align, data);
+        if (!czrect_is_empty(resultrect))
+            return resultrect;
+    }
+
+    /* the segment of a shared atlas cannot move */
+    if (atlas->shared != NULL)
+        return whole;
 
     /* find the largest size to expand map with */
     inc = width;
     if (width < height) inc = height;
 
-    if (atlas->size.w > atlas->size.h)
-        atlas->size.h += inc;
+    if (newsize.w > newsize.h)
+        newsize.h += inc;
     else
-        atlas->size.w += inc;
+        newsize.w += inc;
+
+    newsize.w = chizu_internal_next_power_of_2(newsize.w);
+    newsize.h = chizu_internal_next_power_of_2(newsize.h);
+    newtarget = czsurface_create(newsize.w, newsize.h, atlas->channels, atlas->type);
+    if (atlas->capacity > 0)
+        newsprites = czalloc_malloc(atlas->capacity * sizeof(chizu_sprite));
+    if (newtarget == NULL || (atlas->capacity > 0 && newsprites == NULL)) {
+        czsurface_destroy(newtarget);
+        czalloc_free(newsprites);
+        return whole;
+    }
 
-    atlas->size.w = chizu_internal_next_power_of_2(atlas->size.w);
-    atlas->size.h = chizu_internal_next_power_of_2(atlas->size.h);
+    /* restored sprites only live in the target, which is about to go */
+    inc = 1;
+    chizu_internal_foreach(atlas, czdata_internal_materialize, &inc);
+    if (!inc) {
+        czsurface_destroy(newtarget);
+        czalloc_free(newsprites);
+        return whole;
+    }
+
+    /* create new maps and copy contents; stable atlases keep every lease where it was */
+    for (plane = 0; plane < atlas->planes; plane++) {
+        if (atlas->stable)
+            newmaps[plane] = czmap_resize(atlas->maps[plane], newsize.w, newsize.h);
+        else
+            newmaps[plane] = czmap_create(newsize.w, newsize.h);
+        /* a copy short of memory would drop sprites */
+        if (newmaps[plane] != NULL && !atlas->stable && czmap_copy(atlas->maps[plane], newmaps[plane], 1u << atlas->miplevels) != CZMAP_COPY_OK) {
+            czmap_destroy(newmaps[plane], NULL);
+            newmaps[plane] = NULL;
+        }
+        if (newmaps[plane] == NULL) {
+            while (plane-- > 0)
+                czmap_destroy(newmaps[plane], NULL);
+            czsurface_destroy(newtarget);
+            czalloc_free(newsprites);
+            return whole;
+        }
+    }
+
+    /* blitters and readers of the target wait while everything moves */
+    czthread_rwlock_write_lock(&atlas->targetlock);
+    for (plane = 0; plane < atlas->planes; plane++) {
+        czmap_destroy(atlas->maps[plane], NULL);
+        atlas->maps[plane] = newmaps[plane];
+    }
+    atlas->size = newsize;
+    compose.sprites = czalloc_malloc((atlas->count > 0 ? atlas->count : 1) * sizeof(czdata *));
+    compose.count = 0;
+    if (compose.sprites != NULL) {
+        chizu_internal_foreach(atlas, czdata_internal_collect, &compose);
+        chizu_internal_compose(compose.sprites, compose.count, newtarget);
+        czalloc_free(compose.sprites);
+    } else {
+        chizu_internal_foreach(atlas, czdata_internal_relocate, newtarget);
+    }
+    czsurface_destroy(atlas->target);
+    atlas->target = newtarget;
+    czthread_rwlock_write_unlock(&atlas->targetlock);
 
-    /* create a new map and copy contents */
-    newmap = czmap_create(atlas->size.w, atlas->size.h);
-    czmap_copy(atlas->map, newmap);
-    czmap_destroy(atlas->map, NULL);
-    atlas->map = newmap;
+    /* published rects moved too, so readers get a whole new layout */
+    chizu_internal_foreach(atlas, czdata_internal_relayout, newsprites);
+    chizu_internal_publish(atlas, newsprites, atlas->capacity);
+
+    /* everything moved: the whole (new) target has to be uploaded again */
+    atlas->dirtycount = 0;
+    whole.w = atlas->size.w;
+    whole.h = atlas->size.h;
+    chizu_internal_mark_dirty(atlas, whole);
 
     /* try again until space was found */
     return chizu_internal_lease_or_enlarge(atlas, width, height, data);
 }
 
+/*
+ * The surface was decoded without holding any lock. Only finding space
+ * takes the atlas lock; blitting shares the target with other inserters,
+ * whose leases never overlap. A growing atlas relocates (and blits) every
+ * sprite placed so far, so data->rect is read again under the target lock.
+ */
+static chizu_insert_status chizu_internal_insert_surface(chizu * atlas, const char * file, czsurface * surface, unsigned * handle) {
+    czdata * data = NULL;
+    chizu_insert_status status;
+
+    czthread_mutex_lock(&atlas->lock);
+    status = chizu_internal_place(atlas, file, surface, &data);
+    czthread_mutex_unlock(&atlas->lock);
+    if (status == CHIZU_INSERT_OK)
+        chizu_internal_finish_insert(atlas, data);
+    /* the slot was given by this thread, in finish_insert */
+    if (handle != NULL)
+        *handle = status == CHIZU_INSERT_OK ? data->slot : CHIZU_NO_HANDLE;
+    return status;
+}
+
+/* the target is kept composed, so each subimage is blitted once, here */
+static void chizu_internal_finish_insert(chizu * atlas, czdata * data) {
+    czthread_rwlock_read_lock(&atlas->targetlock);
+    czdata_internal_blit(data, atlas->target, data->rect);
+    czthread_rwlock_read_unlock(&atlas->targetlock);
+    chizu_internal_mark_placed(atlas, &data, 1);
+}
+
+/*
+ * Runs on the pool. Decoding overlaps with other jobs, but each job waits
+ * for the previous tickets to be packed before finding space, so images
+ * are packed in the order they were submitted. The pool starts jobs in
+ * that order too, so the one being waited for is always running.
+ */
+static void chizu_internal_insert_job(void * priv) {
+    chizu_future * future = (chizu_future *) priv;
+    chizu * atlas = future->atlas;
+    czsurface * surface = chizu_internal_load(atlas, future->file);
+    czdata * data = NULL;
+    chizu_insert_status status;
+    chizu_rect rect = { 0, 0, 0, 0 };
+    unsigned handle = CHIZU_NO_HANDLE;
+
+    czthread_mutex_lock(&atlas->asynclock);
+    while (atlas->packed != future->ticket)
+        czthread_cond_wait(&atlas->asyncchange, &atlas->asynclock);
+    czthread_mutex_unlock(&atlas->asynclock);
+
+    czthread_mutex_lock(&atlas->lock);
+    status = chizu_internal_place(atlas, future->file, surface, &data);
+    czthread_mutex_unlock(&atlas->lock);
+
+    czthread_mutex_lock(&atlas->asynclock);
+    atlas->packed++;
+    czthread_cond_broadcast(&atlas->asyncchange);
+    czthread_mutex_unlock(&atlas->asynclock);
+
+    if (status == CHIZU_INSERT_OK) {
+        chizu_internal_finish_insert(atlas, data);
+        czthread_mutex_lock(&atlas->lock);
+        rect.x = data->rect.x;
+        rect.y = data->rect.y;
+        rect.w = data->size.w;
+        rect.h = data->size.h;
+        handle = data->slot;
+        czthread_mutex_unlock(&atlas->lock);
+    }
+    future->status = status;
+    future->rect = rect;
+    future->handle = handle;
+    if (future->callback != NULL)
+        future->callback(future->file, status, rect, future->priv);
+
+    czthread_mutex_lock(&atlas->asynclock);
+    czthread_atomic_store(&future->done, 1);
+    atlas->pending--;
+    czthread_cond_broadcast(&atlas->asyncchange);
+    chizu_internal_future_unref(future);
+    czthread_mutex_unlock(&atlas->asynclock);
+}
+
+/* called with the asynclock held */
+static void chizu_internal_future_unref(chizu_future * future) {
+    if (--future->refs > 0)
+        return;
+    czalloc_free(future->file);
+    czalloc_free(future);
+}
+
+/* leases space for surface, leaving blitting it to the caller. Called with the atlas lock held */
+static chizu_insert_status chizu_internal_place(chizu * atlas, const char * file, czsurface * surface, czdata ** placed) {
+    czsize surfsize;
+    czdata * data = NULL;
+    unsigned namebytes = (unsigned) strlen(file) + 1;
+    if (surface == NULL)
+        return CHIZU_INSERT_FILEOPEN_FAIL;
+    if (atlas->shared != NULL && (atlas->count >= atlas->shared->maxsprites
+                                  || namebytes > atlas->shared->namebytes - atlas->sharednames)) {
+        czsurface_destroy(surface);
+        return CHIZU_INSERT_NOSPACE;
+    }
+
+    if (atlas->reserved != NULL && (data = chizu_internal_claim(atlas, file, surface)) != NULL) {
+        atlas->count++;
+        *placed = data;
+        return CHIZU_INSERT_OK;
+    }
+
+    data = czdata_internal_alloc();
+    if (data == NULL) {
+        czsurface_destroy(surface);
+        return CHIZU_INSERT_FAIL;
+    }
+    data->file = chizu_internal_strdup(file);
+    if (data->file == NULL) {
+        czdata_internal_free(data);
+        czsurface_destroy(surface);
+        return CHIZU_INSERT_FAIL;
+    }
+    surfsize = czsurface_size(surface);
+    data->atlas = atlas;
+    data->surface = surface;
+    data->size = surfsize;
+    data->slot = CHIZU_UNPUBLISHED;
+    if (atlas->reserved != NULL)
+        chizu_internal_unreserve(atlas, data);
+
+    data->rect = chizu_internal_lease_or_enlarge(atlas, surfsize.w, surfsize.h, data);
+    if (czrect_is_empty(data->rect)) {
+        czdata_internal_destroy(data);
+        return atlas->shared != NULL ? CHIZU_INSERT_NOSPACE : CHIZU_INSERT_FAIL;
+    }
+
+    if (atlas->shared != NULL)
+        atlas->sharednames += namebytes;
+    atlas->count++;
+    *placed = data;
+    return CHIZU_INSERT_OK;
+}
+
+/* the reservation of file, if it has one of the same size. Called with the atlas lock held */
+static czdata * chizu_internal_claim(chizu * atlas, const char * file, czsurface * surface) {
+    unsigned i = czindex_get(atlas->reservedindex, file);
+    czsize size = czsurface_size(surface);
+    czdata * data = NULL;
+    if (i == CZINDEX_MISSING || atlas->reserved[i] == NULL)
+        return NULL;
+    data = atlas->reserved[i];
+    if (data->state != CZDATA_RESERVED || data->size.w != size.w || data->size.h != size.h)
+        return NULL;
+    data->surface = surface;
+    data->state = chizu_internal_same_pixels(atlas, data) ? CZDATA_KEPT : CZDATA_CHANGED;
+    return data;
+}
+
+/*
+ * Marks data as moved if its file had a place in the previous layout. A
+ * place nobody took (the file was resized) is freed for this build, so it
+ * is not listed as removed too. Called with the atlas lock held.
+ */
+static void chizu_internal_unreserve(chizu * atlas, czdata * data) {
+    unsigned i = czindex_get(atlas->reservedindex, data->file);
+    czdata * old = NULL;
+    czmap * map = NULL;
+    if (i == CZINDEX_MISSING || atlas->reserved[i] == NULL)
+        return;
+    old = atlas->reserved[i];
+    data->state = CZDATA_MOVED;
+    data->was = old->rect;
+    data->waschannel = old->channel;
+    if (old->state != CZDATA_RESERVED)
+        return;
+
+    /* out of memory, the place only stays leased */
+    map = czmap_remove(atlas->maps[old->channel], atlas->size.w, atlas->size.h, old);
+    if (map == NULL) {
+        old->state = CZDATA_SUPERSEDED;
+        return;
+    }
+    czmap_destroy(atlas->maps[old->channel], NULL);
+    atlas->maps[old->channel] = map;
+    atlas->reserved[i] = NULL;
+    czdata_internal_destroy(old);
+}
+
+/* tells if data has the pixels it had in the previous texture */
+static int chizu_internal_same_pixels(chizu * atlas, czdata * data) {
+    const unsigned char * old = NULL, * pixels = NULL;
+    czsize size;
+    unsigned oldbpp = 0, bpp = 0, x = 0, y = 0;
+    if (atlas->previous == NULL)
+        return 0;
+    size = czsurface_size(atlas->previous);
+    if (data->rect.x + data->size.w > size.w || data->rect.y + data->size.h > size.h)
+        return 0;
+    old = (const unsigned char *) czsurface_pixels(atlas->previous);
+    oldbpp = czsurface_bpp(atlas->previous);
+    pixels = (const unsigned char *) czsurface_pixels(data->surface);
+    bpp = czsurface_bpp(data->surface);
+
+    /* masks of channel packed atlases are compared to their channel only */
+    for (y = 0; y < data->size.h; y++) {
+        const unsigned char * a = old + ((size_t) (data->rect.y + y) * size.w + data->rect.x) * oldbpp;
+        const unsigned char * b = pixels + (size_t) y * data->size.w * bpp;
+        if (atlas->planes == 1 && (bpp != oldbpp || memcmp(a, b, (size_t) data->size.w * bpp) != 0))
+            return 0;
+        for (x = 0; atlas->planes > 1 && x < data->size.w; x++)
+            if (a[x * oldbpp + data->channel] != b[x * bpp])
+                return 0;
+    }
+    return 1;
+}
+
+/* sprites are reported dirty and published only once blitted, so nobody sees them before */
+static void chizu_internal_mark_placed(chizu * atlas, czdata ** placed, unsigned count) {
+    unsigned i = 0, capacity = 0;
+    czrect dirty;
+    chizu_sprite * sprites = NULL;
+    czthread_mutex_lock(&atlas->lock);
+    for (i = 0; i < count; i++) {
+        dirty.x = placed[i]->rect.x;
+        dirty.y = placed[i]->rect.y;
+        dirty.w = placed[i]->size.w;
+        dirty.h = placed[i]->size.h;
+        chizu_internal_mark_dirty(atlas, dirty);
+    }
+
+    /* appending past the count of older layouts does not disturb their readers */
+    sprites = atlas->sprites;
+    capacity = atlas->capacity;
+    if (atlas->published + count > capacity) {
+        while (atlas->published + count > capacity)
+            capacity = capacity > 0 ? capacity * 2 : 64;
+        sprites = czalloc_malloc(capacity * sizeof(chizu_sprite));
+        if (sprites == NULL) {
+            czthread_mutex_unlock(&atlas->lock);
+            return;
+        }
+        if (atlas->published > 0)
+            memcpy(sprites, atlas->sprites, atlas->published * sizeof(chizu_sprite));
+    }
+    for (i = 0; i < count; i++) {
+        placed[i]->slot = atlas->published + i;
+        czdata_internal_sprite(placed[i], &sprites[placed[i]->slot]);
+    }
+    atlas->published += count;
+
+    /* out of memory, they stay unpublished as when the array cannot grow */
+    if (!chizu_internal_publish(atlas, sprites, capacity)) {
+        atlas->published -= count;
+        for (i = 0; i < count; i++)
+            placed[i]->slot = CHIZU_UNPUBLISHED;
+        czthread_mutex_unlock(&atlas->lock);
+        return;
+    }
+    for (i = 0; i < count; i++)
+        czindex_put(atlas->index, placed[i]->file, placed[i]->slot);
+    if (atlas->shared != NULL)
+        chizu_internal_share(atlas, placed, count);
+    czthread_mutex_unlock(&atlas->lock);
+}
+
+/*
+ * Makes a new layout of the published sprites current, with sprites as its
+ * array if it is not the current one. What readers may still see is retired
+ * instead of freed. Called with the atlas lock held.
+ */
+static int chizu_internal_publish(chizu * atlas, chizu_sprite * sprites, unsigned capacity) {
+    chizu_layout * layout = czalloc_malloc(sizeof(chizu_layout));
+    void * old = atlas->layout;
+    if (layout == NULL) {
+        if (sprites != atlas->sprites)
+            czalloc_free(sprites);
+        return 0;
+    }
+    layout->version = ++atlas->version;
+    layout->width = atlas->size.w;
+    layout->height = atlas->size.h;
+    layout->count = atlas->published;
+    layout->sprites = sprites;
+
+    czthread_atomic_store_ptr(&atlas->layout, layout);
+    if (old != NULL)
+        czepoch_retire(atlas->epoch, old);
+    if (sprites != atlas->sprites) {
+        czepoch_retire(atlas->epoch, atlas->sprites);
+        atlas->sprites = sprites;
+        atlas->capacity = capacity;
+    }
+    return 1;
+}
+
+static void czdata_internal_relayout(czrect r, void * d, void * priv) {
+    czdata * data = (czdata *) d;
+    if (data->slot != CHIZU_UNPUBLISHED)
+        czdata_internal_sprite(data, (chizu_sprite *) priv + data->slot);
+}
+
+static void czdata_internal_sprite(czdata * data, chizu_sprite * sprite) {
+    sprite->name = data->file;
+    sprite->x = data->rect.x;
+    sprite->y = data->rect.y;
+    sprite->w = data->size.w;
+    sprite->h = data->size.h;
+    sprite->channel = data->channel;
+}
+
+/* walks the sprites of every plane, but not reservations */
+static void chizu_internal_foreach(chizu * atlas, czwalkfunc func, void * priv) {
+    unsigned i = 0;
+    czvisit visit;
+    visit.func = func;
+    visit.priv = priv;
+    for (i = 0; i < atlas->planes; i++) {
+        if (atlas->reserved != NULL)
+            czmap_foreach(atlas->maps[i], czdata_internal_visit, &visit);
+        else
+            czmap_foreach(atlas->maps[i], func, priv);
+    }
+}
+
+static void czdata_internal_visit(czrect r, void * d, void * priv) {
+    czvisit * visit = (czvisit *) priv;
+    czdata_state state = ((czdata *) d)->state;
+    if (state != CZDATA_RESERVED && state != CZDATA_SUPERSEDED)
+        visit->func(r, d, visit->priv);
+}
+
+/*
+ * The lease alignment of a width by height sprite: 2^levels, but no more
+ * than its smaller side, so a small sprite does not take a lease many times
+ * its size. Below that side it covers less than a texel, and may blend
+ * with its neighbours.
+ */
+static unsigned chizu_internal_mip_align(unsigned levels, unsigned width, unsigned height) {
+    unsigned side = width < height ? width : height, align = 1;
+    while (levels > 0 && align * 2 <= side) {
+        align *= 2;
+        levels--;
+    }
+    return align;
+}
+
+/* the plane whose free rect would be filled the most, or atlas->planes if none fits */
+static unsigned chizu_internal_best_plane(chizu * atlas, unsigned width, unsigned height, unsigned align) {
+    unsigned i = 0, best = atlas->planes;
+    unsigned long waste = 0, bestwaste = 0;
+    for (i = 0; i < atlas->planes; i++) {
+        if (czmap_probe(atlas->maps[i], width, height, align, &waste) && (best == atlas->planes || waste < bestwaste)) {
+            best = i;
+            bestwaste = waste;
+        }
+    }
+    return best;
+}
+
+/* decodes file, or takes it from the cache; the variant tells apart the decodings below */
+static czsurface * chizu_internal_load(chizu * atlas, const char * file) {
+    unsigned variant = atlas->planes > 1 ? 0x100 : atlas->channels | (unsigned) atlas->type << 4;
+    if (atlas->cache == NULL)
+        return chizu_internal_decode(file, atlas);
+    return czcache_load(atlas->cache->cache, file, variant, chizu_internal_decode, atlas);
+}
+
+/* channel packed atlases take masks, everything else is converted to the atlas format */
+static czsurface * chizu_internal_decode(const char * file, void * priv) {
+    chizu * atlas = (chizu *) priv;
+    if (atlas->planes > 1)
+        return czsurface_load_mask(file);
+    return czsurface_load(file, atlas->channels, atlas->type);
+}
+
+static void chizu_internal_sdf_load(unsigned index, void * priv) {
+    czsdfjob * job = (czsdfjob *) priv;
+    czsurface * source = czsurface_load(job->files[index], 0, CZSURFACE_UINT8);
+    if (source == NULL)
+        return;
+    job->surfaces[index] = czsdf_create(source, job->downscale, job->spread);
+    czsurface_destroy(source);
+}
+
+/* merges r with every dirty rect it touches, keeping at most CHIZU_MAX_DIRTY_RECTS of them */
+static void chizu_internal_mark_dirty(chizu * atlas, czrect r) {
+    unsigned i = 0;
+    czrect merged;
+    for (i = 0; i < atlas->dirtycount; i++) {
+        czrect d = atlas->dirty[i];
+        if (r.x <= d.x + d.w && d.x <= r.x + r.w && r.y <= d.y + d.h && d.y <= r.y + r.h) {
+            chizu_internal_merged_area(r, d, &merged);
+            atlas->dirty[i] = atlas->dirty[--atlas->dirtycount];
+            r = merged;
+            i = (unsigned) -1;
+        }
+    }
+    if (atlas->dirtycount == CHIZU_MAX_DIRTY_RECTS)
+        chizu_internal_coalesce(atlas, CHIZU_MAX_DIRTY_RECTS - 1);
+    atlas->dirty[atlas->dirtycount++] = r;
+}
+
+/* area of the bounding rect of a and b, which is stored in merged */
+static unsigned long chizu_internal_merged_area(czrect a, czrect b, czrect * merged) {
+    unsigned right = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    unsigned bottom = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    merged->x = a.x < b.x ? a.x : b.x;
+    merged->y = a.y < b.y ? a.y : b.y;
+    merged->w = right - merged->x;
+    merged->h = bottom - merged->y;
+    return (unsigned long) merged->w * merged->h;
+}
+
+/* merges the pair that adds the least area until there are at most max dirty rects */
+static void chizu_internal_coalesce(chizu * atlas, unsigned max) {
+    while (atlas->dirtycount > max) {
+        unsigned i = 0, j = 0, besti = 0, bestj = 1;
+        double best = 0;
+        czrect merged, bestmerged = atlas->dirty[0];
+        for (i = 0; i < atlas->dirtycount; i++) {
+            for (j = i + 1; j < atlas->dirtycount; j++) {
+                czrect a = atlas->dirty[i], b = atlas->dirty[j];
+                double grow = (double) chizu_internal_merged_area(a, b, &merged)
+                    - (double) a.w * a.h - (double) b.w * b.h;
+                if (grow < best || j == 1) {
+                    best = grow;
+                    besti = i;
+                    bestj = j;
+                    bestmerged = merged;
+                }
+            }
+        }
+        atlas->dirty[besti] = bestmerged;
+        atlas->dirty[bestj] = atlas->dirty[--atlas->dirtycount];
+    }
+}
+
+/*
+ * The sprites of generated code: one per name, the latest, as chizu_lookup
+ * finds. czcode puts them in the same order in headers and sources.
+ */
+static unsigned chizu_internal_code_entries(chizu * atlas, czspec_entry * entries) {
+    unsigned count = 0, i = 0;
+    for (i = 0; i < atlas->published; i++) {
+        if (czindex_get(atlas->index, atlas->sprites[i].name) != i)
+            continue;
+        entries[count].name = atlas->sprites[i].name;
+        entries[count].x = atlas->sprites[i].x;
+        entries[count].y = atlas->sprites[i].y;
+        entries[count].w = atlas->sprites[i].w;
+        entries[count].h = atlas->sprites[i].h;
+        entries[count].channel = atlas->sprites[i].channel;
+        count++;
+    }
+    return count;
+}
+
+static int chizu_internal_pixel_format(chizu * atlas, chizu_pixel_format * format) {
+    if (atlas->type == CZSURFACE_FLOAT16)
+        *format = CHIZU_PIXEL_RGBA16F;
+    else if (atlas->type == CZSURFACE_FLOAT32)
+        *format = CHIZU_PIXEL_RGBA32F;
+    else if (atlas->channels == 4)
+        *format = CHIZU_PIXEL_RGBA8;
+    else if (atlas->channels == 3)
+        *format = CHIZU_PIXEL_RGB8;
+    else if (atlas->channels == 2)
+        *format = CHIZU_PIXEL_LA8;
+    else if (atlas->channels == 1)
+        *format = CHIZU_PIXEL_L8;
+    else
+        return 0;
+    return 1;
+}
+
+/* 0 for unknown formats */
+static unsigned chizu_internal_format_bytes(chizu_pixel_format format) {
+    switch (format) {
+        case CHIZU_PIXEL_RGBA8: return 4;
+        case CHIZU_PIXEL_RGB8: return 3;
+        case CHIZU_PIXEL_LA8: return 2;
+        case CHIZU_PIXEL_L8: return 1;
+        case CHIZU_PIXEL_RGBA16F: return 8;
+        case CHIZU_PIXEL_RGBA32F: return 16;
+        default: return 0;
+    }
+}
+
+static unsigned czdata_internal_state_index(void * d, void * priv) {
+    czdata * data = (czdata *) d;
+    return data->slot != CHIZU_UNPUBLISHED ? data->slot + 1 : 0;
+}
+
+/* each sprite belongs to exactly one node */
+static void * czdata_internal_state_data(unsigned index, void * priv) {
+    czstate_load * load = (czstate_load *) priv;
+    if (index > load->count || load->used[index - 1])
+        return NULL;
+    load->used[index - 1] = 1;
+    return load->datas[index - 1];
+}
+
+static void czdata_internal_restore_rect(czrect r, void * d, void * priv) {
+    ((czdata *) d)->rect = r;
+}
+
+static void czdata_internal_check_rect(czrect r, void * d, void * priv) {
+    czdata * data = (czdata *) d;
+    if (r.x != data->rect.x || r.y != data->rect.y || r.w < data->size.w || r.h < data->size.h)
+        *(int *) priv = 0;
+}
+
+/* gives restored sprites a surface of their own again, out of the target */
+static void czdata_internal_materialize(czrect r, void * d, void * priv) {
+    czdata * data = (czdata *) d;
+    czrect area;
+    if (data->surface != NULL)
+        return;
+    area.x = data->rect.x;
+    area.y = data->rect.y;
+    area.w = data->size.w;
+    area.h = data->size.h;
+    data->surface = czsurface_crop(data->atlas->target, area, data->atlas->planes > 1 ? (int) data->channel : -1);
+    if (data->surface == NULL)
+        *(unsigned *) priv = 0;
+}
+
+/*
+ * Replaces the empty maps and target of a new atlas by the ones in a state
+ * file. The target keeps using the mapped pixels, which are copied on
+ * write, until the atlas grows. Returns 0 if the file is malformed.
+ */
+static int chizu_internal_restore(chizu * atlas, czfile * file, const czstate_header * header) {
+    const unsigned char * bytes = (const unsigned char *) czfile_data(file);
+    unsigned long long offset = sizeof(czstate_header), pixelbytes = 0;
+    const czstate_sprite * sprites = NULL;
+    const czmap_record * records[CHIZU_MAX_PLANES];
+    const char * names = NULL;
+    czmap * maps[CHIZU_MAX_PLANES] = { NULL, NULL, NULL, NULL };
+    czsurface * target = NULL;
+    czstate_load load;
+    unsigned i = 0, plane = 0, capacity = 64;
+    int ok = 1;
+    czrect whole = { 0, 0, 0, 0 };
+
+    /* every table has to fit before the pixels, and the pixels in the file */
+    sprites = (const czstate_sprite *) (bytes + offset);
+    offset += (unsigned long long) header->sprites * sizeof(czstate_sprite);
+    for (plane = 0; plane < header->planes; plane++) {
+        records[plane] = (const czmap_record *) (bytes + offset);
+        offset += (unsigned long long) header->nodes[plane] * sizeof(czmap_record);
+    }
+    names = (const char *) (bytes + offset);
+    offset += header->names;
+    pixelbytes = (unsigned long long) header->width * header->height * czsurface_bpp(atlas->target);
+    if (offset > header->pixels || header->pixels % CHIZU_STATE_ALIGN != 0 || header->pixels + pixelbytes > czfile_size(file)
+            || header->width == 0 || header->height == 0 || (header->names > 0 && names[header->names - 1] != 0))
+        return 0;
+
+    load.count = header->sprites;
+    load.datas = czalloc_calloc(load.count > 0 ? load.count : 1, sizeof(czdata *));
+    load.used = czalloc_calloc(load.count > 0 ? load.count : 1, 1);
+    while (capacity < load.count)
+        capacity *= 2;
+    atlas->sprites = czalloc_malloc(capacity * sizeof(chizu_sprite));
+    ok = load.datas != NULL && load.used != NULL && atlas->sprites != NULL;
+
+    for (i = 0; ok && i < load.count; i++) {
+        const czstate_sprite * s = &sprites[i];
+        ok = s->name < header->names && s->w <= header->width && s->h <= header->height
+            && s->x <= header->width - s->w && s->y <= header->height - s->h && s->channel < header->planes
+            && (load.datas[i] = czdata_internal_alloc()) != NULL
+            && (load.datas[i]->file = chizu_internal_strdup(names + s->name)) != NULL;
+        if (ok) {
+            load.datas[i]->size.w = s->w;
+            load.datas[i]->size.h = s->h;
+            load.datas[i]->rect.x = s->x;
+            load.datas[i]->rect.y = s->y;
+            load.datas[i]->channel = s->channel;
+            load.datas[i]->slot = i;
+            load.datas[i]->atlas = atlas;
+        }
+    }
+    for (plane = 0; ok && plane < header->planes; plane++)
+        ok = (maps[plane] = czmap_unflatten(records[plane], header->nodes[plane], header->width, header->height,
+                                            czdata_internal_state_data, &load)) != NULL;
+    for (i = 0; ok && i < load.count; i++)
+        ok = load.used[i];
+    /* the trees put each sprite where the sprite table does, with room for it */
+    for (plane = 0; ok && plane < header->planes; plane++)
+        czmap_foreach(maps[plane], czdata_internal_check_rect, &ok);
+    if (ok)
+        ok = (target = czsurface_wrap((void *) (bytes + header->pixels), header->width, header->height,
+                                      atlas->channels, atlas->type, chizu_internal_unmap, file)) != NULL;
+
+    if (!ok) {
+        for (plane = 0; plane < CHIZU_MAX_PLANES; plane++)
+            if (maps[plane] != NULL)
+                czmap_destroy(maps[plane], NULL);
+        for (i = 0; load.datas != NULL && i < load.count; i++)
+            czdata_internal_destroy(load.datas[i]);
+        czalloc_free(load.datas);
+        czalloc_free(load.used);
+        return 0;
+    }
+
+    /* from here on the atlas owns everything */
+    for (plane = 0; plane < atlas->planes; plane++) {
+        czmap_destroy(atlas->maps[plane], NULL);
+        atlas->maps[plane] = maps[plane];
+    }
+    czsurface_destroy(atlas->target);
+    atlas->target = target;
+    atlas->size.w = header->width;
+    atlas->size.h = header->height;
+    atlas->miplevels = header->miplevels;
+    atlas->count = load.count;
+    chizu_internal_foreach(atlas, czdata_internal_restore_rect, NULL);
+    for (i = 0; i < load.count; i++) {
+        czdata_internal_sprite(load.datas[i], &atlas->sprites[i]);
+        czindex_put(atlas->index, load.datas[i]->file, i);
+    }
+    atlas->published = load.count;
+    atlas->capacity = capacity;
+    chizu_internal_publish(atlas, atlas->sprites, capacity);
+    whole.w = atlas->size.w;
+    whole.h = atlas->size.h;
+    chizu_internal_mark_dirty(atlas, whole);
+
+    czalloc_free(load.datas);
+    czalloc_free(load.used);
+    return 1;
+}
+
+static void chizu_internal_unmap(void * file) {
+    czfile_unmap((czfile *) file);
+}
+
+/* the whole file, NUL terminated so that text specs can be parsed in place */
+static char * chizu_internal_read_spec(const char * path, size_t * size) {
+    FILE * in = fopen(path, "rb");
+    char * data = NULL;
+    long length = 0;
+    if (in == NULL)
+        return NULL;
+    if (fseek(in, 0, SEEK_END) == 0 && (length = ftell(in)) >= 0 && fseek(in, 0, SEEK_SET) == 0) {
+        data = czalloc_malloc((size_t) length + 1);
+        if (data != NULL && fread(data, 1, (size_t) length, in) != (size_t) length) {
+            czalloc_free(data);
+            data = NULL;
+        }
+    }
+    fclose(in);
+    if (data != NULL) {
+        data[length] = 0;
+        *size = (size_t) length;
+    }
+    return data;
+}
+
+static int chizu_internal_open_binary(czopen * open, const void * data, const czspec_info * info) {
+    czspec_entry entry;
+    unsigned i = 0, length = 0, values[5];
+    char * name = NULL;
+    for (i = 0; i < info->count; i++) {
+        czspec_entry_at(data, i, &entry);
+        length = czspec_name(data, i, NULL, 0);
+        name = czalloc_malloc(length + 1);
+        if (name == NULL)
+            return 0;
+        czspec_name(data, i, name, length + 1);
+        values[0] = entry.x;
+        values[1] = entry.y;
+        values[2] = entry.w;
+        values[3] = entry.h;
+        values[4] = entry.channel;
+        if (!chizu_internal_open_sprite(open, name, values))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Lines are "name x y w h", with the channel as a sixth column in channel
+ * packed atlases, which the first line tells apart. Blank lines are skipped.
+ */
+static int chizu_internal_open_text(czopen * open, char * text, int * packed) {
+    unsigned values[5] = { 0, 0, 0, 0, 0 };
+    unsigned length = 0, columns = 0;
+    char * line = text, * next = NULL, * name = NULL;
+    for (; *line != 0; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = 0;
+        else
+            next = line + strlen(line);
+        if (*line != 0 && line[strlen(line) - 1] == '\r')
+            line[strlen(line) - 1] = 0;
+        if (*line == 0)
+            continue;
+
+        if (columns == 0) {
+            columns = chizu_internal_spec_line(line, values, 5) > 0 && values[4] < CHIZU_MAX_PLANES ? 5 : 4;
+            *packed = columns == 5;
+        }
+        values[4] = 0;
+        length = chizu_internal_spec_line(line, values, columns);
+        if (length == 0 || (name = czalloc_malloc(length + 1)) == NULL)
+            return 0;
+        memcpy(name, line, length);
+        name[length] = 0;
+        if (!chizu_internal_open_sprite(open, name, values))
+            return 0;
+    }
+    return 1;
+}
+
+/* reads the last count numbers of line into values, returns the length of the name before them or 0 */
+static unsigned chizu_internal_spec_line(const char * line, unsigned * values, unsigned count) {
+    const char * end = line + strlen(line), * start = NULL;
+    while (count-- > 0) {
+        start = end;
+        while (start > line && start[-1] >= '0' && start[-1] <= '9')
+            start--;
+        if (start == end || end - start > 9 || start - 1 <= line || start[-1] != ' ')
+            return 0;
+        values[count] = (unsigned) strtoul(start, NULL, 10);
+        end = start - 1;
+    }
+    return (unsigned) (end - line);
+}
+
+/* takes name, whatever happens. values are x, y, w, h and the channel */
+static int chizu_internal_open_sprite(czopen * open, char * name, const unsigned * values) {
+    czdata ** datas = NULL;
+    czdata * data = NULL;
+    if (open->count == open->capacity) {
+        open->capacity = open->capacity > 0 ? open->capacity * 2 : 64;
+        datas = czalloc_realloc(open->datas, open->capacity * sizeof(czdata *));
+        if (datas == NULL) {
+            czalloc_free(name);
+            return 0;
+        }
+        open->datas = datas;
+    }
+    data = czdata_internal_alloc();
+    if (data == NULL) {
+        czalloc_free(name);
+        return 0;
+    }
+    data->file = name;
+    data->rect.x = values[0];
+    data->rect.y = values[1];
+    data->rect.w = values[2];
+    data->rect.h = values[3];
+    data->size.w = values[2];
+    data->size.h = values[3];
+    data->channel = values[4];
+    data->slot = open->count;
+    open->datas[open->count++] = data;
+    return 1;
+}
+
+/*
+ * Gives a new atlas the opened sprites, leased where they are, and target.
+ * Like restored ones, they have no surface until the atlas grows. Returns 0,
+ * leaving everything to the caller, if the sprites do not make a layout.
+ */
+static int chizu_internal_adopt(chizu * atlas, czopen * open, czsurface * target) {
+    czmap * maps[CHIZU_MAX_PLANES] = { NULL, NULL, NULL, NULL };
+    czmap_placement * placements = NULL;
+    chizu_sprite * sprites = NULL;
+    czsize size = czsurface_size(target);
+    unsigned i = 0, plane = 0, count = 0, capacity = 64;
+    int ok = 1;
+
+    while (capacity < open->count)
+        capacity *= 2;
+    placements = czalloc_malloc((open->count > 0 ? open->count : 1) * sizeof(czmap_placement));
+    sprites = czalloc_malloc(capacity * sizeof(chizu_sprite));
+    ok = placements != NULL && sprites != NULL;
+    for (i = 0; ok && i < open->count; i++)
+        ok = open->datas[i]->channel < atlas->planes;
+    for (plane = 0; ok && plane < atlas->planes; plane++) {
+        for (i = 0, count = 0; i < open->count; i++) {
+            if (open->datas[i]->channel != plane)
+                continue;
+            placements[count].rect = open->datas[i]->rect;
+            placements[count++].data = open->datas[i];
+        }
+        ok = (maps[plane] = czmap_build(size.w, size.h, placements, count)) != NULL;
+    }
+    czalloc_free(placements);
+    if (!ok) {
+        for (plane = 0; plane < CHIZU_MAX_PLANES; plane++)
+            if (maps[plane] != NULL)
+                czmap_destroy(maps[plane], NULL);
+        czalloc_free(sprites);
+        return 0;
+    }
+
+    /* from here on the atlas owns everything */
+    for (plane = 0; plane < atlas->planes; plane++) {
+        czmap_destroy(atlas->maps[plane], NULL);
+        atlas->maps[plane] = maps[plane];
+    }
+    czsurface_destroy(atlas->target);
+    atlas->target = target;
+    atlas->size = size;
+    atlas->count = open->count;
+    for (i = 0; i < open->count; i++) {
+        open->datas[i]->atlas = atlas;
+        czdata_internal_sprite(open->datas[i], &sprites[i]);
+        czindex_put(atlas->index, open->datas[i]->file, i);
+    }
+    atlas->sprites = sprites;
+    atlas->published = open->count;
+    atlas->capacity = capacity;
+    chizu_internal_publish(atlas, sprites, capacity);
+    return 1;
+}
+
+/* appends the records of newly published sprites, then lets other processes see them */
+static void chizu_internal_share(chizu * atlas, czdata ** placed, unsigned count) {
+    unsigned char * base = (unsigned char *) atlas->shared;
+    chizu_shared_sprite * records = (chizu_shared_sprite *) (base + atlas->shared->sprites);
+    char * names = (char *) (base + atlas->shared->names);
+    unsigned i = 0;
+    size_t length = 0;
+    for (i = 0; i < count; i++) {
+        chizu_shared_sprite * record = &records[placed[i]->slot];
+        length = strlen(placed[i]->file) + 1;
+        record->x = placed[i]->rect.x;
+        record->y = placed[i]->rect.y;
+        record->w = placed[i]->size.w;
+        record->h = placed[i]->size.h;
+        record->channel = placed[i]->channel;
+        record->name = atlas->sharedused;
+        memcpy(names + atlas->sharedused, placed[i]->file, length);
+        atlas->sharedused += (unsigned) length;
+    }
+    czthread_atomic_store(&atlas->shared->published, (long) atlas->published);
+}
+
+/*
+ * Writes one texture coordinate of each sprite: the left (or top, if
+ * vertical) edge moved inset texels in, or the right (bottom) one if far.
+ */
+static void chizu_internal_export_uv(const chizu_sprite * sprites, unsigned count, int vertical, int far, float scale, float inset, chizu_uv_format format, void * out) {
+    unsigned i = 0;
+    float edge = 0;
+    if (out == NULL)
+        return;
+    for (i = 0; i < count; i++) {
+        if (vertical)
+            edge = far ? sprites[i].y + sprites[i].h - inset : sprites[i].y + inset;
+        else
+            edge = far ? sprites[i].x + sprites[i].w - inset : sprites[i].x + inset;
+        if (format == CHIZU_UV_UNORM16)
+            ((unsigned short *) out)[i] = (unsigned short) (edge * scale * 65535.0f + 0.5f);
+        else
+            ((float *) out)[i] = edge * scale;
+    }
+}
+
 static char * chizu_internal_strdup(const char * s) {
     size_t n = strlen(s);
-    char * p = (char *) malloc(n+1);
+    char * p = (char *) czalloc_malloc(n+1);
     if (p) strcpy(p,s);
     return p;
 }
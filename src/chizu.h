@@ -26,6 +26,8 @@ THE SOFTWARE.
 #ifndef CHIZU_H
 #define CHIZU_H
 
+#include <stddef.h>
+
 #if defined(_WIN32)
 #   if defined(CHIZU_EXPORTS)
 #       define  CHIZU_API  __declspec(dllexport)
@@ -39,6 +41,27 @@ THE SOFTWARE.
 struct chizu;
 typedef struct chizu chizu;
 
+/**
+ * Handle of no subimage.
+ * @sa chizu_insert_handle
+ */
+#define CHIZU_NO_HANDLE ((unsigned) -1)
+
+/**
+ * Most mip levels an atlas exports, enough for 32768 pixel wide textures.
+ * @sa chizu_set_mipmaps
+ */
+#define CHIZU_MAX_MIPLEVELS 15
+
+struct chizu_future;
+typedef struct chizu_future chizu_future;
+
+struct chizu_shared;
+typedef struct chizu_shared chizu_shared;
+
+struct chizu_cache;
+typedef struct chizu_cache chizu_cache;
+
 /**
  * Status of the subimage insertion.
  * @sa chizu_insert
@@ -64,15 +87,56 @@ typedef enum chizu_export_status {
 
 /**
  * Texture formats supported when exporting.
+ * @details CHIZU_FORMAT_HDR writes a Radiance file (converting 8 bit atlases
+ * to floats), CHIZU_FORMAT_KTX2 an uncompressed KTX2 texture in the exact
+ * pixel format of the atlas, including its mip levels. The other formats
+ * are 8 bit, float atlases being tone mapped with a 2.2 gamma.
+ * CHIZU_FORMAT_PNG_INDEXED and CHIZU_FORMAT_INDEXED reduce the texture to at
+ * most 256 colors (exactly, when it has that few), writing a paletted PNG or
+ * one raw index byte per pixel plus the RGBA palette in <texture>.pal.
  * @sa chizu_export
  */
 typedef enum chizu_export_format {
     CHIZU_FORMAT_BMP,
     CHIZU_FORMAT_PNG,
     CHIZU_FORMAT_TGA,
-    CHIZU_FORMAT_HDR
+    CHIZU_FORMAT_HDR,
+    CHIZU_FORMAT_KTX2,
+    CHIZU_FORMAT_PNG_INDEXED,
+    CHIZU_FORMAT_INDEXED
 } chizu_export_format;
 
+/**
+ * Spec file formats written by chizu_export.
+ * @details CHIZU_SPEC_TEXT is one line per subimage. CHIZU_SPEC_BINARY is a
+ * file meant to be mapped in memory and read in place with chizu_spec_open,
+ * without parsing or allocating anything.
+ * @sa chizu_set_spec_format
+ */
+typedef enum chizu_spec_format {
+    CHIZU_SPEC_TEXT,
+    CHIZU_SPEC_BINARY
+} chizu_spec_format;
+
+/**
+ * Pixel formats an atlas can be created with.
+ * @details Inserted images are converted to the atlas format once, when they
+ * are loaded, and the exported texture keeps that format (L8 and LA8 atlases
+ * are written as grayscale and grayscale-alpha images).
+ *
+ * RGBA16F and RGBA32F atlases hold linear half-float and float pixels. HDR
+ * files keep their range and 8 bit files are linearized when loaded.
+ * @sa chizu_create_format
+ */
+typedef enum chizu_pixel_format {
+    CHIZU_PIXEL_RGBA8 = 0,
+    CHIZU_PIXEL_RGB8,
+    CHIZU_PIXEL_LA8,
+    CHIZU_PIXEL_L8,
+    CHIZU_PIXEL_RGBA16F,
+    CHIZU_PIXEL_RGBA32F
+} chizu_pixel_format;
+
 /**
  * Status of Chizu initialization routines.
  * @sa chizu_init
@@ -88,8 +152,109 @@ typedef enum chizu_init_status {
 typedef struct czexport {
     const char * subfile; /** The file name that should go in this position */
     unsigned x, y, w, h;  /** The position of the subimage in the target */
+    unsigned channel;     /** The channel holding the subimage in channel packed atlases, 0 otherwise */
 } czexport;
 
+/**
+ * @brief A rectangle of the atlas texture, in pixels.
+ */
+typedef struct chizu_rect {
+    unsigned x, y, w, h;
+} chizu_rect;
+
+/**
+ * @brief Where a subimage is, as seen in a chizu_layout.
+ */
+typedef struct chizu_sprite {
+    const char * name;
+    unsigned x, y, w, h;
+    unsigned channel;
+} chizu_sprite;
+
+/**
+ * @brief An immutable snapshot of the atlas layout.
+ * @details sprites holds count subimages, in insertion order. A subimage
+ * keeps its index in every later layout of the same atlas.
+ */
+typedef struct chizu_layout {
+    unsigned long version;
+    unsigned width, height;
+    unsigned count;
+    const chizu_sprite * sprites;
+} chizu_layout;
+
+/**
+ * Formats of texture coordinates in chizu_layout_arrays.
+ */
+typedef enum chizu_uv_format {
+    CHIZU_UV_FLOAT = 0, /* float, 0 to 1 */
+    CHIZU_UV_UNORM16    /* unsigned short, 0 to 65535 */
+} chizu_uv_format;
+
+/**
+ * @brief Arrays filled by chizu_layout_export, one element per subimage.
+ * @details Any array can be NULL to skip it. page is the channel holding
+ * the subimage in channel packed atlases and 0 otherwise; rotated is always
+ * 0, as subimages are never rotated, and is there for formats that expect
+ * it. u0, v0, u1 and v1 point to floats or unsigned shorts, per uvformat,
+ * and are normalized by the texture size. With inset non zero they are
+ * moved half a texel inwards, so bilinear sampling never reaches a
+ * neighbour.
+ */
+typedef struct chizu_layout_arrays {
+    unsigned * x, * y, * w, * h;
+    unsigned char * page;
+    unsigned char * rotated;
+    void * u0, * v0, * u1, * v1;
+    chizu_uv_format uvformat;
+    int inset;
+} chizu_layout_arrays;
+
+/**
+ * @brief Where a subimage is in a shared atlas, as seen by chizu_shared_layout.
+ * @details name is an offset, resolved by chizu_shared_name.
+ */
+typedef struct chizu_shared_sprite {
+    unsigned x, y, w, h;
+    unsigned channel;
+    unsigned name;
+} chizu_shared_sprite;
+
+/**
+ * Pixel encodings of an embedded atlas.
+ * @sa chizu_export_source
+ */
+typedef enum chizu_embed_compression {
+    CHIZU_EMBED_RAW,  /* the pixels as they are */
+    CHIZU_EMBED_LZ4   /* an LZ4 block of the pixels */
+} chizu_embed_compression;
+
+/**
+ * @brief An atlas compiled into a program, defined by a source written by chizu_export_source.
+ * @details data holds size bytes: tightly packed pixels in format, aligned to
+ * 64 bytes, or an LZ4 block of them. sprites holds count subimages, one per
+ * file name, in the order of the enum written by chizu_export_header.
+ */
+typedef struct chizu_embedded {
+    unsigned width, height;
+    chizu_pixel_format format;
+    chizu_embed_compression compression;
+    const void * data;
+    size_t size;
+    unsigned count;
+    const chizu_sprite * sprites;
+} chizu_embedded;
+
+/**
+ * @brief A binary spec, read in place by chizu_spec_open.
+ * @details data must stay valid (mapped) while the spec is used.
+ */
+typedef struct chizu_spec {
+    const void * data;
+    unsigned count;
+    unsigned width, height;
+    int packed;
+} chizu_spec;
 
 /**
  * @brief Type of the custom export function.
@@ -103,11 +268,51 @@ typedef chizu_export_status (*chizu_custom_export_func)(const czexport * node, v
  * @param pixels The pixels of the target image.
  * @param width The width of the target image.
  * @param height The height of the target image.
- * @param depth How many bytes per pixel.
+ * @param depth How many bits per pixel.
  * @param priv The custom private pointer.
  */
 typedef void (*chizu_receive_pixel_data_func)(const void * pixels, unsigned width, unsigned height, unsigned depth, void * priv);
 
+/**
+ * @brief Type of the function called when an asynchronous insert finishes.
+ * @param file The file that was inserted.
+ * @param status How the insertion went, as returned by chizu_insert.
+ * @param rect Where the subimage was placed, empty if it was not.
+ * @param priv The custom private pointer.
+ */
+typedef void (*chizu_insert_callback)(const char * file, chizu_insert_status status, chizu_rect rect, void * priv);
+
+/**
+ * @brief Allocation function of chizu_set_allocator.
+ * @param size How many bytes to allocate.
+ * @param user The user pointer given to chizu_set_allocator.
+ * @return The memory, suitably aligned for any type, or NULL.
+ */
+typedef void * (*chizu_malloc_func)(size_t size, void * user);
+
+/**
+ * @brief Reallocation function of chizu_set_allocator, with realloc semantics.
+ */
+typedef void * (*chizu_realloc_func)(void * ptr, size_t size, void * user);
+
+/**
+ * @brief Deallocation function of chizu_set_allocator. ptr is never NULL.
+ */
+typedef void (*chizu_free_func)(void * ptr, void * user);
+
+/**
+ * @brief chizu_set_allocator Makes every allocation of Chizu go through your functions.
+ * @param m Allocates memory.
+ * @param r Reallocates memory.
+ * @param f Frees memory.
+ * @param user Passed back to the three functions.
+ * @details This covers atlases, their pixels and the image codecs. Pass NULL
+ * functions to go back to malloc, realloc and free. Set it before creating
+ * any atlas: memory is always given back to the functions that allocated it,
+ * so changing them while atlases exist would mix allocators.
+ */
+CHIZU_API void chizu_set_allocator(chizu_malloc_func m, chizu_realloc_func r, chizu_free_func f, void * user);
+
 /**
  * @brief czinit Initializes image loading features of Chizu
  * @return CHIZU_INIT_OK if propertly initialized or CHIZU_INIT_FAIL if failed.
@@ -127,6 +332,79 @@ CHIZU_API void chizu_quit();
  */
 CHIZU_API chizu * chizu_create();
 
+/**
+ * @brief chizu_create_format Creates a new texture atlas with a fixed pixel format.
+ * @param format The pixel format of the atlas and of its exported texture.
+ * @return An chizu * atlas instance or NULL if format is invalid.
+ * @sa chizu_pixel_format
+ */
+CHIZU_API chizu * chizu_create_format(chizu_pixel_format format);
+
+/**
+ * @brief chizu_create_channel_packed Creates an RGBA atlas for single channel masks.
+ * @return An chizu * atlas instance.
+ * @details Each of R, G, B and A is packed as an independent layer, and every
+ * inserted image goes to the channel where it fits best. Images are read as
+ * masks: from their alpha channel if they have one or as grayscale otherwise.
+ * The channel of each subimage is reported in czexport::channel and as a sixth
+ * column of the spec file.
+ */
+CHIZU_API chizu * chizu_create_channel_packed();
+
+/**
+ * @brief chizu_set_mipmaps Sets how many mip levels are exported with the atlas.
+ * @param atlas The atlas to configure, best before inserting anything.
+ * @param levels How many levels besides the full size texture, 0 for none.
+ * At most CHIZU_MAX_MIPLEVELS; more are taken as that.
+ * @details Subimages are placed on (and padded to) multiples of 2^levels
+ * pixels, or of the largest power of two not above their smaller side if
+ * that is less, so small subimages do not take huge leases. A subimage is
+ * kept apart from the others in every level where it still spans a texel;
+ * in smaller levels it is only approximately separated, and its alpha
+ * coverage is no longer fitted. Subimages already in the atlas are not
+ * placed again, so their levels may still bleed into each other. Colors are filtered in linear space and
+ * the alpha coverage of each subimage is preserved across levels.
+ *
+ * chizu_export writes level N next to the texture, with N before the
+ * extension: atlas.png, atlas.1.png, atlas.2.png and so on. KTX2 textures
+ * hold all their levels in the same file instead.
+ */
+CHIZU_API void chizu_set_mipmaps(chizu * atlas, unsigned levels);
+
+/**
+ * @brief chizu_set_spec_format Sets the format of the spec written by chizu_export.
+ * @param atlas The atlas to configure.
+ * @param format CHIZU_SPEC_TEXT (the default) or CHIZU_SPEC_BINARY.
+ */
+CHIZU_API void chizu_set_spec_format(chizu * atlas, chizu_spec_format format);
+
+/**
+ * @brief chizu_cache_open Opens a cache of decoded images on disk, creating it if needed.
+ * @param dir The directory holding the cache, usually one per project.
+ * @param limit How many bytes the cache may keep when closed.
+ * @return The cache, or NULL if dir could not be created or read.
+ * @details Decoded images are stored compressed with LZ4, under the hash of
+ * their file contents, so inputs that did not change are never decoded
+ * again, whatever their name. Inputs whose path, size and modification time
+ * did not change are not even read. The cache is safe to share between
+ * atlases, threads and processes.
+ */
+CHIZU_API chizu_cache * chizu_cache_open(const char * dir, unsigned long long limit);
+
+/**
+ * @brief chizu_cache_close Closes a cache, removing the least recently used images beyond its limit.
+ * @param cache The cache to close. No atlas may still use it.
+ */
+CHIZU_API void chizu_cache_close(chizu_cache * cache);
+
+/**
+ * @brief chizu_set_cache Makes an atlas load the images it inserts through a cache.
+ * @param atlas The atlas to configure.
+ * @param cache The cache, or NULL to decode every image.
+ * @details Distance field inserts (chizu_insert_sdf) are not cached.
+ */
+CHIZU_API void chizu_set_cache(chizu * atlas, chizu_cache * cache);
+
 /**
  * @brief chizu_insert Inserts a new subimage in the atlas.
  * @param atlas The atlas instance to put the image into.
@@ -135,9 +413,155 @@ CHIZU_API chizu * chizu_create();
  * @return CHIZU_INSERT_FILEOPEN_FAIL if image could not be added.
  * @return CHIZU_INSERT_NOSPACE if there is no enough space to add.
  * @return CHIZU_INSERT_FAIL if an unknown error happened.
+ * @details Several threads can insert into the same atlas at once. The file
+ * is decoded and blitted without blocking other inserters; only finding
+ * space for it is serialized. This holds for every chizu_insert_* function.
  */
 CHIZU_API chizu_insert_status chizu_insert(chizu * atlas, const char * file);
 
+/**
+ * @brief chizu_insert_handle Inserts a new subimage and tells its handle.
+ * @param atlas The atlas instance to put the image into.
+ * @param file The path of the file to load.
+ * @param handle Receives the handle of the subimage, or CHIZU_NO_HANDLE if
+ * it was not inserted.
+ * @return The same as chizu_insert.
+ * @details Handles are small integers, given in the order subimages become
+ * visible, that never change: a handle is also the index of the subimage in
+ * the sprites of every chizu_layout that has it. Keep handles to look up
+ * rects with chizu_lookup_rect or through a layout, instead of names.
+ */
+CHIZU_API chizu_insert_status chizu_insert_handle(chizu * atlas, const char * file, unsigned * handle);
+
+/**
+ * @brief chizu_insert_async Inserts a new subimage without waiting for it.
+ * @param atlas The atlas instance to put the image into.
+ * @param file The path of the file to load.
+ * @param callback Called once the insertion is over, or NULL.
+ * @param priv Custom private pointer passed back to callback.
+ * @return A handle to poll or wait for the result, to be given back with
+ * chizu_future_release, or NULL if the insertion could not be queued.
+ * @details The file is read and decoded on a pool of threads owned by the
+ * atlas, so this returns right away. Images are packed in the order they
+ * were submitted, whatever order they finish decoding in. callback runs
+ * on a pool thread and must not wait for other insertions.
+ *
+ * The rect reported is where the subimage was placed; if the atlas grows
+ * afterwards every subimage moves (see chizu_layout_acquire).
+ */
+CHIZU_API chizu_future * chizu_insert_async(chizu * atlas, const char * file, chizu_insert_callback callback, void * priv);
+
+/**
+ * @brief chizu_future_done Checks, without blocking, if an asynchronous insert is over.
+ * @return Non zero once the result is available (and the callback ran).
+ */
+CHIZU_API int chizu_future_done(const chizu_future * future);
+
+/**
+ * @brief chizu_future_wait Waits for an asynchronous insert to finish.
+ * @param future The insertion to wait for.
+ * @param rect Receives where the subimage was placed, if not NULL.
+ * @return The status of the insertion, as chizu_insert returns.
+ */
+CHIZU_API chizu_insert_status chizu_future_wait(chizu_future * future, chizu_rect * rect);
+
+/**
+ * @brief chizu_future_release Gives back a handle from chizu_insert_async.
+ * @details The insertion goes on if it is not over. Every handle must be
+ * released before destroying its atlas.
+ */
+CHIZU_API void chizu_future_release(chizu_future * future);
+
+/**
+ * @brief chizu_future_handle Waits for an asynchronous insert and gets the handle of the subimage.
+ * @return The handle, or CHIZU_NO_HANDLE if the insertion failed.
+ * @sa chizu_insert_handle
+ */
+CHIZU_API unsigned chizu_future_handle(chizu_future * future);
+
+/**
+ * @brief chizu_lookup Finds the handle of a subimage by name, in constant time.
+ * @param atlas The atlas to search.
+ * @param name The file name the subimage was inserted with.
+ * @return Its handle, or CHIZU_NO_HANDLE if there is no such subimage. When
+ * the same file was inserted more than once, the latest one.
+ */
+CHIZU_API unsigned chizu_lookup(chizu * atlas, const char * name);
+
+/**
+ * @brief chizu_lookup_rect Finds where a subimage currently is, in constant time.
+ * @param atlas The atlas to search.
+ * @param handle The handle of the subimage.
+ * @param rect Receives the rect of the subimage.
+ * @return Non zero if handle names a subimage, 0 otherwise.
+ */
+CHIZU_API int chizu_lookup_rect(chizu * atlas, unsigned handle, chizu_rect * rect);
+
+/**
+ * @brief chizu_layout_export Writes the layout of many subimages at once into arrays.
+ * @param atlas The atlas to read.
+ * @param arrays Where to write, with room for max elements in each array.
+ * @param first The handle of the first subimage to write.
+ * @param max How many subimages to write at most.
+ * @return How many subimages were written, those with handles first to
+ * first + return - 1.
+ * @details Subimages are written by handle, so element i describes handle
+ * first + i. Nothing is called per subimage and each array is filled in
+ * one pass, making the arrays ready to be uploaded to the GPU as they are.
+ */
+CHIZU_API unsigned chizu_layout_export(chizu * atlas, const chizu_layout_arrays * arrays, unsigned first, unsigned max);
+
+/**
+ * @brief chizu_wait_all Waits until every asynchronous insert of the atlas is over.
+ * @details Call it before exporting, so the export has every subimage.
+ */
+CHIZU_API void chizu_wait_all(chizu * atlas);
+
+/**
+ * @brief chizu_insert_sdf Inserts a subimage converted to a signed distance field.
+ * @param atlas The atlas instance to put the image into.
+ * @param file The path of the (high resolution) file to load.
+ * @param downscale How many times smaller the distance field is than the file.
+ * @param spread The distance, in pixels of the distance field, covered by the
+ * full 0..255 range. It is also the border added around the image.
+ * @return The same values as chizu_insert.
+ * @details The distance field is single channel, with 128 on the edge and
+ * higher values inside. The shape is taken from the alpha channel of the file,
+ * or from its gray/red channel if it has no alpha.
+ * @sa chizu_insert_sdf_many
+ */
+CHIZU_API chizu_insert_status chizu_insert_sdf(chizu * atlas, const char * file, unsigned downscale, unsigned spread);
+
+/**
+ * @brief chizu_insert_sdf_many Inserts many subimages as signed distance fields.
+ * @param atlas The atlas instance to put the images into.
+ * @param files The paths of the files to load.
+ * @param count How many files there are.
+ * @param downscale See chizu_insert_sdf.
+ * @param spread See chizu_insert_sdf.
+ * @param statuses If not NULL, receives the insert status of each file.
+ * @return How many files were inserted.
+ * @details Files are loaded and converted in parallel, and inserted in the
+ * order they were given.
+ * @sa chizu_insert_sdf
+ */
+CHIZU_API unsigned chizu_insert_sdf_many(chizu * atlas, const char ** files, unsigned count, unsigned downscale, unsigned spread, chizu_insert_status * statuses);
+
+/**
+ * @brief chizu_insert_scaled Inserts one subimage in several atlases, each at its own scale.
+ * @param atlases The atlases to put the image into, one for each scale.
+ * @param scales The scale factors, relative to the image in file.
+ * @param count How many atlases and scales there are.
+ * @param file The path of the file to load.
+ * @return CHIZU_INSERT_OK if the subimage was added to every atlas.
+ * @return CHIZU_INSERT_FILEOPEN_FAIL if image could not be loaded.
+ * @return CHIZU_INSERT_FAIL if it could not be resized for some scale.
+ * @details The file is decoded only once and resampled for each atlas, which
+ * is useful to build @1x/@2x/@0.5x variants of the same set in one go. The
+ * image is decoded in the pixel format of the first atlas.
+ */
+CHIZU_API chizu_insert_status chizu_insert_scaled(chizu ** atlases, const float * scales, unsigned count, const char * file);
+
 /**
  * @brief chizu_export Exports the resulting atlas to a spec and texture file.
  * @param atlas The atlas to export.
@@ -153,6 +577,51 @@ CHIZU_API chizu_insert_status chizu_insert(chizu * atlas, const char * file);
  */
 CHIZU_API chizu_export_status chizu_export(chizu * atlas, const char * spec, const char * texture, chizu_export_format format);
 
+/**
+ * @brief chizu_export_header Writes a C/C++ header describing where every subimage is.
+ * @param atlas The atlas to export.
+ * @param path The header to write.
+ * @param prefix Prefix of every name in the header, usually the atlas name.
+ * @return CHIZU_EXPORT_OK, or CHIZU_EXPORT_SPEC_FAIL if the file could not
+ * be written.
+ * @details The header has an enum with one constant per subimage, sorted by
+ * file name (PREFIX_PLAYER_PNG for player.png), their rects and texture
+ * coordinates in prefix_rects, indexed by those constants, and their names
+ * in prefix_names. These are constexpr in C++11 and static const in C, so
+ * the compiler can fold them. prefix_find(name) looks a subimage up by name
+ * with a minimal perfect hash and one string comparison, returning -1 if
+ * there is none. A file inserted more than once appears once, at its
+ * latest position. An empty atlas gets an empty enum and a prefix_find that
+ * always returns -1.
+ */
+CHIZU_API chizu_export_status chizu_export_header(chizu * atlas, const char * path, const char * prefix);
+
+/**
+ * @brief chizu_export_source Writes a C source embedding the atlas.
+ * @param atlas The atlas to export.
+ * @param path The source to write.
+ * @param prefix The source defines a const chizu_embedded named
+ * prefix_embedded (made a valid identifier, in lower case).
+ * @param compression How to store the pixels.
+ * @return CHIZU_EXPORT_OK, or CHIZU_EXPORT_SPEC_FAIL if the file could not
+ * be written.
+ * @details Compiling the source into a program leaves nothing to open or
+ * decode at startup: declare it with
+ * `extern const chizu_embedded prefix_embedded;` and upload its data
+ * directly if raw, or through chizu_embedded_pixels. Combine it with
+ * chizu_export_header to refer to subimages by enum: its constants index
+ * prefix_embedded.sprites as well.
+ */
+CHIZU_API chizu_export_status chizu_export_source(chizu * atlas, const char * path, const char * prefix, chizu_embed_compression compression);
+
+/**
+ * @brief chizu_embedded_pixels Gets the pixels of an embedded atlas.
+ * @param embedded The embedded atlas.
+ * @param pixels Receives width * height pixels, tightly packed.
+ * @return Non zero on success, 0 if the data is damaged.
+ */
+CHIZU_API int chizu_embedded_pixels(const chizu_embedded * embedded, void * pixels);
+
 /**
  * @brief chizu_custom_export Calls your custom function on each subrect.
  * @param atlas The atlas that will be exported
@@ -168,21 +637,268 @@ CHIZU_API chizu_export_status chizu_custom_export(chizu * atlas, chizu_custom_ex
  * @param f The function that will receive the pixel data.
  * @param priv Custom private pointer to be passed back to f.
  * @details This function is useful in case of custom exporting.
- * The containing pixel data is always RGBA (or ABGR on low-endian).
+ * The containing pixel data has the format the atlas was created with,
+ * RGBA (or ABGR on low-endian) by default.
+ *
+ * The atlas keeps its texture composed as subimages are inserted, so this
+ * does not copy or allocate anything. Use chizu_dirty_rects to know which
+ * parts changed since the last time.
  *
- * Thus, the size of this buffer is always (width * height * 4) bytes, if you
- * want to copy it.
+ * Thus, the size of this buffer is always (width * height * depth / 8) bytes,
+ * if you want to copy it.
  *
  * Do not store the pixels pointer passed to you as they may be invalid after
- * your function returns.
+ * your function returns. Inserts running on other threads may blit into the
+ * pixels while f reads them, but the atlas cannot grow until f returns, so f
+ * must not insert into the same atlas.
  */
 CHIZU_API void chizu_pixel_data(chizu * atlas, chizu_receive_pixel_data_func f, void * priv);
 
+/**
+ * @brief chizu_read_pixels Copies the atlas texture, or part of it, to your memory.
+ * @param atlas The atlas to read.
+ * @param area The part of the texture to copy, or NULL for all of it.
+ * @param pixels Where the first pixel of area goes.
+ * @param pitch The distance in bytes between rows of pixels, at least
+ * (area width * depth / 8). Mapped upload buffers often need rows aligned to
+ * 256 bytes, for example.
+ * @param swizzle For each channel of the atlas, which channel of the texture
+ * goes there, or NULL to keep the order. { 2, 1, 0, 3 } writes BGRA pixels
+ * out of an RGBA atlas.
+ * @return CHIZU_EXPORT_OK, or CHIZU_EXPORT_FAIL if area is outside the
+ * texture, pitch is too small or swizzle names a channel the atlas lacks.
+ * @details Pixels go straight from the composed texture to pixels, so it can
+ * point into a mapped staging buffer. 8 bit RGBA swizzles work on whole
+ * pixels at a time; combined with chizu_dirty_rects only the changed regions
+ * need to be written.
+ */
+CHIZU_API chizu_export_status chizu_read_pixels(chizu * atlas, const chizu_rect * area, void * pixels, unsigned pitch, const unsigned char * swizzle);
+
+/**
+ * @brief chizu_dirty_rects Queries which parts of the texture changed since the last query.
+ * @param atlas The atlas to query.
+ * @param rects Receives the changed rectangles.
+ * @param max How many rectangles fit in rects.
+ * @return How many rectangles were written, 0 if nothing changed.
+ * @details Rectangles that touch are coalesced, and the closest ones merged
+ * further until they fit in max. When the atlas grows every subimage moves,
+ * so a single rectangle covering the whole (new) texture is reported.
+ * Querying clears the changes, whatever the value of max.
+ */
+CHIZU_API unsigned chizu_dirty_rects(chizu * atlas, chizu_rect * rects, unsigned max);
+
+/**
+ * @brief chizu_save_state Saves the whole atlas to a file chizu_load_state can restore.
+ * @param atlas The atlas to save.
+ * @param path The file to write.
+ * @return CHIZU_EXPORT_OK, or CHIZU_EXPORT_FAIL if the file could not be written.
+ * @details The file holds the packing trees (free space included), the
+ * subimages and the composed texture, in the memory layout of this machine.
+ * It is meant as a cache to start up faster, not to be shipped to other
+ * platforms. Subimages still being inserted are left out.
+ */
+CHIZU_API chizu_export_status chizu_save_state(chizu * atlas, const char * path);
+
+/**
+ * @brief chizu_load_state Restores an atlas saved by chizu_save_state.
+ * @param path The file to read.
+ * @return The atlas, or NULL if the file is missing, malformed or was saved
+ * by another version of Chizu or kind of machine.
+ * @details Nothing is decoded or packed again: the file is mapped in memory
+ * and its texture used in place, so loading takes about as long as reading
+ * the packing trees. The atlas accepts new subimages as any other, and the
+ * whole texture is reported dirty.
+ */
+CHIZU_API chizu * chizu_load_state(const char * path);
+
+/**
+ * @brief chizu_open Opens an atlas exported by chizu_export to add subimages to it.
+ * @param spec The spec file, text or binary.
+ * @param texture The texture file, in any format chizu can insert.
+ * @return The atlas, or NULL if either file is missing or malformed, its
+ * subimages overlap or fall outside the texture.
+ * @details Only the texture is decoded; no subimage is read again. The
+ * packing trees are rebuilt from the spec with the free space between the
+ * subimages, which new ones fill before the atlas has to grow. The format
+ * comes from the texture (8 bits per channel) and the spec format from the
+ * spec. Nothing is reported dirty until something is inserted, so
+ * chizu_dirty_rects tells which regions of the old texture changed. Specs
+ * do not record mip levels, so set them again with chizu_set_mipmaps.
+ */
+CHIZU_API chizu * chizu_open(const char * spec, const char * texture);
+
+/**
+ * @brief chizu_set_stable_layout Keeps the subimages of a previous build where they were.
+ * @param atlas A new atlas, nothing inserted in it yet.
+ * @param spec The spec file of the previous build, text or binary.
+ * @param texture The texture file of the previous build, or NULL.
+ * @return 1, or 0 if the atlas is not empty or shared, or the spec is missing
+ * or malformed. The atlas is packed as usual then.
+ * @details The places of the previous subimages are reserved. Inserting a
+ * file with the same name and size takes its old place; new and resized
+ * files are packed in the space left, and a growing atlas moves nothing.
+ * The old place of a resized file is freed; places of files not inserted
+ * again stay empty in this build. With the
+ * previous texture, kept subimages are compared to their old pixels, so
+ * chizu_export_delta only lists the ones that really changed.
+ */
+CHIZU_API int chizu_set_stable_layout(chizu * atlas, const char * spec, const char * texture);
+
+/**
+ * @brief chizu_export_delta Writes what changed since the layout given to chizu_set_stable_layout.
+ * @param atlas The atlas to compare.
+ * @param path The text file to write.
+ * @return CHIZU_EXPORT_OK, or CHIZU_EXPORT_FAIL if the file could not be written.
+ * @details One line per subimage that is not exactly as it was, in the
+ * format of the text spec preceded by the change: added, moved (placed
+ * anew, followed by the old x, y, width, height and channel if packed),
+ * changed (same place, other pixels) or removed (with its old place). A
+ * file appears on one line at most.
+ * Without a stable layout every subimage is added.
+ */
+CHIZU_API chizu_export_status chizu_export_delta(chizu * atlas, const char * path);
+
+/**
+ * @brief chizu_layout_register Registers a thread reading layout snapshots.
+ * @param atlas The atlas to read.
+ * @return A reader id for chizu_layout_acquire, or -1 if 64 readers are
+ * already registered.
+ * @details Each reading thread needs its own id.
+ */
+CHIZU_API int chizu_layout_register(chizu * atlas);
+
+/**
+ * @brief chizu_layout_unregister Gives back an id from chizu_layout_register.
+ */
+CHIZU_API void chizu_layout_unregister(chizu * atlas, int reader);
+
+/**
+ * @brief chizu_layout_acquire Gets the current layout of the atlas without locking.
+ * @param atlas The atlas to read.
+ * @param reader The id of the calling thread.
+ * @return The latest layout, valid until chizu_layout_release.
+ * @details Inserts keep going meanwhile: they publish new layouts instead
+ * of changing this one, and a subimage only shows up once its pixels are in
+ * the texture. Hold layouts briefly, as the memory of the ones replaced
+ * cannot be reclaimed while any reader holds an older one.
+ */
+CHIZU_API const chizu_layout * chizu_layout_acquire(chizu * atlas, int reader);
+
+/**
+ * @brief chizu_layout_release Ends the use of the layout acquired by reader.
+ */
+CHIZU_API void chizu_layout_release(chizu * atlas, int reader);
+
+/**
+ * @brief chizu_create_shared Creates an atlas living in named shared memory.
+ * @param name The name of the segment, such as "/game-ui" (POSIX names
+ * start with a slash). A segment of the same name is replaced.
+ * @param format The pixel format of the atlas.
+ * @param width The fixed width of the texture.
+ * @param height The fixed height of the texture.
+ * @param maxsprites How many subimages it can hold at most.
+ * @return The atlas, or NULL if the segment could not be created.
+ * @details The texture and the subimage table are in the segment, so any
+ * number of processes can chizu_attach_shared to it without copying. A
+ * shared atlas never grows: inserting returns CHIZU_INSERT_NOSPACE once
+ * the texture, the table or the room for names (64 bytes per subimage on
+ * average) is full. Destroying the atlas removes the segment name;
+ * attached processes keep their mapping.
+ */
+CHIZU_API chizu * chizu_create_shared(const char * name, chizu_pixel_format format, unsigned width, unsigned height, unsigned maxsprites);
+
+/**
+ * @brief chizu_attach_shared Maps, read only, an atlas made by chizu_create_shared in another process.
+ * @param name The name given to chizu_create_shared.
+ * @return A handle to read the atlas, or NULL if there is none (yet).
+ */
+CHIZU_API chizu_shared * chizu_attach_shared(const char * name);
+
+/**
+ * @brief chizu_shared_version Tells how many subimages the builder published so far.
+ * @details This only grows, and reading it costs one load: poll it to know
+ * when to refresh the layout or texture.
+ */
+CHIZU_API unsigned long chizu_shared_version(chizu_shared * shared);
+
+/**
+ * @brief chizu_shared_layout Gets the subimage table of a shared atlas, in place.
+ * @param shared The attached atlas.
+ * @param count Receives how many records are valid, the current version
+ * (never more than the table holds).
+ * @return The records. They never change once published, and their pixels
+ * are in the texture by then.
+ */
+CHIZU_API const chizu_shared_sprite * chizu_shared_layout(chizu_shared * shared, unsigned * count);
+
+/**
+ * @brief chizu_shared_name The name of a subimage of a shared atlas.
+ * @return The name, or an empty one if the record points outside the names.
+ */
+CHIZU_API const char * chizu_shared_name(chizu_shared * shared, const chizu_shared_sprite * sprite);
+
+/**
+ * @brief chizu_shared_pixels Gets the texture of a shared atlas, in place.
+ * @param shared The attached atlas.
+ * @param width Receives the width of the texture, if not NULL.
+ * @param height Receives the height of the texture, if not NULL.
+ * @param format Receives the pixel format, if not NULL.
+ * @return The pixels, tightly packed.
+ */
+CHIZU_API const void * chizu_shared_pixels(chizu_shared * shared, unsigned * width, unsigned * height, chizu_pixel_format * format);
+
+/**
+ * @brief chizu_detach_shared Unmaps an atlas attached with chizu_attach_shared.
+ */
+CHIZU_API void chizu_detach_shared(chizu_shared * shared);
+
+/**
+ * @brief chizu_spec_open Reads a binary spec in place.
+ * @param spec The spec to fill.
+ * @param data The contents of the spec file, 4 byte aligned (a mapped file
+ * is). It is not copied.
+ * @param size The size of data in bytes.
+ * @return Non zero if data is a valid spec, 0 otherwise.
+ * @details The whole file is checked here, so the other chizu_spec
+ * functions never read out of it. None of them allocates.
+ */
+CHIZU_API int chizu_spec_open(chizu_spec * spec, const void * data, size_t size);
+
+/**
+ * @brief chizu_spec_find Finds a subimage of a binary spec by name.
+ * @param spec The spec, opened by chizu_spec_open.
+ * @param name The file name the subimage was inserted with.
+ * @return Its index, from 0 to spec->count - 1, or CHIZU_NO_HANDLE if there
+ * is no such subimage. Subimages are sorted by name.
+ */
+CHIZU_API unsigned chizu_spec_find(const chizu_spec * spec, const char * name);
+
+/**
+ * @brief chizu_spec_rect Gets where a subimage of a binary spec is.
+ * @param spec The spec, opened by chizu_spec_open.
+ * @param index The index of the subimage.
+ * @param rect Receives its rect.
+ * @param channel Receives its channel in channel packed atlases, may be NULL.
+ * @return Non zero if index names a subimage, 0 otherwise.
+ */
+CHIZU_API int chizu_spec_rect(const chizu_spec * spec, unsigned index, chizu_rect * rect, unsigned * channel);
+
+/**
+ * @brief chizu_spec_name Gets the name of a subimage of a binary spec.
+ * @param spec The spec, opened by chizu_spec_open.
+ * @param index The index of the subimage.
+ * @param name Receives the name, truncated to size - 1 characters and NUL
+ * terminated. May be NULL if size is 0.
+ * @param size The size of name in bytes.
+ * @return The length of the whole name, 0 if index names no subimage.
+ */
+CHIZU_API unsigned chizu_spec_name(const chizu_spec * spec, unsigned index, char * name, unsigned size);
+
 /**
  * @brief chizu_destroy Destroys and frees the memory used by a chizu atlas instance
  * @param atlas The atlas to destroy.
- * @details The atlas becomes invalid after this, together with any pointer
- * returned. Using it will result in doomsday.
+ * @details Pending asynchronous inserts are finished first. The atlas
+ * becomes invalid after this, together with any pointer returned. Using it will result in doomsday.
  */
 CHIZU_API void chizu_destroy(chizu * atlas);
 
@@ -0,0 +1,92 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void * czalloc_internal_malloc(size_t size, void * user);
+static void * czalloc_internal_realloc(void * ptr, size_t size, void * user);
+static void czalloc_internal_free(void * ptr, void * user);
+
+static czalloc_malloc_func czalloc_internal_m = czalloc_internal_malloc;
+static czalloc_realloc_func czalloc_internal_r = czalloc_internal_realloc;
+static czalloc_free_func czalloc_internal_f = czalloc_internal_free;
+static void * czalloc_internal_user = NULL;
+
+/* NULL functions go back to the C library ones */
+void czalloc_set(czalloc_malloc_func m, czalloc_realloc_func r, czalloc_free_func f, void * user) {
+    if (m == NULL || r == NULL || f == NULL) {
+        m = czalloc_internal_malloc;
+        r = czalloc_internal_realloc;
+        f = czalloc_internal_free;
+        user = NULL;
+    }
+    czalloc_internal_m = m;
+    czalloc_internal_r = r;
+    czalloc_internal_f = f;
+    czalloc_internal_user = user;
+}
+
+void * czalloc_malloc(size_t size) {
+    return czalloc_internal_m(size, czalloc_internal_user);
+}
+
+void * czalloc_calloc(size_t count, size_t size) {
+    void * p = NULL;
+    if (size != 0 && count > (size_t) -1 / size)
+        return NULL;
+    p = czalloc_internal_m(count * size, czalloc_internal_user);
+    if (p != NULL)
+        memset(p, 0, count * size);
+    return p;
+}
+
+void * czalloc_realloc(void * ptr, size_t size) {
+    return czalloc_internal_r(ptr, size, czalloc_internal_user);
+}
+
+void czalloc_free(void * ptr) {
+    if (ptr != NULL)
+        czalloc_internal_f(ptr, czalloc_internal_user);
+}
+
+
+/* internal functions */
+
+static void * czalloc_internal_malloc(size_t size, void * user) {
+    (void) user;
+    return malloc(size);
+}
+
+static void * czalloc_internal_realloc(void * ptr, size_t size, void * user) {
+    (void) user;
+    return realloc(ptr, size);
+}
+
+static void czalloc_internal_free(void * ptr, void * user) {
+    (void) user;
+    free(ptr);
+}
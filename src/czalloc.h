@@ -0,0 +1,41 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef CZALLOC_H
+#define CZALLOC_H
+
+#include <stddef.h>
+
+typedef void * (*czalloc_malloc_func)(size_t size, void * user);
+typedef void * (*czalloc_realloc_func)(void * ptr, size_t size, void * user);
+typedef void (*czalloc_free_func)(void * ptr, void * user);
+
+void czalloc_set(czalloc_malloc_func m, czalloc_realloc_func r, czalloc_free_func f, void * user);
+void * czalloc_malloc(size_t size);
+void * czalloc_calloc(size_t count, size_t size);
+void * czalloc_realloc(void * ptr, size_t size);
+void czalloc_free(void * ptr);
+
+#endif
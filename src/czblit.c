@@ -0,0 +1,229 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czblit.h"
+#include "czthread.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define CZBLIT_X86
+#   include <immintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#       define CZBLIT_TARGET(t)
+#   else
+#       define CZBLIT_TARGET(t) __attribute__((target(t)))
+#   endif
+#endif
+
+#if !defined(_WIN32)
+#   include <unistd.h>
+#endif
+
+#define CZBLIT_MAX_CACHE_INFOS 256
+
+/*
+ * Cached copies are a memcpy per row: measured fairly (warm, taking turns,
+ * see bench/blit.c) the C library beats hand written SSE2 and AVX2 loops.
+ * Destinations far larger than the last level cache can be written with
+ * non-temporal stores instead, so composing a huge atlas does not evict
+ * everything else; that kernel is picked once for the cpu, on first use.
+ */
+
+/* data type declarations */
+
+typedef void (*czblit_kernel)(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows);
+
+/* internal forward declarations */
+
+static void czblit_internal_select(void);
+static size_t czblit_internal_llc_bytes();
+static void czblit_internal_rows_memcpy(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows);
+#if defined(CZBLIT_X86)
+static int czblit_internal_has_avx2();
+static void czblit_internal_stream_sse2(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows);
+static void czblit_internal_stream_avx2(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows);
+#endif
+
+/* written once under czblit_internal_once, read only afterwards */
+static czthread_once_flag czblit_internal_once = CZTHREAD_ONCE_INIT;
+static czblit_kernel czblit_internal_stream = NULL;
+static const char * czblit_internal_name = NULL;
+static size_t czblit_internal_stream_min = 0;
+
+/*
+ * Copies rows of rowbytes bytes from src to dst. stream asks for
+ * non-temporal stores, so a large destination does not evict the cache; it
+ * is ignored for short rows and on cpus without them.
+ */
+void czblit_rows(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows, int stream) {
+    czthread_once(&czblit_internal_once, czblit_internal_select);
+    if (stream && rowbytes >= CZBLIT_STREAM_ROW_BYTES)
+        czblit_internal_stream(src, srcpitch, dst, dstpitch, rowbytes, rows);
+    else
+        czblit_internal_rows_memcpy(src, srcpitch, dst, dstpitch, rowbytes, rows);
+}
+
+/* how large a destination must be to be worth streaming, from the last level cache */
+size_t czblit_stream_bytes() {
+    czthread_once(&czblit_internal_once, czblit_internal_select);
+    return czblit_internal_stream_min;
+}
+
+/* the name of the streaming kernel picked for this cpu */
+const char * czblit_kernel_name() {
+    czthread_once(&czblit_internal_once, czblit_internal_select);
+    return czblit_internal_name;
+}
+
+
+/* internal functions */
+
+static void czblit_internal_select(void) {
+    czblit_kernel kernel = czblit_internal_rows_memcpy;
+    const char * name = "memcpy";
+#if defined(CZBLIT_X86)
+    if (czblit_internal_has_avx2()) {
+        kernel = czblit_internal_stream_avx2;
+        name = "avx2";
+    } else {
+        kernel = czblit_internal_stream_sse2;
+        name = "sse2";
+    }
+#endif
+    czblit_internal_name = name;
+    czblit_internal_stream = kernel;
+    czblit_internal_stream_min = czblit_internal_llc_bytes() * CZBLIT_STREAM_LLC_FACTOR;
+}
+
+/* the size of the largest cache, or CZBLIT_DEFAULT_LLC_BYTES if unknown */
+static size_t czblit_internal_llc_bytes() {
+    size_t llc = 0;
+#if defined(_WIN32)
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION infos[CZBLIT_MAX_CACHE_INFOS];
+    DWORD bytes = sizeof(infos), i = 0;
+    if (GetLogicalProcessorInformation(infos, &bytes)) {
+        for (i = 0; i < bytes / sizeof(infos[0]); i++)
+            if (infos[i].Relationship == RelationCache && infos[i].Cache.Size > llc)
+                llc = infos[i].Cache.Size;
+    }
+#else
+    long size = 0;
+#   if defined(_SC_LEVEL3_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#   endif
+#   if defined(_SC_LEVEL2_CACHE_SIZE)
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#   endif
+    if (size > 0)
+        llc = (size_t) size;
+#endif
+    return llc > 0 ? llc : CZBLIT_DEFAULT_LLC_BYTES;
+}
+
+static void czblit_internal_rows_memcpy(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows) {
+    unsigned y = 0;
+    for (y = 0; y < rows; y++, src += srcpitch, dst += dstpitch)
+        memcpy(dst, src, rowbytes);
+}
+
+#if defined(CZBLIT_X86)
+
+static int czblit_internal_has_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+    __cpuid(info, 1);
+    /* the os must save ymm registers (osxsave and xcr0 bits 1 and 2) */
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+/*
+ * Destinations are aligned with a short memcpy so the streaming stores are
+ * aligned; loads stay unaligned. The next source row is prefetched while
+ * the current one is copied.
+ */
+CZBLIT_TARGET("sse2")
+static void czblit_internal_stream_sse2(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows) {
+    unsigned y = 0;
+    for (y = 0; y < rows; y++, src += srcpitch, dst += dstpitch) {
+        const unsigned char * next = y + 1 < rows ? src + srcpitch : src;
+        size_t i = (16 - ((size_t) dst & 15)) & 15;
+        if (i > rowbytes)
+            i = rowbytes;
+        memcpy(dst, src, i);
+        for (; i + 64 <= rowbytes; i += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (src + i + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *) (src + i + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *) (src + i + 48));
+            _mm_prefetch((const char *) (next + i), _MM_HINT_T0);
+            _mm_stream_si128((__m128i *) (dst + i), a);
+            _mm_stream_si128((__m128i *) (dst + i + 16), b);
+            _mm_stream_si128((__m128i *) (dst + i + 32), c);
+            _mm_stream_si128((__m128i *) (dst + i + 48), d);
+        }
+        memcpy(dst + i, src + i, rowbytes - i);
+    }
+    _mm_sfence();
+}
+
+CZBLIT_TARGET("avx2")
+static void czblit_internal_stream_avx2(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows) {
+    unsigned y = 0;
+    for (y = 0; y < rows; y++, src += srcpitch, dst += dstpitch) {
+        const unsigned char * next = y + 1 < rows ? src + srcpitch : src;
+        size_t i = (32 - ((size_t) dst & 31)) & 31;
+        if (i > rowbytes)
+            i = rowbytes;
+        memcpy(dst, src, i);
+        for (; i + 128 <= rowbytes; i += 128) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *) (src + i + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *) (src + i + 96));
+            _mm_prefetch((const char *) (next + i), _MM_HINT_T0);
+            _mm_prefetch((const char *) (next + i + 64), _MM_HINT_T0);
+            _mm256_stream_si256((__m256i *) (dst + i), a);
+            _mm256_stream_si256((__m256i *) (dst + i + 32), b);
+            _mm256_stream_si256((__m256i *) (dst + i + 64), c);
+            _mm256_stream_si256((__m256i *) (dst + i + 96), d);
+        }
+        memcpy(dst + i, src + i, rowbytes - i);
+    }
+    _mm_sfence();
+}
+
+#endif
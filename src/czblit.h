@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef CZBLIT_H
+#define CZBLIT_H
+
+#include <stddef.h>
+
+/* destinations this many times the last level cache are worth streaming... */
+#define CZBLIT_STREAM_LLC_FACTOR 8
+/* ...but only rows this long, shorter ones are slower streamed than cached */
+#define CZBLIT_STREAM_ROW_BYTES 16384
+/* the last level cache assumed when the system does not tell its size */
+#define CZBLIT_DEFAULT_LLC_BYTES (8ul * 1024 * 1024)
+
+void czblit_rows(const unsigned char * src, size_t srcpitch, unsigned char * dst, size_t dstpitch, size_t rowbytes, unsigned rows, int stream);
+size_t czblit_stream_bytes();
+const char * czblit_kernel_name();
+
+#endif
@@ -0,0 +1,410 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czcache.h"
+#include "czalloc.h"
+#include "czlz4.h"
+#include "czthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#   include <direct.h>
+#   include <sys/utime.h>
+#   define czcache_internal_touch(path) _utime(path, NULL)
+#   define czcache_internal_pid() ((long) GetCurrentProcessId())
+#else
+#   include <dirent.h>
+#   include <unistd.h>
+#   include <utime.h>
+#   define czcache_internal_touch(path) utime(path, NULL)
+#   define czcache_internal_pid() ((long) getpid())
+#endif
+
+/*
+ * A directory of decoded images, so unchanged inputs are never decoded
+ * again. Each decoded image is a content entry (.czc), named by the hash of
+ * the file bytes and of the variant (how it was converted): a header and
+ * the pixels as an LZ4 block. Each input path has a path entry (.czp),
+ * named by the hash of the path and variant, remembering the size,
+ * modification time and content hash it had: when they still match, the
+ * input is not even read.
+ *
+ * Entries are written to a temporary file and renamed, so concurrent
+ * loaders and processes never see half an entry. Hits touch their entries,
+ * and czcache_prune removes the least recently used ones beyond the limit.
+ */
+
+#define CZCACHE_VERSION 1
+
+/* data type declarations */
+
+struct czcache {
+    char * dir;
+    unsigned long long limit;
+    volatile long temporaries;
+};
+
+typedef struct czcache_content {
+    char magic[4];
+    unsigned version;
+    unsigned variant;
+    unsigned width, height;
+    unsigned channels, type;
+    unsigned long long size;    /* pixel bytes */
+    unsigned long long packed;  /* bytes of the LZ4 block that follows */
+} czcache_content;
+
+typedef struct czcache_path {
+    char magic[4];
+    unsigned version;
+    unsigned variant;
+    unsigned length;            /* of the path that follows */
+    long long mtime;
+    unsigned long long size;
+    unsigned long long content;
+} czcache_path;
+
+typedef struct czcache_file {
+    char * name;
+    unsigned long long size;
+    long long mtime;
+} czcache_file;
+
+static const char czcache_content_magic[4] = { 'C', 'Z', 'C', 'C' };
+static const char czcache_path_magic[4] = { 'C', 'Z', 'C', 'P' };
+
+/* internal forward declarations */
+
+static unsigned long long czcache_internal_hash(unsigned long long hash, const void * data, size_t size);
+static char * czcache_internal_name(czcache * cache, unsigned long long key, const char * extension);
+static char * czcache_internal_full_path(const char * file);
+static void * czcache_internal_read(const char * path, size_t * size);
+static int czcache_internal_write(czcache * cache, const char * path, const void * header, size_t headersize, const void * data, size_t size);
+static czsurface * czcache_internal_get(czcache * cache, unsigned long long key, unsigned variant);
+static void czcache_internal_put(czcache * cache, unsigned long long key, unsigned variant, czsurface * surface);
+static int czcache_internal_compare_files(const void * a, const void * b);
+static czcache_file * czcache_internal_list(czcache * cache, unsigned * count);
+
+/* opens (creating it if needed) the cache in dir, pruned to limit bytes */
+czcache * czcache_open(const char * dir, unsigned long long limit) {
+    struct stat info;
+    czcache * cache = NULL;
+#if defined(_WIN32)
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+    if (stat(dir, &info) != 0 || (info.st_mode & S_IFMT) != S_IFDIR)
+        return NULL;
+    cache = czalloc_calloc(1, sizeof(czcache));
+    if (cache == NULL)
+        return NULL;
+    cache->dir = czalloc_malloc(strlen(dir) + 1);
+    if (cache->dir == NULL) {
+        czalloc_free(cache);
+        return NULL;
+    }
+    strcpy(cache->dir, dir);
+    cache->limit = limit;
+    return cache;
+}
+
+/*
+ * Loads file as decode(file, priv) would, from the cache if possible.
+ * variant tells apart different decodings of the same file.
+ */
+czsurface * czcache_load(czcache * cache, const char * file, unsigned variant, czcache_decode_func decode, void * priv) {
+    struct stat info;
+    czcache_path path;
+    czcache_path * entry = NULL;
+    czsurface * surface = NULL;
+    char * full = NULL, * name = NULL;
+    void * bytes = NULL;
+    size_t size = 0;
+    unsigned long long key = 0;
+    if (stat(file, &info) != 0 || (full = czcache_internal_full_path(file)) == NULL)
+        return decode(file, priv);
+
+    /* fast path: the input did not change since it was last seen */
+    memset(&path, 0, sizeof(path));
+    memcpy(path.magic, czcache_path_magic, sizeof(path.magic));
+    path.version = CZCACHE_VERSION;
+    path.variant = variant;
+    path.length = (unsigned) strlen(full);
+    path.mtime = (long long) info.st_mtime;
+    path.size = (unsigned long long) info.st_size;
+    key = czcache_internal_hash(czcache_internal_hash(14695981039346656037ull, full, path.length), &variant, sizeof(variant));
+    name = czcache_internal_name(cache, key, ".czp");
+    if (name != NULL && (entry = czcache_internal_read(name, &size)) != NULL && size == sizeof(path) + path.length
+            && memcmp(entry, &path, offsetof(czcache_path, content)) == 0
+            && memcmp(entry + 1, full, path.length) == 0) {
+        surface = czcache_internal_get(cache, entry->content, variant);
+        if (surface != NULL)
+            czcache_internal_touch(name);
+    }
+    czalloc_free(entry);
+
+    /* slow path: the same bytes may have been decoded before, under any name */
+    if (surface == NULL && (bytes = czcache_internal_read(file, &size)) != NULL) {
+        path.content = czcache_internal_hash(czcache_internal_hash(14695981039346656037ull, bytes, size), &variant, sizeof(variant));
+        czalloc_free(bytes);
+        surface = czcache_internal_get(cache, path.content, variant);
+        if (surface == NULL) {
+            surface = decode(file, priv);
+            if (surface != NULL)
+                czcache_internal_put(cache, path.content, variant, surface);
+        }
+        if (surface != NULL && name != NULL)
+            czcache_internal_write(cache, name, &path, sizeof(path), full, path.length);
+    } else if (surface == NULL) {
+        surface = decode(file, priv);
+    }
+
+    czalloc_free(name);
+    free(full);
+    return surface;
+}
+
+/* removes the least recently used entries until the cache fits its limit */
+void czcache_prune(czcache * cache) {
+    czcache_file * files = NULL;
+    unsigned count = 0, i = 0;
+    unsigned long long total = 0;
+    files = czcache_internal_list(cache, &count);
+    if (files == NULL)
+        return;
+    for (i = 0; i < count; i++)
+        total += files[i].size;
+    qsort(files, count, sizeof(czcache_file), czcache_internal_compare_files);
+    for (i = 0; i < count; i++) {
+        if (total > cache->limit && remove(files[i].name) == 0)
+            total -= files[i].size;
+        czalloc_free(files[i].name);
+    }
+    czalloc_free(files);
+}
+
+/* prunes and frees the cache */
+void czcache_close(czcache * cache) {
+    if (cache == NULL)
+        return;
+    czcache_prune(cache);
+    czalloc_free(cache->dir);
+    czalloc_free(cache);
+}
+
+
+/* internal functions */
+
+/* 64 bit FNV-1a, continuing from hash */
+static unsigned long long czcache_internal_hash(unsigned long long hash, const void * data, size_t size) {
+    const unsigned char * p = (const unsigned char *) data;
+    size_t i = 0;
+    for (i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    return hash;
+}
+
+/* dir/<key in hex><extension> */
+static char * czcache_internal_name(czcache * cache, unsigned long long key, const char * extension) {
+    char * name = czalloc_malloc(strlen(cache->dir) + strlen(extension) + 18);
+    if (name != NULL)
+        sprintf(name, "%s/%08x%08x%s", cache->dir, (unsigned) (key >> 32), (unsigned) key, extension);
+    return name;
+}
+
+/* allocated by the C library, free it with free() */
+static char * czcache_internal_full_path(const char * file) {
+#if defined(_WIN32)
+    return _fullpath(NULL, file, 0);
+#else
+    return realpath(file, NULL);
+#endif
+}
+
+static void * czcache_internal_read(const char * path, size_t * size) {
+    FILE * in = fopen(path, "rb");
+    long length = 0;
+    void * data = NULL;
+    if (in == NULL)
+        return NULL;
+    if (fseek(in, 0, SEEK_END) == 0 && (length = ftell(in)) >= 0 && fseek(in, 0, SEEK_SET) == 0) {
+        data = czalloc_malloc(length > 0 ? (size_t) length : 1);
+        if (data != NULL && fread(data, 1, (size_t) length, in) != (size_t) length) {
+            czalloc_free(data);
+            data = NULL;
+        }
+    }
+    fclose(in);
+    *size = (size_t) length;
+    return data;
+}
+
+/* writes header and data to a temporary file, then renames it to path */
+static int czcache_internal_write(czcache * cache, const char * path, const void * header, size_t headersize, const void * data, size_t size) {
+    char * temporary = czalloc_malloc(strlen(path) + 40);
+    FILE * out = NULL;
+    long serial = 0;
+    int ok = 0;
+    if (temporary == NULL)
+        return 0;
+    do {
+        serial = czthread_atomic_load(&cache->temporaries);
+    } while (!czthread_atomic_cas(&cache->temporaries, serial, serial + 1));
+    sprintf(temporary, "%s.%ld.%ld.tmp", path, czcache_internal_pid(), serial);
+    out = fopen(temporary, "wb");
+    if (out != NULL) {
+        ok = fwrite(header, headersize, 1, out) == 1 && (size == 0 || fwrite(data, size, 1, out) == 1);
+        ok = fclose(out) == 0 && ok;
+#if defined(_WIN32)
+        remove(path);
+#endif
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok)
+            remove(temporary);
+    }
+    czalloc_free(temporary);
+    return ok;
+}
+
+static czsurface * czcache_internal_get(czcache * cache, unsigned long long key, unsigned variant) {
+    char * name = czcache_internal_name(cache, key, ".czc");
+    czcache_content * content = NULL;
+    czsurface * surface = NULL;
+    size_t size = 0;
+    if (name == NULL)
+        return NULL;
+    content = czcache_internal_read(name, &size);
+    if (content != NULL && size >= sizeof(czcache_content) && memcmp(content->magic, czcache_content_magic, sizeof(content->magic)) == 0
+            && content->version == CZCACHE_VERSION && content->variant == variant
+            && content->packed == size - sizeof(czcache_content)
+            && content->type <= CZSURFACE_FLOAT32 && content->channels >= 1 && content->channels <= 4)
+        surface = czsurface_create(content->width, content->height, content->channels, (czsurface_type) content->type);
+    if (surface != NULL && (content->size != (unsigned long long) content->width * content->height * czsurface_bpp(surface)
+            || !czlz4_decompress(content + 1, (size_t) content->packed, czsurface_pixels(surface), (size_t) content->size))) {
+        czsurface_destroy(surface);
+        surface = NULL;
+    }
+    if (surface != NULL)
+        czcache_internal_touch(name);
+    czalloc_free(content);
+    czalloc_free(name);
+    return surface;
+}
+
+static void czcache_internal_put(czcache * cache, unsigned long long key, unsigned variant, czsurface * surface) {
+    czcache_content content;
+    czsize size = czsurface_size(surface);
+    void * packed = NULL;
+    char * name = NULL;
+    memset(&content, 0, sizeof(content));
+    memcpy(content.magic, czcache_content_magic, sizeof(content.magic));
+    content.version = CZCACHE_VERSION;
+    content.variant = variant;
+    content.width = (unsigned) size.w;
+    content.height = (unsigned) size.h;
+    content.channels = czsurface_channels(surface);
+    content.type = (unsigned) czsurface_pixel_type(surface);
+    content.size = (unsigned long long) content.width * content.height * czsurface_bpp(surface);
+    packed = czalloc_malloc(czlz4_bound((size_t) content.size));
+    name = czcache_internal_name(cache, key, ".czc");
+    if (packed != NULL && name != NULL) {
+        content.packed = czlz4_compress(czsurface_pixels(surface), (size_t) content.size, packed);
+        if (content.packed > 0)
+            czcache_internal_write(cache, name, &content, sizeof(content), packed, (size_t) content.packed);
+    }
+    czalloc_free(name);
+    czalloc_free(packed);
+}
+
+/* least recently used first */
+static int czcache_internal_compare_files(const void * a, const void * b) {
+    long long x = ((const czcache_file *) a)->mtime, y = ((const czcache_file *) b)->mtime;
+    return x < y ? -1 : x > y;
+}
+
+/* the entries in the cache directory */
+static czcache_file * czcache_internal_list(czcache * cache, unsigned * count) {
+    czcache_file * files = NULL, * grown = NULL;
+    unsigned capacity = 0;
+    const char * name = NULL;
+    size_t length = 0;
+    struct stat info;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA found;
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    char * pattern = czalloc_malloc(strlen(cache->dir) + 3);
+    if (pattern == NULL)
+        return NULL;
+    sprintf(pattern, "%s/*", cache->dir);
+    dir = FindFirstFileA(pattern, &found);
+    czalloc_free(pattern);
+    if (dir == INVALID_HANDLE_VALUE)
+        return NULL;
+    do {
+        name = found.cFileName;
+#else
+    struct dirent * found = NULL;
+    DIR * dir = opendir(cache->dir);
+    if (dir == NULL)
+        return NULL;
+    while ((found = readdir(dir)) != NULL) {
+        name = found->d_name;
+#endif
+        length = strlen(name);
+        if (length < 4 || (strcmp(name + length - 4, ".czc") != 0 && strcmp(name + length - 4, ".czp") != 0))
+            continue;
+        if (*count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            grown = czalloc_realloc(files, capacity * sizeof(czcache_file));
+            if (grown == NULL)
+                break;
+            files = grown;
+        }
+        files[*count].name = czalloc_malloc(strlen(cache->dir) + length + 2);
+        if (files[*count].name == NULL)
+            break;
+        sprintf(files[*count].name, "%s/%s", cache->dir, name);
+        if (stat(files[*count].name, &info) != 0) {
+            czalloc_free(files[*count].name);
+            continue;
+        }
+        files[*count].size = (unsigned long long) info.st_size;
+        files[*count].mtime = (long long) info.st_mtime;
+        (*count)++;
+#if defined(_WIN32)
+    } while (FindNextFileA(dir, &found));
+    FindClose(dir);
+#else
+    }
+    closedir(dir);
+#endif
+    return files;
+}
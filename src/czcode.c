@@ -0,0 +1,380 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czcode.h"
+#include "czalloc.h"
+#include "czindex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+ * Generates C code describing an atlas. Headers get an enum of sprites, in
+ * name order, their rects and UVs as constant arrays and a minimal perfect
+ * hash from names to sprites, built by hash and displace: names are put in
+ * buckets by one hash, then the largest buckets look for a seed of a second
+ * hash sending all their names to free slots, and the names left alone in
+ * their buckets take the remaining slots directly.
+ *
+ * Sources define a chizu_embedded (see chizu.h) with the texture, aligned
+ * for direct upload, and the subimages in the order of the header's enum.
+ */
+
+#define CZCODE_MAX_SEED (1u << 24)
+#define CZCODE_ALIGN 64
+#define CZCODE_LINE_BYTES 24
+
+/* data type declarations */
+
+typedef struct czcode_bucket {
+    unsigned first, count; /* in czcode_hashdata::order */
+} czcode_bucket;
+
+typedef struct czcode_hashdata {
+    int * displace;      /* per bucket: a seed, or -(slot + 1) for a single name */
+    unsigned * slots;    /* per slot: the sprite, or count when free */
+    unsigned * order;    /* sprites by bucket */
+    czcode_bucket * buckets;
+} czcode_hashdata;
+
+/* internal forward declarations */
+
+static int czcode_internal_compare_entries(const void * a, const void * b);
+static unsigned czcode_internal_hash(unsigned seed, const char * name);
+static int czcode_internal_perfect_hash(czspec_entry * entries, unsigned count, czcode_hashdata * hash);
+static void czcode_internal_identifier(char * out, const char * prefix, const char * name, int upper);
+static void czcode_internal_name(FILE * out, const char * name);
+
+/*
+ * Writes a C/C++ header for entries, which must have distinct names (and
+ * are sorted by name here). With no entries, the arrays hold one
+ * placeholder (C has no empty arrays) and find always misses.
+ * Returns 0 on failure.
+ */
+int czcode_write_header(FILE * out, const char * prefix, czspec_entry * entries, unsigned count, unsigned width, unsigned height) {
+    czcode_hashdata hash;
+    czindex * used = NULL;
+    char * lower = NULL, * upper = NULL, * id = NULL;
+    size_t longest = 0;
+    unsigned i = 0;
+    unsigned size = count > 0 ? count : 1;
+    int ok = width > 0 && height > 0;
+
+    memset(&hash, 0, sizeof(hash));
+    for (i = 0; i < count; i++)
+        if (strlen(entries[i].name) > longest)
+            longest = strlen(entries[i].name);
+    longest += strlen(prefix) + 16;
+    if (ok) {
+        if (count > 0)
+            qsort(entries, count, sizeof(czspec_entry), czcode_internal_compare_entries);
+        lower = czalloc_malloc(longest);
+        upper = czalloc_malloc(longest);
+        id = czalloc_malloc(longest);
+        used = czindex_create();
+        ok = lower != NULL && upper != NULL && id != NULL && used != NULL
+            && (count == 0 || czcode_internal_perfect_hash(entries, count, &hash));
+    }
+
+    if (ok) {
+        czcode_internal_identifier(lower, prefix, "", 0);
+        czcode_internal_identifier(upper, prefix, "", 1);
+        fprintf(out, "/* generated by chizu, do not edit */\n\n");
+        fprintf(out, "#ifndef %sATLAS_H\n#define %sATLAS_H\n\n", upper, upper);
+        fprintf(out, "#if defined(__cplusplus) && __cplusplus >= 201103L\n");
+        fprintf(out, "#   define %sDATA constexpr const\n#else\n#   define %sDATA static const\n#endif\n\n", upper, upper);
+        fprintf(out, "#define %sWIDTH %u\n#define %sHEIGHT %u\n\n", upper, width, upper, height);
+
+        fprintf(out, "typedef enum %ssprite {\n", lower);
+        for (i = 0; i < count; i++) {
+            czcode_internal_identifier(id, prefix, entries[i].name, 1);
+            if (czindex_get(used, id) != CZINDEX_MISSING)
+                sprintf(id + strlen(id), "_%u", i);
+            czindex_put(used, id, i);
+            fprintf(out, "    %s = %u, /* ", id, i);
+            czcode_internal_name(out, entries[i].name);
+            fprintf(out, " */\n");
+        }
+        fprintf(out, "    %sSPRITE_COUNT = %u\n} %ssprite;\n\n", upper, count, lower);
+
+        fprintf(out, "typedef struct %srect {\n", lower);
+        fprintf(out, "    unsigned x, y, w, h;\n    unsigned channel;\n    float u0, v0, u1, v1;\n} %srect;\n\n", lower);
+        fprintf(out, "%sDATA %srect %srects[%u] = {\n", upper, lower, lower, size);
+        if (count == 0)
+            fprintf(out, "    { 0, 0, 0, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f }\n");
+        for (i = 0; i < count; i++)
+            fprintf(out, "    { %u, %u, %u, %u, %u, %#.9gf, %#.9gf, %#.9gf, %#.9gf }%s\n",
+                entries[i].x, entries[i].y, entries[i].w, entries[i].h, entries[i].channel,
+                (double) entries[i].x / width, (double) entries[i].y / height,
+                (double) (entries[i].x + entries[i].w) / width, (double) (entries[i].y + entries[i].h) / height,
+                i + 1 < count ? "," : "");
+        fprintf(out, "};\n\n");
+
+        fprintf(out, "%sDATA char * const %snames[%u] = {\n", upper, lower, size);
+        if (count == 0)
+            fprintf(out, "    \"\"\n");
+        for (i = 0; i < count; i++) {
+            fprintf(out, "    \"");
+            czcode_internal_name(out, entries[i].name);
+            fprintf(out, "\"%s\n", i + 1 < count ? "," : "");
+        }
+        fprintf(out, "};\n\n");
+
+    }
+
+    if (ok && count == 0) {
+        fprintf(out, "/* the sprite named name, or -1 */\n");
+        fprintf(out, "static inline int %sfind(const char * name) {\n", lower);
+        fprintf(out, "    (void) name;\n    return -1;\n}\n\n");
+    } else if (ok) {
+        fprintf(out, "%sDATA int %sdisplace[%u] = {", upper, lower, count);
+        for (i = 0; i < count; i++)
+            fprintf(out, "%s%d%s", i % 16 == 0 ? "\n    " : " ", hash.displace[i], i + 1 < count ? "," : "\n");
+        fprintf(out, "};\n\n");
+        fprintf(out, "%sDATA unsigned %sslots[%u] = {", upper, lower, count);
+        for (i = 0; i < count; i++)
+            fprintf(out, "%s%u%s", i % 16 == 0 ? "\n    " : " ", hash.slots[i], i + 1 < count ? "," : "\n");
+        fprintf(out, "};\n\n");
+
+        fprintf(out, "static inline unsigned %shash(unsigned seed, const char * name) {\n", lower);
+        fprintf(out, "    unsigned h = seed != 0 ? seed : 2166136261u;\n");
+        fprintf(out, "    while (*name != 0)\n        h = (h ^ (unsigned char) *name++) * 16777619u;\n");
+        fprintf(out, "    return h;\n}\n\n");
+        fprintf(out, "/* the sprite named name, or -1 */\n");
+        fprintf(out, "static inline int %sfind(const char * name) {\n", lower);
+        fprintf(out, "    int d = %sdisplace[%shash(0, name) %% %uu];\n", lower, lower, count);
+        fprintf(out, "    unsigned i = %sslots[d < 0 ? (unsigned) (-d - 1) : %shash((unsigned) d, name) %% %uu];\n", lower, lower, count);
+        fprintf(out, "    const char * a = name, * b = %snames[i];\n", lower);
+        fprintf(out, "    while (*a != 0 && *a == *b)\n        a++, b++;\n");
+        fprintf(out, "    return *a == *b ? (int) i : -1;\n}\n\n");
+    }
+    if (ok) {
+        fprintf(out, "#endif\n");
+        ok = !ferror(out);
+    }
+
+    czindex_destroy(used);
+    czalloc_free(id);
+    czalloc_free(upper);
+    czalloc_free(lower);
+    czalloc_free(hash.displace);
+    czalloc_free(hash.slots);
+    return ok;
+}
+
+
+/*
+ * Writes a C source defining prefix_embedded. Entries are sorted by name as
+ * in czcode_write_header, so the header's enum indexes the subimages too.
+ * Returns 0 on failure.
+ */
+int czcode_write_source(FILE * out, const char * prefix, czspec_entry * entries, unsigned count, unsigned width, unsigned height,
+        const char * format, const char * compression, const void * data, size_t size) {
+    const unsigned char * bytes = (const unsigned char *) data;
+    char * lower = czalloc_malloc(strlen(prefix) + 3);
+    char * upper = czalloc_malloc(strlen(prefix) + 3);
+    char line[CZCODE_LINE_BYTES * 5 + 8];
+    size_t i = 0, k = 0;
+    int length = 0;
+    if (lower == NULL || upper == NULL) {
+        czalloc_free(lower);
+        czalloc_free(upper);
+        return 0;
+    }
+    if (count > 0)
+        qsort(entries, count, sizeof(czspec_entry), czcode_internal_compare_entries);
+    czcode_internal_identifier(lower, prefix, "", 0);
+    czcode_internal_identifier(upper, prefix, "", 1);
+
+    fprintf(out, "/* generated by chizu, do not edit */\n\n");
+    fprintf(out, "#include \"chizu.h\"\n\n");
+    fprintf(out, "#if defined(_MSC_VER)\n#   define %sALIGNED __declspec(align(%d))\n", upper, CZCODE_ALIGN);
+    fprintf(out, "#else\n#   define %sALIGNED __attribute__((aligned(%d)))\n#endif\n\n", upper, CZCODE_ALIGN);
+
+    /* one line at a time, textures are large */
+    fprintf(out, "%sALIGNED static const unsigned char %sdata[%lu] = {\n", upper, lower, (unsigned long) (size > 0 ? size : 1));
+    for (i = 0; i < size; i += CZCODE_LINE_BYTES) {
+        length = sprintf(line, "   ");
+        for (k = i; k < size && k < i + CZCODE_LINE_BYTES; k++)
+            length += sprintf(line + length, " %u%s", bytes[k], k + 1 < size ? "," : "");
+        line[length++] = '\n';
+        fwrite(line, 1, (size_t) length, out);
+    }
+    fprintf(out, "%s};\n\n", size > 0 ? "" : "    0\n");
+
+    fprintf(out, "static const chizu_sprite %slayout[%u] = {\n", lower, count > 0 ? count : 1);
+    for (i = 0; i < count; i++) {
+        fprintf(out, "    { \"");
+        czcode_internal_name(out, entries[i].name);
+        fprintf(out, "\", %u, %u, %u, %u, %u }%s\n", entries[i].x, entries[i].y, entries[i].w, entries[i].h,
+            entries[i].channel, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "%s};\n\n", count > 0 ? "" : "    { 0, 0, 0, 0, 0, 0 }\n");
+
+    fprintf(out, "const chizu_embedded %sembedded = {\n", lower);
+    fprintf(out, "    %u, %u, %s, %s,\n", width, height, format, compression);
+    fprintf(out, "    %sdata, %lu,\n    %u, %slayout\n};\n", lower, (unsigned long) size, count, lower);
+
+    czalloc_free(upper);
+    czalloc_free(lower);
+    return !ferror(out);
+}
+
+
+/* internal functions */
+
+static int czcode_internal_compare_entries(const void * a, const void * b) {
+    return strcmp(((const czspec_entry *) a)->name, ((const czspec_entry *) b)->name);
+}
+
+/* 32 bit FNV-1a, starting from seed when not 0. The generated code has the same */
+static unsigned czcode_internal_hash(unsigned seed, const char * name) {
+    unsigned h = seed != 0 ? seed : 2166136261u;
+    const unsigned char * p = (const unsigned char *) name;
+    while (*p != 0)
+        h = (h ^ *p++) * 16777619u;
+    return h;
+}
+
+/* fills hash->displace and hash->slots, returns 0 on failure */
+static int czcode_internal_perfect_hash(czspec_entry * entries, unsigned count, czcode_hashdata * hash) {
+    unsigned * byorder = NULL, * tried = NULL, * bucketof = NULL;
+    unsigned i = 0, j = 0, b = 0, seed = 0, freeslot = 0, largest = 0, used = 0;
+    int ok = 1;
+
+    hash->displace = czalloc_calloc(count, sizeof(int));
+    hash->slots = czalloc_malloc(count * sizeof(unsigned));
+    hash->order = czalloc_malloc(count * sizeof(unsigned));
+    hash->buckets = czalloc_calloc(count, sizeof(czcode_bucket));
+    byorder = czalloc_malloc(count * sizeof(unsigned));
+    tried = czalloc_malloc(count * sizeof(unsigned));
+    bucketof = czalloc_malloc(count * sizeof(unsigned));
+    ok = hash->displace != NULL && hash->slots != NULL && hash->order != NULL && hash->buckets != NULL
+        && byorder != NULL && tried != NULL && bucketof != NULL;
+
+    if (ok) {
+        /* counting sort of the sprites by bucket */
+        for (i = 0; i < count; i++) {
+            bucketof[i] = czcode_internal_hash(0, entries[i].name) % count;
+            hash->buckets[bucketof[i]].count++;
+        }
+        for (b = 0, j = 0; b < count; b++) {
+            hash->buckets[b].first = j;
+            j += hash->buckets[b].count;
+            hash->buckets[b].count = 0;
+            hash->slots[b] = count;
+        }
+        for (i = 0; i < count; i++) {
+            czcode_bucket * bucket = &hash->buckets[bucketof[i]];
+            hash->order[bucket->first + bucket->count++] = i;
+            if (bucket->count > largest)
+                largest = bucket->count;
+        }
+        /* largest buckets first, they are the hardest to place; buckets are small */
+        for (j = largest; j > 0; j--)
+            for (b = 0; b < count; b++)
+                if (hash->buckets[b].count == j)
+                    byorder[used++] = b;
+    }
+
+    for (i = 0; ok && i < used && hash->buckets[byorder[i]].count > 1; i++) {
+        czcode_bucket * bucket = &hash->buckets[byorder[i]];
+        for (seed = 1; seed < CZCODE_MAX_SEED; seed++) {
+            for (j = 0; j < bucket->count; j++) {
+                unsigned slot = czcode_internal_hash(seed, entries[hash->order[bucket->first + j]].name) % count;
+                unsigned k = 0;
+                if (hash->slots[slot] != count)
+                    break;
+                for (k = 0; k < j && tried[k] != slot; k++);
+                if (k < j)
+                    break;
+                tried[j] = slot;
+            }
+            if (j == bucket->count)
+                break;
+        }
+        if (seed == CZCODE_MAX_SEED) {
+            ok = 0;
+            break;
+        }
+        hash->displace[byorder[i]] = (int) seed;
+        for (j = 0; j < bucket->count; j++)
+            hash->slots[tried[j]] = hash->order[bucket->first + j];
+    }
+
+    /* single names take any free slot */
+    for (; ok && i < used; i++) {
+        while (hash->slots[freeslot] != count)
+            freeslot++;
+        hash->slots[freeslot] = hash->order[hash->buckets[byorder[i]].first];
+        hash->displace[byorder[i]] = -(int) freeslot - 1;
+    }
+
+    czalloc_free(bucketof);
+    czalloc_free(tried);
+    czalloc_free(byorder);
+    czalloc_free(hash->order);
+    czalloc_free(hash->buckets);
+    hash->order = NULL;
+    hash->buckets = NULL;
+    return ok;
+}
+
+/* prefix and name as a C identifier, in lower or upper case and ending in _ if name is empty */
+static void czcode_internal_identifier(char * out, const char * prefix, const char * name, int upper) {
+    const char * parts[2];
+    unsigned p = 0;
+    parts[0] = prefix;
+    parts[1] = name;
+    if (!isalpha((unsigned char) prefix[0]) && prefix[0] != '_')
+        *out++ = '_';
+    for (p = 0; p < 2; p++) {
+        const unsigned char * c = (const unsigned char *) parts[p];
+        for (; *c != 0; c++) {
+            if (!isalnum(*c))
+                *out++ = '_';
+            else
+                *out++ = (char) (upper ? toupper(*c) : tolower(*c));
+        }
+        if (p == 0)
+            *out++ = '_';
+    }
+    *out = 0;
+}
+
+/* writes name escaped for a C string literal or comment */
+static void czcode_internal_name(FILE * out, const char * name) {
+    const unsigned char * c = (const unsigned char *) name;
+    for (; *c != 0; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if (*c == '/' && c != (const unsigned char *) name && c[-1] == '*')
+            fprintf(out, "\\057");
+        else if (*c < 32 || *c > 126 || *c == '?')
+            fprintf(out, "\\%03o", *c);
+        else
+            fputc(*c, out);
+    }
+}
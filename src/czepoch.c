@@ -0,0 +1,138 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czepoch.h"
+#include "czthread.h"
+#include "czalloc.h"
+
+/*
+ * Epoch based reclamation. Readers announce the epoch they saw before
+ * loading a shared pointer and clear it when done; both are single atomic
+ * stores, so readers never wait. Writers (serialized by their caller)
+ * replace the pointer, retire the old one tagged with the current epoch and
+ * advance it. A retired pointer is freed once every reader announced a
+ * later epoch or is idle, as none of them can still be looking at it.
+ */
+
+/* data type declarations */
+
+typedef struct czepoch_retired {
+    void * ptr;
+    long epoch;
+} czepoch_retired;
+
+struct czepoch {
+    volatile long current;
+    volatile long slots[CZEPOCH_MAX_READERS]; /* 0 idle, else announced epoch + 1 */
+    volatile long used[CZEPOCH_MAX_READERS];
+    czepoch_retired * retired;
+    unsigned count, capacity;
+};
+
+/* internal forward declarations */
+
+static void czepoch_internal_reclaim(czepoch * epoch);
+
+czepoch * czepoch_create() {
+    return czalloc_calloc(1, sizeof(czepoch));
+}
+
+/* frees everything still retired, no reader may be active anymore */
+void czepoch_destroy(czepoch * epoch) {
+    unsigned i = 0;
+    if (epoch == NULL)
+        return;
+    for (i = 0; i < epoch->count; i++)
+        czalloc_free(epoch->retired[i].ptr);
+    czalloc_free(epoch->retired);
+    czalloc_free(epoch);
+}
+
+/* a reader slot for the calling thread, or -1 if all are taken */
+int czepoch_register(czepoch * epoch) {
+    int i = 0;
+    for (i = 0; i < CZEPOCH_MAX_READERS; i++)
+        if (czthread_atomic_cas(&epoch->used[i], 0, 1))
+            return i;
+    return -1;
+}
+
+void czepoch_unregister(czepoch * epoch, int reader) {
+    czthread_atomic_store(&epoch->slots[reader], 0);
+    czthread_atomic_store(&epoch->used[reader], 0);
+}
+
+void czepoch_enter(czepoch * epoch, int reader) {
+    czthread_atomic_store(&epoch->slots[reader], czthread_atomic_load(&epoch->current) + 1);
+}
+
+void czepoch_exit(czepoch * epoch, int reader) {
+    czthread_atomic_store(&epoch->slots[reader], 0);
+}
+
+/*
+ * Frees ptr once no reader can see it. It must have been unpublished
+ * already. Returns 0 if out of memory, in which case ptr is leaked rather
+ * than freed too early.
+ */
+int czepoch_retire(czepoch * epoch, void * ptr) {
+    czepoch_retired * grown = NULL;
+    if (ptr == NULL)
+        return 1;
+    if (epoch->count == epoch->capacity) {
+        unsigned capacity = epoch->capacity > 0 ? epoch->capacity * 2 : 16;
+        grown = czalloc_realloc(epoch->retired, capacity * sizeof(czepoch_retired));
+        if (grown == NULL)
+            return 0;
+        epoch->retired = grown;
+        epoch->capacity = capacity;
+    }
+    epoch->retired[epoch->count].ptr = ptr;
+    epoch->retired[epoch->count].epoch = epoch->current;
+    epoch->count++;
+    czthread_atomic_store(&epoch->current, epoch->current + 1);
+    czepoch_internal_reclaim(epoch);
+    return 1;
+}
+
+
+/* internal functions */
+
+static void czepoch_internal_reclaim(czepoch * epoch) {
+    long oldest = epoch->current;
+    unsigned i = 0, kept = 0;
+    for (i = 0; i < CZEPOCH_MAX_READERS; i++) {
+        long slot = czthread_atomic_load(&epoch->slots[i]);
+        if (slot != 0 && slot - 1 < oldest)
+            oldest = slot - 1;
+    }
+    for (i = 0; i < epoch->count; i++) {
+        if (epoch->retired[i].epoch < oldest)
+            czalloc_free(epoch->retired[i].ptr);
+        else
+            epoch->retired[kept++] = epoch->retired[i];
+    }
+    epoch->count = kept;
+}
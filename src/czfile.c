@@ -0,0 +1,238 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czfile.h"
+#include "czalloc.h"
+#include <string.h>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+/*
+ * Read only files mapped copy on write: pages are read from the file on
+ * first access, and writing to them makes private copies, leaving the
+ * file untouched. Named shared memory is mapped the same way, writable by
+ * the process that created it and read only by the others.
+ */
+
+/* data type declarations */
+
+struct czfile {
+    void * data;
+    size_t size;
+    char * shared; /* name to remove on unmap, for the creator of shared memory */
+#if defined(_WIN32)
+    HANDLE file, mapping;
+#endif
+};
+
+/* internal forward declarations */
+
+static char * czfile_internal_strdup(const char * s);
+
+czfile * czfile_map(const char * path) {
+    czfile * file = czalloc_calloc(1, sizeof(czfile));
+#if defined(_WIN32)
+    LARGE_INTEGER size;
+    if (file == NULL)
+        return NULL;
+    file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        czalloc_free(file);
+        return NULL;
+    }
+    if (GetFileSizeEx(file->file, &size) && size.QuadPart > 0) {
+        file->size = (size_t) size.QuadPart;
+        file->mapping = CreateFileMappingA(file->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (file->mapping != NULL)
+            file->data = MapViewOfFile(file->mapping, FILE_MAP_COPY, 0, 0, 0);
+    }
+    if (file->data == NULL) {
+        if (file->mapping != NULL)
+            CloseHandle(file->mapping);
+        CloseHandle(file->file);
+        czalloc_free(file);
+        return NULL;
+    }
+#else
+    struct stat info;
+    int fd = -1;
+    if (file == NULL)
+        return NULL;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        czalloc_free(file);
+        return NULL;
+    }
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        file->size = (size_t) info.st_size;
+        file->data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (file->data == MAP_FAILED)
+            file->data = NULL;
+    }
+    /* the mapping outlives the descriptor */
+    close(fd);
+    if (file->data == NULL) {
+        czalloc_free(file);
+        return NULL;
+    }
+#endif
+    return file;
+}
+
+/*
+ * A new zero filled shared memory segment, replacing any other of the same
+ * name (processes still attached to that one keep it). It stays until the
+ * creator unmaps it.
+ */
+czfile * czfile_create_shared(const char * name, size_t size) {
+    czfile * file = czalloc_calloc(1, sizeof(czfile));
+#if defined(_WIN32)
+    ULARGE_INTEGER large;
+    if (file == NULL)
+        return NULL;
+    large.QuadPart = size;
+    file->file = INVALID_HANDLE_VALUE;
+    file->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, large.HighPart, large.LowPart, name);
+    if (file->mapping != NULL)
+        file->data = MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (file->data == NULL) {
+        if (file->mapping != NULL)
+            CloseHandle(file->mapping);
+        czalloc_free(file);
+        return NULL;
+    }
+#else
+    int fd = -1;
+    if (file == NULL)
+        return NULL;
+    file->shared = czfile_internal_strdup(name);
+    shm_unlink(name);
+    fd = file->shared != NULL ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+    if (fd >= 0 && ftruncate(fd, (off_t) size) == 0) {
+        file->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (file->data == MAP_FAILED)
+            file->data = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (file->data == NULL) {
+        if (fd >= 0)
+            shm_unlink(name);
+        czalloc_free(file->shared);
+        czalloc_free(file);
+        return NULL;
+    }
+#endif
+    file->size = size;
+    return file;
+}
+
+/* maps an existing shared memory segment, read only */
+czfile * czfile_open_shared(const char * name) {
+    czfile * file = czalloc_calloc(1, sizeof(czfile));
+#if defined(_WIN32)
+    MEMORY_BASIC_INFORMATION info;
+    if (file == NULL)
+        return NULL;
+    file->file = INVALID_HANDLE_VALUE;
+    file->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (file->mapping != NULL)
+        file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (file->data == NULL || VirtualQuery(file->data, &info, sizeof(info)) == 0) {
+        if (file->data != NULL)
+            UnmapViewOfFile(file->data);
+        if (file->mapping != NULL)
+            CloseHandle(file->mapping);
+        czalloc_free(file);
+        return NULL;
+    }
+    file->size = info.RegionSize;
+#else
+    struct stat info;
+    int fd = -1;
+    if (file == NULL)
+        return NULL;
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        czalloc_free(file);
+        return NULL;
+    }
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        file->size = (size_t) info.st_size;
+        file->data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (file->data == MAP_FAILED)
+            file->data = NULL;
+    }
+    close(fd);
+    if (file->data == NULL) {
+        czalloc_free(file);
+        return NULL;
+    }
+#endif
+    return file;
+}
+
+void czfile_unmap(czfile * file) {
+    if (file == NULL)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    if (file->file != INVALID_HANDLE_VALUE)
+        CloseHandle(file->file);
+#else
+    munmap(file->data, file->size);
+    if (file->shared != NULL)
+        shm_unlink(file->shared);
+#endif
+    czalloc_free(file->shared);
+    czalloc_free(file);
+}
+
+void * czfile_data(czfile * file) {
+    return file->data;
+}
+
+size_t czfile_size(czfile * file) {
+    return file->size;
+}
+
+
+/* internal functions */
+
+static char * czfile_internal_strdup(const char * s) {
+    size_t n = strlen(s);
+    char * p = (char *) czalloc_malloc(n + 1);
+    if (p != NULL)
+        memcpy(p, s, n + 1);
+    return p;
+}
@@ -0,0 +1,184 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czindex.h"
+#include "czalloc.h"
+#include <string.h>
+
+/*
+ * String to unsigned hash map. Open addressing with linear probing, kept at
+ * most half full, and the full hash of each key is stored next to it so
+ * probing rarely compares strings. Keys are copied into an arena of large
+ * blocks rather than allocated one by one.
+ */
+
+#define CZINDEX_MIN_SLOTS 64
+#define CZINDEX_ARENA_BLOCK 4096
+
+/* data type declarations */
+
+typedef struct czindex_slot {
+    const char * key; /* NULL when free */
+    unsigned hash;
+    unsigned value;
+} czindex_slot;
+
+typedef struct czindex_block {
+    struct czindex_block * next;
+    size_t used, size;
+    char bytes[1];
+} czindex_block;
+
+struct czindex {
+    czindex_slot * slots;
+    unsigned capacity, count;
+    czindex_block * arena;
+};
+
+/* internal forward declarations */
+
+static unsigned czindex_internal_hash(const char * key, unsigned * length);
+static czindex_slot * czindex_internal_find(czindex_slot * slots, unsigned capacity, const char * key, unsigned hash);
+static int czindex_internal_grow(czindex * index);
+static const char * czindex_internal_store(czindex * index, const char * key, size_t length);
+
+czindex * czindex_create() {
+    czindex * index = czalloc_calloc(1, sizeof(czindex));
+    if (index == NULL)
+        return NULL;
+    index->slots = czalloc_calloc(CZINDEX_MIN_SLOTS, sizeof(czindex_slot));
+    if (index->slots == NULL) {
+        czalloc_free(index);
+        return NULL;
+    }
+    index->capacity = CZINDEX_MIN_SLOTS;
+    return index;
+}
+
+void czindex_destroy(czindex * index) {
+    czindex_block * block = NULL;
+    if (index == NULL)
+        return;
+    while (index->arena != NULL) {
+        block = index->arena;
+        index->arena = block->next;
+        czalloc_free(block);
+    }
+    czalloc_free(index->slots);
+    czalloc_free(index);
+}
+
+/* maps key to value, replacing what it mapped to before. Returns 0 if out of memory */
+int czindex_put(czindex * index, const char * key, unsigned value) {
+    unsigned length = 0, hash = czindex_internal_hash(key, &length);
+    czindex_slot * slot = czindex_internal_find(index->slots, index->capacity, key, hash);
+    if (slot->key != NULL) {
+        slot->value = value;
+        return 1;
+    }
+    if ((index->count + 1) * 2 > index->capacity) {
+        if (!czindex_internal_grow(index))
+            return 0;
+        slot = czindex_internal_find(index->slots, index->capacity, key, hash);
+    }
+    slot->key = czindex_internal_store(index, key, length + 1);
+    if (slot->key == NULL)
+        return 0;
+    slot->hash = hash;
+    slot->value = value;
+    index->count++;
+    return 1;
+}
+
+/* the value of key, or CZINDEX_MISSING */
+unsigned czindex_get(czindex * index, const char * key) {
+    unsigned hash = czindex_internal_hash(key, NULL);
+    czindex_slot * slot = czindex_internal_find(index->slots, index->capacity, key, hash);
+    return slot->key != NULL ? slot->value : CZINDEX_MISSING;
+}
+
+
+/* internal functions */
+
+/* 32 bit FNV-1a, also giving the length of key if asked */
+static unsigned czindex_internal_hash(const char * key, unsigned * length) {
+    unsigned hash = 2166136261u;
+    const unsigned char * p = (const unsigned char *) key;
+    while (*p != 0) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    if (length != NULL)
+        *length = (unsigned) (p - (const unsigned char *) key);
+    return hash;
+}
+
+/* the slot holding key, or the free slot where it would go */
+static czindex_slot * czindex_internal_find(czindex_slot * slots, unsigned capacity, const char * key, unsigned hash) {
+    unsigned i = hash & (capacity - 1);
+    while (slots[i].key != NULL) {
+        if (slots[i].hash == hash && strcmp(slots[i].key, key) == 0)
+            return &slots[i];
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+static int czindex_internal_grow(czindex * index) {
+    unsigned capacity = index->capacity * 2, i = 0;
+    czindex_slot * slots = czalloc_calloc(capacity, sizeof(czindex_slot));
+    czindex_slot * slot = NULL;
+    if (slots == NULL)
+        return 0;
+    for (i = 0; i < index->capacity; i++) {
+        if (index->slots[i].key == NULL)
+            continue;
+        slot = czindex_internal_find(slots, capacity, index->slots[i].key, index->slots[i].hash);
+        *slot = index->slots[i];
+    }
+    czalloc_free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return 1;
+}
+
+static const char * czindex_internal_store(czindex * index, const char * key, size_t length) {
+    czindex_block * block = index->arena;
+    char * copy = NULL;
+    if (block == NULL || block->size - block->used < length) {
+        size_t size = length > CZINDEX_ARENA_BLOCK ? length : CZINDEX_ARENA_BLOCK;
+        block = czalloc_malloc(sizeof(czindex_block) + size);
+        if (block == NULL)
+            return NULL;
+        block->next = index->arena;
+        block->used = 0;
+        block->size = size;
+        index->arena = block;
+    }
+    copy = block->bytes + block->used;
+    memcpy(copy, key, length);
+    block->used += length;
+    return copy;
+}
@@ -0,0 +1,173 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czlz4.h"
+#include "czalloc.h"
+#include <string.h>
+
+/*
+ * LZ4 blocks (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+ * so other tools can read what is written here. Compression is greedy, with
+ * a single hash table of recent positions; decompression checks every
+ * length and offset against both buffers.
+ */
+
+#define CZLZ4_HASH_BITS 16
+#define CZLZ4_MIN_MATCH 4
+#define CZLZ4_LAST_LITERALS 5   /* the last bytes are always literals */
+#define CZLZ4_MATCH_LIMIT 12    /* and the last match starts before them */
+#define CZLZ4_MAX_OFFSET 65535
+
+/* internal forward declarations */
+
+static unsigned czlz4_internal_read32(const unsigned char * p);
+static unsigned char * czlz4_internal_length(unsigned char * out, size_t length);
+static unsigned char * czlz4_internal_sequence(unsigned char * out, const unsigned char * literals, size_t count, size_t offset, size_t match);
+
+/* the most bytes czlz4_compress can write for size bytes */
+size_t czlz4_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+/* compresses size bytes into dst, which holds czlz4_bound(size). Returns the compressed size, 0 on failure */
+size_t czlz4_compress(const void * src, size_t size, void * dst) {
+    const unsigned char * in = (const unsigned char *) src;
+    unsigned char * out = (unsigned char *) dst;
+    size_t * table = NULL;
+    size_t i = 0, anchor = 0;
+
+    if (size >= CZLZ4_MATCH_LIMIT + 1) {
+        table = czalloc_calloc((size_t) 1 << CZLZ4_HASH_BITS, sizeof(size_t));
+        if (table == NULL)
+            return 0;
+    }
+
+    /* table holds position + 1 of the last 4 bytes with each hash */
+    while (table != NULL && i + CZLZ4_MATCH_LIMIT <= size) {
+        unsigned value = czlz4_internal_read32(in + i);
+        unsigned hash = (value * 2654435761u) >> (32 - CZLZ4_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = i + 1;
+        if (candidate != 0 && i - (candidate - 1) <= CZLZ4_MAX_OFFSET
+                && czlz4_internal_read32(in + candidate - 1) == value) {
+            size_t length = CZLZ4_MIN_MATCH;
+            candidate--;
+            while (i + length < size - CZLZ4_LAST_LITERALS && in[candidate + length] == in[i + length])
+                length++;
+            out = czlz4_internal_sequence(out, in + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        } else {
+            /* skip faster over data that does not compress */
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+
+    out = czlz4_internal_sequence(out, in + anchor, size - anchor, 0, 0);
+    czalloc_free(table);
+    return (size_t) (out - (unsigned char *) dst);
+}
+
+/* decompresses a block into exactly dstsize bytes. Returns 0 if src is not such a block */
+int czlz4_decompress(const void * src, size_t size, void * dst, size_t dstsize) {
+    const unsigned char * in = (const unsigned char *) src;
+    unsigned char * out = (unsigned char *) dst;
+    size_t i = 0, o = 0;
+    while (i < size) {
+        unsigned token = in[i++];
+        size_t count = token >> 4, offset = 0, from = 0, k = 0;
+        unsigned char b = 255;
+        if (count == 15)
+            while (b == 255 && i < size)
+                count += (b = in[i++]);
+        if (b == 255 && count >= 15 + 255)
+            return 0;
+        if (count > size - i || count > dstsize - o)
+            return 0;
+        memcpy(out + o, in + i, count);
+        i += count;
+        o += count;
+        if (i == size)
+            break;
+
+        if (size - i < 2)
+            return 0;
+        offset = in[i] | (size_t) in[i + 1] << 8;
+        i += 2;
+        count = token & 15;
+        b = 255;
+        if (count == 15)
+            while (b == 255 && i < size)
+                count += (b = in[i++]);
+        if (b == 255 && count >= 15 + 255)
+            return 0;
+        count += CZLZ4_MIN_MATCH;
+        if (offset == 0 || offset > o || count > dstsize - o)
+            return 0;
+        /* an overlapping match repeats the offset bytes before it: copy what is already repeated, doubling */
+        from = o - offset;
+        while (count > 0) {
+            k = o - from < count ? o - from : count;
+            memcpy(out + o, out + from, k);
+            o += k;
+            count -= k;
+        }
+    }
+    return o == dstsize;
+}
+
+
+/* internal functions */
+
+static unsigned czlz4_internal_read32(const unsigned char * p) {
+    return p[0] | (unsigned) p[1] << 8 | (unsigned) p[2] << 16 | (unsigned) p[3] << 24;
+}
+
+/* the bytes of a length past its 15 in the token */
+static unsigned char * czlz4_internal_length(unsigned char * out, size_t length) {
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = (unsigned char) length;
+    return out;
+}
+
+/* writes count literals followed by a match, or by nothing if match is 0 */
+static unsigned char * czlz4_internal_sequence(unsigned char * out, const unsigned char * literals, size_t count, size_t offset, size_t match) {
+    unsigned char * token = out++;
+    *token = (unsigned char) ((count >= 15 ? 15 : count) << 4);
+    if (count >= 15)
+        out = czlz4_internal_length(out, count - 15);
+    memcpy(out, literals, count);
+    out += count;
+    if (match == 0)
+        return out;
+    *out++ = (unsigned char) offset;
+    *out++ = (unsigned char) (offset >> 8);
+    match -= CZLZ4_MIN_MATCH;
+    *token |= (unsigned char) (match >= 15 ? 15 : match);
+    if (match >= 15)
+        out = czlz4_internal_length(out, match - 15);
+    return out;
+}
@@ -23,12 +23,26 @@ THE SOFTWARE.
 */
 
 #include "czmap.h"
+#include "czalloc.h"
 #include <stdlib.h>
 /* internal forward declarations */
-static void czmap_internal_split(czmap * node, unsigned width, unsigned height);
-static czmap * czmap_internal_find_space(czmap * node, unsigned width, unsigned height);
+static int czmap_internal_split(czmap * node, unsigned width, unsigned height);
+static czmap * czmap_internal_find_space(czmap * node, unsigned width, unsigned height, unsigned align);
+static czmap * czmap_internal_find_leaf(czmap * node, unsigned width, unsigned height, unsigned align);
+static czmap * czmap_internal_align(czmap * node, unsigned align);
 static czmap * czmap_internal_alloc(unsigned x, unsigned y, unsigned w, unsigned h);
 static void czmap_internal_free(czmap * map);
+static czmap_record * czmap_internal_flatten(czmap * node, czmap_record * record, czmap_data_index_func func, void * priv);
+static czmap * czmap_internal_unflatten(const czmap_record ** record, const czmap_record * end, czrect area, czmap_index_data_func func, void * priv);
+static int czmap_internal_build(czmap * node, czmap_placement * placements, unsigned count);
+static int czmap_internal_find_cut(czrect area, czmap_placement * placements, unsigned count, int * vertical, unsigned * at, unsigned * cut);
+static int czmap_internal_best_gap(czmap_placement * placements, unsigned count, int vertical, unsigned * at, unsigned * cut);
+static int czmap_internal_chain(czmap * node, czmap_placement * placements, unsigned count);
+static int czmap_internal_by_x(const void * a, const void * b);
+static czmap * czmap_internal_rebuild(czmap * map, unsigned width, unsigned height, void * skip);
+static void czmap_internal_count(czrect rect, void * data, void * priv);
+static void czmap_internal_collect(czrect rect, void * data, void * priv);
+static int czmap_internal_by_y(const void * a, const void * b);
 
 /* public stuff */
 struct czmap
@@ -39,8 +53,15 @@ struct czmap
     czrect rect;
 };
 
+typedef struct czmap_collect_data {
+    czmap_placement * placements;
+    unsigned count;
+    void * skip; /* the lease left out, if any */
+} czmap_collect_data;
+
 typedef struct czmap_inserter_data {
     czmap * dst;
+    unsigned maxalign;
     unsigned char nospace;
 } czmap_inserter_data;
 
@@ -60,8 +81,16 @@ void czmap_destroy(czmap * map, czdestroyfunc func)  {
 }
 
 czrect czmap_lease(czmap * map, unsigned width, unsigned height, void * data) {
+    return czmap_lease_aligned(map, width, height, 1, data);
+}
+
+/*
+ * Leases a rect whose position is a multiple of align, a power of two. The
+ * free rect it is cut from loses strips on its left and top, which stay free.
+ */
+czrect czmap_lease_aligned(czmap * map, unsigned width, unsigned height, unsigned align, void * data) {
     czrect r = { 0, 0, 0, 0 };
-    czmap * node = czmap_internal_find_space(map, width, height);
+    czmap * node = czmap_internal_find_space(map, width, height, align);
     if (node == NULL)
         return r;
 
@@ -69,6 +98,16 @@ czrect czmap_lease(czmap * map, unsigned width, unsigned height, void * data) {
     return node->rect;
 }
 
+/* tells if czmap_lease_aligned would succeed and how much of the free rect it would leave unused */
+int czmap_probe(czmap * map, unsigned width, unsigned height, unsigned align, unsigned long * waste) {
+    czmap * node = czmap_internal_find_leaf(map, width, height, align);
+    if (node == NULL)
+        return 0;
+    if (waste != NULL)
+        *waste = (unsigned long) node->rect.w * node->rect.h - (unsigned long) width * height;
+    return 1;
+}
+
 void czmap_foreach(czmap * map, czwalkfunc func, void * priv) {
     if (map->data != NULL)
         func(map->rect, map->data, priv);
@@ -80,16 +119,22 @@ void czmap_foreach(czmap * map, czwalkfunc func, void * priv) {
 
 void czmap_internal_inserter(czrect rect, void * data, void * priv) {
     czmap_inserter_data * idata = (czmap_inserter_data*) priv;
+    unsigned bits = rect.x | rect.y | rect.w | rect.h, align = 1;
     if (idata->nospace) return;
 
-    czrect result = czmap_lease(idata->dst, rect.w, rect.h, data);
+    /* as aligned as the lease was, up to maxalign */
+    while (align < idata->maxalign && (bits & align) == 0)
+        align *= 2;
+    czrect result = czmap_lease_aligned(idata->dst, rect.w, rect.h, align, data);
     if (czrect_is_empty(result))
         idata->nospace = 1;
 }
 
-czmap_copy_status czmap_copy(czmap * src, czmap * dst) {
+/* leases everything of src in dst again, keeping alignments up to maxalign */
+czmap_copy_status czmap_copy(czmap * src, czmap * dst, unsigned maxalign) {
     czmap_inserter_data idata;
     idata.dst = dst;
+    idata.maxalign = maxalign;
     idata.nospace = 0;
 
     /* inserter will find space. idata.nospace will be = 1 if
@@ -100,25 +145,346 @@ czmap_copy_status czmap_copy(czmap * src, czmap * dst) {
     else return CZMAP_COPY_NOSPACE;
 }
 
+unsigned czmap_node_count(czmap * map) {
+    unsigned count = 1;
+    if (map->left != NULL)
+        count += czmap_node_count(map->left);
+    if (map->right != NULL)
+        count += czmap_node_count(map->right);
+    return count;
+}
+
+/*
+ * Writes the tree, free leaves included, to czmap_node_count(map) records
+ * so that czmap_unflatten can rebuild it exactly. func maps each non NULL
+ * data pointer to a non zero index.
+ */
+void czmap_flatten(czmap * map, czmap_record * records, czmap_data_index_func func, void * priv) {
+    czmap_internal_flatten(map, records, func, priv);
+}
+
+/*
+ * Rebuilds a tree from czmap_flatten records, NULL if they do not make one
+ * of width by height: the root starts at the origin and every node has to
+ * stay inside width by height. Leased nodes shrink to their lease while their children
+ * keep the rest of the area they were split from, so children are only
+ * checked against that area, not against their parent's rect.
+ */
+czmap * czmap_unflatten(const czmap_record * records, unsigned count, unsigned width, unsigned height, czmap_index_data_func func, void * priv) {
+    const czmap_record * record = records;
+    czrect area = { 0, 0, 0, 0 };
+    czmap * map = NULL;
+    area.w = width;
+    area.h = height;
+    if (count == 0 || records->x != 0 || records->y != 0)
+        return NULL;
+    map = czmap_internal_unflatten(&record, records + count, area, func, priv);
+    if (map != NULL && record != records + count) {
+        czmap_destroy(map, NULL);
+        return NULL;
+    }
+    return map;
+}
+
+/*
+ * Rebuilds a tree in which every placement is leased where it already is,
+ * for layouts made elsewhere (say, a spec file). Space between placements
+ * stays free wherever guillotine cuts can reach it, which is everywhere in
+ * layouts made by czmap_lease. placements gets reordered. NULL if they
+ * overlap, are empty or do not fit.
+ */
+czmap * czmap_build(unsigned width, unsigned height, czmap_placement * placements, unsigned count) {
+    czmap * map = NULL;
+    unsigned i = 0;
+    for (i = 0; i < count; i++) {
+        czrect r = placements[i].rect;
+        if (placements[i].data == NULL || r.w == 0 || r.h == 0 || r.w > width || r.h > height
+                || r.x > width - r.w || r.y > height - r.h)
+            return NULL;
+    }
+    map = czmap_internal_alloc(0, 0, width, height);
+    if (map != NULL && !czmap_internal_build(map, placements, count)) {
+        czmap_destroy(map, NULL);
+        return NULL;
+    }
+    return map;
+}
+
+/*
+ * A tree of another size with every lease where it is in map, which stays
+ * as it was. Unlike czmap_copy nothing moves, at the cost of packing them
+ * no tighter. NULL if some lease falls outside.
+ */
+czmap * czmap_resize(czmap * map, unsigned width, unsigned height) {
+    return czmap_internal_rebuild(map, width, height, NULL);
+}
+
+/*
+ * A tree of width by height, the size of map, with every lease of map but
+ * the one of data, whose space is free again; the others stay where they
+ * are. map stays as it was. NULL if out of memory.
+ */
+czmap * czmap_remove(czmap * map, unsigned width, unsigned height, void * data) {
+    return czmap_internal_rebuild(map, width, height, data);
+}
+
 
 /* internal functions */
 
-static czmap * czmap_internal_find_space(czmap * node, unsigned width, unsigned height)
+/* czmap_build with the leases of map, but skip's */
+static czmap * czmap_internal_rebuild(czmap * map, unsigned width, unsigned height, void * skip) {
+    czmap_collect_data collect;
+    czmap * rebuilt = NULL;
+    collect.count = 0;
+    collect.skip = skip;
+    czmap_foreach(map, czmap_internal_count, &collect);
+    collect.placements = czalloc_malloc((collect.count > 0 ? collect.count : 1) * sizeof(czmap_placement));
+    if (collect.placements == NULL)
+        return NULL;
+    collect.count = 0;
+    czmap_foreach(map, czmap_internal_collect, &collect);
+    rebuilt = czmap_build(width, height, collect.placements, collect.count);
+    czalloc_free(collect.placements);
+    return rebuilt;
+}
+
+static void czmap_internal_count(czrect rect, void * data, void * priv) {
+    ((czmap_collect_data *) priv)->count++;
+}
+
+static void czmap_internal_collect(czrect rect, void * data, void * priv) {
+    czmap_collect_data * collect = (czmap_collect_data *) priv;
+    if (data == collect->skip)
+        return;
+    collect->placements[collect->count].rect = rect;
+    collect->placements[collect->count++].data = data;
+}
+
+/* node is a free leaf holding all of placements. Recurses only into the smaller half of each cut */
+static int czmap_internal_build(czmap * node, czmap_placement * placements, unsigned count) {
+    czrect r;
+    unsigned at = 0, cut = 0;
+    int vertical = 0;
+    while (count > 0) {
+        r = node->rect;
+        if (count == 1 && placements->rect.x == r.x && placements->rect.y == r.y) {
+            node->data = placements->data;
+            return czmap_internal_split(node, placements->rect.w, placements->rect.h);
+        }
+        if (!czmap_internal_find_cut(r, placements, count, &vertical, &at, &cut))
+            return czmap_internal_chain(node, placements, count);
+
+        if (vertical) {
+            node->left = czmap_internal_alloc(r.x, r.y, at - r.x, r.h);
+            node->right = czmap_internal_alloc(at, r.y, r.x + r.w - at, r.h);
+        } else {
+            node->left = czmap_internal_alloc(r.x, r.y, r.w, at - r.y);
+            node->right = czmap_internal_alloc(r.x, at, r.w, r.y + r.h - at);
+        }
+        if (node->left == NULL || node->right == NULL)
+            return 0;
+
+        if (cut <= count - cut) {
+            if (!czmap_internal_build(node->left, placements, cut))
+                return 0;
+            node = node->right;
+            placements += cut;
+            count -= cut;
+        } else {
+            if (!czmap_internal_build(node->right, placements + cut, count - cut))
+                return 0;
+            node = node->left;
+            count = cut;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Finds a line crossing no placement, leaving the first cut placements
+ * (sorted along it) before at. Empty strips along the edges go first, the
+ * largest one best, so free space stays in as few leaves as possible; then
+ * the gap between placements that splits them most evenly.
+ */
+static int czmap_internal_find_cut(czrect area, czmap_placement * placements, unsigned count, int * vertical, unsigned * at, unsigned * cut) {
+    unsigned i = 0, xat = 0, xcut = 0, yat = 0, ycut = 0, xbalance = 0, ybalance = 0;
+    unsigned left = area.x + area.w, top = area.y + area.h, right = 0, bottom = 0;
+    unsigned long long strips[4], best = 0;
+    int xfound = 0, yfound = 0;
+
+    for (i = 0; i < count; i++) {
+        czrect r = placements[i].rect;
+        if (r.x < left) left = r.x;
+        if (r.y < top) top = r.y;
+        if (r.x + r.w > right) right = r.x + r.w;
+        if (r.y + r.h > bottom) bottom = r.y + r.h;
+    }
+    strips[0] = (unsigned long long) (left - area.x) * area.h;
+    strips[1] = (unsigned long long) (area.x + area.w - right) * area.h;
+    strips[2] = (unsigned long long) (top - area.y) * area.w;
+    strips[3] = (unsigned long long) (area.y + area.h - bottom) * area.w;
+    for (i = 0; i < 4; i++) {
+        if (strips[i] <= best)
+            continue;
+        best = strips[i];
+        *vertical = i < 2;
+        *at = i == 0 ? left : i == 1 ? right : i == 2 ? top : bottom;
+        *cut = i % 2 == 0 ? 0 : count;
+    }
+    if (best > 0)
+        return 1;
+
+    xfound = czmap_internal_best_gap(placements, count, 1, &xat, &xcut);
+    yfound = czmap_internal_best_gap(placements, count, 0, &yat, &ycut);
+    xbalance = xcut < count - xcut ? xcut : count - xcut;
+    ybalance = ycut < count - ycut ? ycut : count - ycut;
+    /* placements are sorted by y now */
+    if (yfound && (!xfound || ybalance >= xbalance)) {
+        *vertical = 0;
+        *at = yat;
+        *cut = ycut;
+        return 1;
+    }
+    if (xfound) {
+        qsort(placements, count, sizeof(czmap_placement), czmap_internal_by_x);
+        *vertical = 1;
+        *at = xat;
+        *cut = xcut;
+        return 1;
+    }
+    return 0;
+}
+
+/* sorts placements along the axis and picks the gap between them that splits them most evenly */
+static int czmap_internal_best_gap(czmap_placement * placements, unsigned count, int vertical, unsigned * at, unsigned * cut) {
+    unsigned i = 0, end = 0, best = 0;
+    int found = 0;
+    qsort(placements, count, sizeof(czmap_placement), vertical ? czmap_internal_by_x : czmap_internal_by_y);
+    for (i = 0; i + 1 < count; i++) {
+        czrect r = placements[i].rect;
+        unsigned start = vertical ? placements[i + 1].rect.x : placements[i + 1].rect.y;
+        unsigned balance = i + 1 < count - i - 1 ? i + 1 : count - i - 1;
+        if (vertical ? r.x + r.w > end : r.y + r.h > end)
+            end = vertical ? r.x + r.w : r.y + r.h;
+        if (end <= start && (!found || balance > best)) {
+            found = 1;
+            best = balance;
+            *at = end;
+            *cut = i + 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * No guillotine cut separates placements: each gets a node of its own, and
+ * whatever space is left between them is lost. Overlaps are refused.
+ */
+static int czmap_internal_chain(czmap * node, czmap_placement * placements, unsigned count) {
+    unsigned i = 0, j = 0;
+    for (i = 0; i < count; i++) {
+        for (j = i + 1; j < count; j++) {
+            czrect a = placements[i].rect, b = placements[j].rect;
+            if (a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h)
+                return 0;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        czrect r = placements[i].rect;
+        node->left = czmap_internal_alloc(r.x, r.y, r.w, r.h);
+        if (node->left == NULL)
+            return 0;
+        node->left->data = placements[i].data;
+        if (!czmap_internal_split(node->left, r.w, r.h))
+            return 0;
+        if (i + 1 < count) {
+            node->right = czmap_internal_alloc(node->rect.x, node->rect.y, node->rect.w, node->rect.h);
+            if (node->right == NULL)
+                return 0;
+            node = node->right;
+        }
+    }
+    return 1;
+}
+
+static int czmap_internal_by_x(const void * a, const void * b) {
+    unsigned ax = ((const czmap_placement *) a)->rect.x, bx = ((const czmap_placement *) b)->rect.x;
+    return ax < bx ? -1 : ax > bx;
+}
+
+static int czmap_internal_by_y(const void * a, const void * b) {
+    unsigned ay = ((const czmap_placement *) a)->rect.y, by = ((const czmap_placement *) b)->rect.y;
+    return ay < by ? -1 : ay > by;
+}
+
+static czmap_record * czmap_internal_flatten(czmap * node, czmap_record * record, czmap_data_index_func func, void * priv) {
+    czmap_record * next = record + 1;
+    record->x = node->rect.x;
+    record->y = node->rect.y;
+    record->w = node->rect.w;
+    record->h = node->rect.h;
+    record->data = node->data != NULL ? func(node->data, priv) : 0;
+    record->children = (node->left != NULL ? 1 : 0) | (node->right != NULL ? 2 : 0);
+    if (node->left != NULL)
+        next = czmap_internal_flatten(node->left, next, func, priv);
+    if (node->right != NULL)
+        next = czmap_internal_flatten(node->right, next, func, priv);
+    return next;
+}
+
+static czmap * czmap_internal_unflatten(const czmap_record ** record, const czmap_record * end, czrect area, czmap_index_data_func func, void * priv) {
+    const czmap_record * r = *record;
+    czmap * node = NULL;
+    if (r >= end || r->x < area.x || r->y < area.y || r->w > area.w || r->h > area.h
+            || r->x - area.x > area.w - r->w || r->y - area.y > area.h - r->h)
+        return NULL;
+    node = czmap_internal_alloc(r->x, r->y, r->w, r->h);
+    if (node == NULL)
+        return NULL;
+    *record = r + 1;
+    if (r->data != 0 && (node->data = func(r->data, priv)) == NULL) {
+        czmap_internal_free(node);
+        return NULL;
+    }
+    if ((r->children & 1) && (node->left = czmap_internal_unflatten(record, end, area, func, priv)) == NULL) {
+        czmap_destroy(node, NULL);
+        return NULL;
+    }
+    if ((r->children & 2) && (node->right = czmap_internal_unflatten(record, end, area, func, priv)) == NULL) {
+        czmap_destroy(node, NULL);
+        return NULL;
+    }
+    return node;
+}
+
+static czmap * czmap_internal_find_space(czmap * node, unsigned width, unsigned height, unsigned align)
+{
+    czmap * found = czmap_internal_find_leaf(node, width, height, align);
+    if (found != NULL)
+        found = czmap_internal_align(found, align);
+    if (found != NULL && !czmap_internal_split(found, width, height))
+        return NULL;
+    return found;
+}
+
+static czmap * czmap_internal_find_leaf(czmap * node, unsigned width, unsigned height, unsigned align)
 {
     czmap * found = NULL;
     if (node->left == NULL && node->right == NULL) { /* this node might be it */
-        if (width > node->rect.w|| height > node->rect.h)
+        unsigned padx = (0u - node->rect.x) & (align - 1), pady = (0u - node->rect.y) & (align - 1);
+        if (node->data != NULL || padx > node->rect.w || pady > node->rect.h
+            || width > node->rect.w - padx || height > node->rect.h - pady)
             return NULL;
-        czmap_internal_split(node, width, height);
         return node;
     } else {
         if (node->left != NULL) { /* tries left */
-            found = czmap_internal_find_space(node->left, width, height);
+            found = czmap_internal_find_leaf(node->left, width, height, align);
             if (found != NULL)
                 return found;
         }
         if (node->right != NULL) { /* tries right */
-            found = czmap_internal_find_space(node->right, width, height);
+            found = czmap_internal_find_leaf(node->right, width, height, align);
             if (found != NULL)
                 return found;
         }
@@ -127,22 +493,71 @@ static czmap * czmap_internal_find_space(czmap * node, unsigned width, unsigned
     return found;
 }
 
-static void czmap_internal_split(czmap * node, unsigned width, unsigned height) {
+/*
+ * Cuts free strips off the left and top of the free leaf node, so the rest
+ * starts at a multiple of align. Returns the rest, a leaf, or NULL if out
+ * of memory; the tree is valid either way.
+ */
+static czmap * czmap_internal_align(czmap * node, unsigned align) {
+    unsigned padx = (0u - node->rect.x) & (align - 1), pady = (0u - node->rect.y) & (align - 1);
+    czmap * strip = NULL, * rest = NULL;
+    czrect r = node->rect;
+    if (padx > 0) {
+        strip = czmap_internal_alloc(r.x, r.y, padx, r.h);
+        rest = czmap_internal_alloc(r.x + padx, r.y, r.w - padx, r.h);
+        if (strip == NULL || rest == NULL) {
+            czmap_internal_free(strip);
+            czmap_internal_free(rest);
+            return NULL;
+        }
+        node->left = strip;
+        node->right = rest;
+        node = rest;
+        r = node->rect;
+    }
+    if (pady > 0) {
+        strip = czmap_internal_alloc(r.x, r.y, r.w, pady);
+        rest = czmap_internal_alloc(r.x, r.y + pady, r.w, r.h - pady);
+        if (strip == NULL || rest == NULL) {
+            czmap_internal_free(strip);
+            czmap_internal_free(rest);
+            return NULL;
+        }
+        node->left = strip;
+        node->right = rest;
+        node = rest;
+    }
+    return node;
+}
+
+/* returns 0, leaving node as it was, if out of memory */
+static int czmap_internal_split(czmap * node, unsigned width, unsigned height) {
     unsigned resultw = node->rect.w - width;
     unsigned resulth = node->rect.h - height;
+    czmap * left = NULL, * right = NULL;
     if (resultw <= resulth) {
-        node->left = czmap_internal_alloc(node->rect.x + width, node->rect.y, resultw, height);
-        node->right = czmap_internal_alloc(node->rect.x, node->rect.y + height, node->rect.w, resulth);
+        left = czmap_internal_alloc(node->rect.x + width, node->rect.y, resultw, height);
+        right = czmap_internal_alloc(node->rect.x, node->rect.y + height, node->rect.w, resulth);
     } else {
-        node->left = czmap_internal_alloc(node->rect.x, node->rect.y + height, width, resulth);
-        node->right = czmap_internal_alloc(node->rect.x + width, node->rect.y, resultw, node->rect.h);
+        left = czmap_internal_alloc(node->rect.x, node->rect.y + height, width, resulth);
+        right = czmap_internal_alloc(node->rect.x + width, node->rect.y, resultw, node->rect.h);
+    }
+    if (left == NULL || right == NULL) {
+        czmap_internal_free(left);
+        czmap_internal_free(right);
+        return 0;
     }
+    node->left = left;
+    node->right = right;
     node->rect.w = width;
     node->rect.h = height;
+    return 1;
 }
 
 static czmap * czmap_internal_alloc(unsigned x, unsigned y, unsigned w, unsigned h) {
-    czmap * r = calloc(sizeof(czmap), 1);
+    czmap * r = czalloc_calloc(sizeof(czmap), 1);
+    if (r == NULL)
+        return NULL;
     r->rect.x = x;
     r->rect.y = y;
     r->rect.w = w;
@@ -151,5 +566,5 @@ static czmap * czmap_internal_alloc(unsigned x, unsigned y, unsigned w, unsigned
 }
 
 static void czmap_internal_free(czmap * map) {
-    free(map);
+    czalloc_free(map);
 }
@@ -33,6 +33,22 @@ typedef struct czmap czmap;
 typedef void (*czwalkfunc)(czrect rect, void * data, void * priv);
 typedef void (*czdestroyfunc)(void * data);
 
+/* nodes in preorder; data is 0 for none, or whatever the index functions map it to */
+typedef struct czmap_record {
+    unsigned x, y, w, h;
+    unsigned data;
+    unsigned children; /* 1 for left, 2 for right */
+} czmap_record;
+
+/* a rect already taken by data, for czmap_build */
+typedef struct czmap_placement {
+    czrect rect;
+    void * data;
+} czmap_placement;
+
+typedef unsigned (*czmap_data_index_func)(void * data, void * priv);
+typedef void * (*czmap_index_data_func)(unsigned index, void * priv);
+
 typedef enum czmap_copy_status {
     CZMAP_COPY_OK,
     CZMAP_COPY_NOSPACE
@@ -41,7 +57,15 @@ typedef enum czmap_copy_status {
 czmap * czmap_create(unsigned width, unsigned height);
 void czmap_destroy(czmap * map, czdestroyfunc func);
 czrect czmap_lease(czmap * map, unsigned width, unsigned height, void * data);
+czrect czmap_lease_aligned(czmap * map, unsigned width, unsigned height, unsigned align, void * data);
+int czmap_probe(czmap * map, unsigned width, unsigned height, unsigned align, unsigned long * waste);
 void czmap_foreach(czmap * map, czwalkfunc func, void * priv);
-czmap_copy_status czmap_copy(czmap * src, czmap * dst);
+czmap_copy_status czmap_copy(czmap * src, czmap * dst, unsigned maxalign);
+unsigned czmap_node_count(czmap * map);
+void czmap_flatten(czmap * map, czmap_record * records, czmap_data_index_func func, void * priv);
+czmap * czmap_unflatten(const czmap_record * records, unsigned count, unsigned width, unsigned height, czmap_index_data_func func, void * priv);
+czmap * czmap_build(unsigned width, unsigned height, czmap_placement * placements, unsigned count);
+czmap * czmap_resize(czmap * map, unsigned width, unsigned height);
+czmap * czmap_remove(czmap * map, unsigned width, unsigned height, void * data);
 
 #endif
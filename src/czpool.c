@@ -0,0 +1,150 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czpool.h"
+#include "czthread.h"
+#include "czalloc.h"
+
+/*
+ * A fixed set of worker threads taking jobs from a queue. Jobs start in
+ * the order they were submitted, so a job waiting for an earlier one is
+ * never stuck behind a later one.
+ */
+
+#define CZPOOL_MAX_WORKERS 64
+
+/* data type declarations */
+
+typedef struct czpool_job {
+    czpool_func func;
+    void * priv;
+    struct czpool_job * next;
+} czpool_job;
+
+struct czpool {
+    czthread_mutex lock;
+    czthread_cond wake;
+    czpool_job * head, * tail;
+    int stopping;
+    unsigned workers;
+    czthread_handle threads[CZPOOL_MAX_WORKERS];
+};
+
+/* internal forward declarations */
+
+static void czpool_internal_worker(void * priv);
+
+czpool * czpool_create(unsigned workers) {
+    czpool * pool = czalloc_calloc(1, sizeof(czpool));
+    if (pool == NULL)
+        return NULL;
+    if (czthread_mutex_init(&pool->lock) != 0) {
+        czalloc_free(pool);
+        return NULL;
+    }
+    if (czthread_cond_init(&pool->wake) != 0) {
+        czthread_mutex_destroy(&pool->lock);
+        czalloc_free(pool);
+        return NULL;
+    }
+
+    if (workers == 0) workers = 1;
+    if (workers > CZPOOL_MAX_WORKERS) workers = CZPOOL_MAX_WORKERS;
+    while (pool->workers < workers) {
+        if (czthread_start(&pool->threads[pool->workers], czpool_internal_worker, pool) != 0)
+            break;
+        pool->workers++;
+    }
+    if (pool->workers == 0) {
+        czpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* runs every job still queued, then stops the workers */
+void czpool_destroy(czpool * pool) {
+    unsigned i = 0;
+    if (pool == NULL)
+        return;
+    czthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    czthread_cond_broadcast(&pool->wake);
+    czthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->workers; i++)
+        czthread_join(pool->threads[i]);
+    czthread_cond_destroy(&pool->wake);
+    czthread_mutex_destroy(&pool->lock);
+    czalloc_free(pool);
+}
+
+/* queues func(priv) to run on a worker, returns 0 if out of memory */
+int czpool_submit(czpool * pool, czpool_func func, void * priv) {
+    czpool_job * job = czalloc_malloc(sizeof(czpool_job));
+    if (job == NULL)
+        return 0;
+    job->func = func;
+    job->priv = priv;
+    job->next = NULL;
+
+    czthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    czthread_cond_signal(&pool->wake);
+    czthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+
+/* internal functions */
+
+static void czpool_internal_worker(void * priv) {
+    czpool * pool = (czpool *) priv;
+    czpool_job * job = NULL;
+    czpool_func func = NULL;
+    void * data = NULL;
+    for (;;) {
+        czthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL && !pool->stopping)
+            czthread_cond_wait(&pool->wake, &pool->lock);
+        job = pool->head;
+        if (job == NULL) {
+            czthread_mutex_unlock(&pool->lock);
+            return;
+        }
+        pool->head = job->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        czthread_mutex_unlock(&pool->lock);
+
+        func = job->func;
+        data = job->priv;
+        czalloc_free(job);
+        func(data);
+    }
+}
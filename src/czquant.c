@@ -0,0 +1,341 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czquant.h"
+#include "czthread.h"
+#include "czalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CZQUANT_EXACT_SLOTS 1024
+#define CZQUANT_BITS 5
+#define CZQUANT_BUCKETS (1u << (4 * CZQUANT_BITS))
+#define CZQUANT_ROWS 4096
+
+/* data type declarations */
+
+typedef struct czquant_entry {
+    unsigned char key[4];
+    unsigned count;
+    double sum[4];
+} czquant_entry;
+
+typedef struct czquant_box {
+    unsigned begin, end;
+    unsigned long population;
+} czquant_box;
+
+typedef struct czquant_map_data {
+    const unsigned char * rgba;
+    unsigned char * indices;
+    size_t count;
+    int palette[4][CZQUANT_MAX_COLORS];
+    unsigned colors;
+} czquant_map_data;
+
+/* internal forward declarations */
+
+static unsigned czquant_internal_pixel(const unsigned char * p);
+static int czquant_internal_exact(const unsigned char * rgba, size_t count, unsigned char * palette, unsigned * colors);
+static int czquant_internal_median_cut(const unsigned char * rgba, size_t count, unsigned char * palette, unsigned * colors);
+static void czquant_internal_map_rows(unsigned index, void * priv);
+static void czquant_internal_sort(czquant_entry * entries, unsigned count, int channel, czquant_entry * scratch);
+
+/*
+ * Converts count RGBA pixels to palette indices. palette receives up to
+ * CZQUANT_MAX_COLORS RGBA entries and colors how many were used. If the
+ * pixels have few enough colors the palette is exact, otherwise it is built
+ * by median cut. Fully transparent pixels are all mapped to the same color.
+ * Returns the indices, or NULL if out of memory.
+ */
+unsigned char * czquant_quantize(const unsigned char * rgba, size_t count, unsigned char * palette, unsigned * colors) {
+    czquant_map_data * data = NULL;
+    unsigned i = 0, chunks = 0;
+    unsigned char * indices = NULL;
+
+    if (!czquant_internal_exact(rgba, count, palette, colors)
+        && !czquant_internal_median_cut(rgba, count, palette, colors))
+        return NULL;
+
+    data = czalloc_malloc(sizeof(czquant_map_data));
+    indices = czalloc_malloc(count > 0 ? count : 1);
+    if (data == NULL || indices == NULL) {
+        czalloc_free(data);
+        czalloc_free(indices);
+        return NULL;
+    }
+
+    /* palette as one array per channel, so distances vectorize */
+    data->rgba = rgba;
+    data->indices = indices;
+    data->count = count;
+    data->colors = *colors;
+    for (i = 0; i < CZQUANT_MAX_COLORS; i++) {
+        int k = 0;
+        for (k = 0; k < 4; k++)
+            data->palette[k][i] = i < *colors ? palette[i * 4 + k] : 1 << 12;
+    }
+
+    chunks = (unsigned) ((count + CZQUANT_ROWS - 1) / CZQUANT_ROWS);
+    czthread_parallel_for(chunks, czquant_internal_map_rows, data);
+    czalloc_free(data);
+    return indices;
+}
+
+
+/* internal functions */
+
+static unsigned czquant_internal_pixel(const unsigned char * p) {
+    if (p[3] == 0)
+        return 0;
+    return (unsigned) p[0] | ((unsigned) p[1] << 8) | ((unsigned) p[2] << 16) | ((unsigned) p[3] << 24);
+}
+
+/* collects the colors if there are at most CZQUANT_MAX_COLORS of them */
+static int czquant_internal_exact(const unsigned char * rgba, size_t count, unsigned char * palette, unsigned * colors) {
+    unsigned slots[CZQUANT_EXACT_SLOTS];
+    unsigned char used[CZQUANT_EXACT_SLOTS];
+    unsigned found = 0, last = 0, i = 0;
+    size_t p = 0;
+    int haslast = 0;
+
+    memset(used, 0, sizeof(used));
+    for (p = 0; p < count; p++) {
+        unsigned color = czquant_internal_pixel(rgba + p * 4);
+        unsigned slot = 0;
+        if (haslast && color == last)
+            continue;
+        last = color;
+        haslast = 1;
+
+        slot = (color * 2654435761u) >> 22;
+        while (used[slot] && slots[slot] != color)
+            slot = (slot + 1) & (CZQUANT_EXACT_SLOTS - 1);
+        if (used[slot])
+            continue;
+        if (found == CZQUANT_MAX_COLORS)
+            return 0;
+        used[slot] = 1;
+        slots[slot] = color;
+        found++;
+    }
+
+    *colors = 0;
+    for (i = 0; i < CZQUANT_EXACT_SLOTS; i++) {
+        unsigned char * entry = NULL;
+        if (!used[i])
+            continue;
+        entry = palette + (*colors)++ * 4;
+        entry[0] = (unsigned char) slots[i];
+        entry[1] = (unsigned char) (slots[i] >> 8);
+        entry[2] = (unsigned char) (slots[i] >> 16);
+        entry[3] = (unsigned char) (slots[i] >> 24);
+    }
+    return 1;
+}
+
+/* median cut over a histogram of CZQUANT_BITS per channel */
+static int czquant_internal_median_cut(const unsigned char * rgba, size_t count, unsigned char * palette, unsigned * colors) {
+    const unsigned shift = 8 - CZQUANT_BITS;
+    unsigned * buckets = czalloc_calloc(CZQUANT_BUCKETS, sizeof(unsigned));
+    czquant_entry * entries = NULL, * scratch = NULL;
+    czquant_box boxes[CZQUANT_MAX_COLORS];
+    unsigned nentries = 0, nboxes = 1, i = 0, b = 0;
+    size_t p = 0;
+    int k = 0;
+
+    if (buckets == NULL)
+        return 0;
+
+    /* count, then turn counts into entry indices and accumulate */
+    for (p = 0; p < count; p++) {
+        unsigned color = czquant_internal_pixel(rgba + p * 4);
+        unsigned key = ((color & 0xFF) >> shift)
+            | (((color >> 8) & 0xFF) >> shift) << CZQUANT_BITS
+            | (((color >> 16) & 0xFF) >> shift) << (2 * CZQUANT_BITS)
+            | (((color >> 24) & 0xFF) >> shift) << (3 * CZQUANT_BITS);
+        if (buckets[key]++ == 0)
+            nentries++;
+    }
+
+    entries = czalloc_calloc(nentries > 0 ? nentries : 1, sizeof(czquant_entry));
+    scratch = czalloc_malloc((nentries > 0 ? nentries : 1) * sizeof(czquant_entry));
+    if (entries == NULL || scratch == NULL) {
+        czalloc_free(scratch);
+        czalloc_free(entries);
+        czalloc_free(buckets);
+        return 0;
+    }
+    nentries = 0;
+    for (i = 0; i < CZQUANT_BUCKETS; i++) {
+        if (buckets[i] == 0)
+            continue;
+        for (k = 0; k < 4; k++)
+            entries[nentries].key[k] = (unsigned char) ((i >> (k * CZQUANT_BITS)) & ((1u << CZQUANT_BITS) - 1));
+        entries[nentries].count = buckets[i];
+        buckets[i] = nentries++;
+    }
+    for (p = 0; p < count; p++) {
+        unsigned color = czquant_internal_pixel(rgba + p * 4);
+        unsigned key = ((color & 0xFF) >> shift)
+            | (((color >> 8) & 0xFF) >> shift) << CZQUANT_BITS
+            | (((color >> 16) & 0xFF) >> shift) << (2 * CZQUANT_BITS)
+            | (((color >> 24) & 0xFF) >> shift) << (3 * CZQUANT_BITS);
+        czquant_entry * e = entries + buckets[key];
+        for (k = 0; k < 4; k++)
+            e->sum[k] += (color >> (8 * k)) & 0xFF;
+    }
+    czalloc_free(buckets);
+
+    boxes[0].begin = 0;
+    boxes[0].end = nentries;
+    boxes[0].population = (unsigned long) count;
+
+    /* split the box with the widest (population weighted) range until the palette is full */
+    while (nboxes < CZQUANT_MAX_COLORS) {
+        int bestchannel = -1;
+        unsigned bestbox = 0;
+        double bestscore = 0;
+        unsigned long half = 0, acc = 0;
+        unsigned split = 0;
+
+        for (b = 0; b < nboxes; b++) {
+            unsigned char lo[4] = { 255, 255, 255, 255 }, hi[4] = { 0, 0, 0, 0 };
+            if (boxes[b].end - boxes[b].begin < 2)
+                continue;
+            for (i = boxes[b].begin; i < boxes[b].end; i++) {
+                for (k = 0; k < 4; k++) {
+                    if (entries[i].key[k] < lo[k]) lo[k] = entries[i].key[k];
+                    if (entries[i].key[k] > hi[k]) hi[k] = entries[i].key[k];
+                }
+            }
+            for (k = 0; k < 4; k++) {
+                double score = (double) (hi[k] - lo[k]) * boxes[b].population;
+                if (hi[k] > lo[k] && score > bestscore) {
+                    bestscore = score;
+                    bestchannel = k;
+                    bestbox = b;
+                }
+            }
+        }
+        if (bestchannel < 0)
+            break;
+
+        czquant_internal_sort(entries + boxes[bestbox].begin, boxes[bestbox].end - boxes[bestbox].begin, bestchannel, scratch);
+
+        half = boxes[bestbox].population / 2;
+        for (split = boxes[bestbox].begin; split < boxes[bestbox].end - 1; split++) {
+            acc += entries[split].count;
+            if (acc >= half)
+                break;
+        }
+        /* without reaching half, the last entry alone makes the second box */
+        if (acc >= half)
+            split++;
+        else
+            split = boxes[bestbox].end - 1;
+
+        boxes[nboxes].begin = split;
+        boxes[nboxes].end = boxes[bestbox].end;
+        boxes[nboxes].population = boxes[bestbox].population - acc;
+        boxes[bestbox].end = split;
+        boxes[bestbox].population = acc;
+        nboxes++;
+    }
+
+    /* each color is the average of the pixels in its box */
+    for (b = 0; b < nboxes; b++) {
+        double sum[4] = { 0, 0, 0, 0 };
+        double n = 0;
+        for (i = boxes[b].begin; i < boxes[b].end; i++) {
+            for (k = 0; k < 4; k++)
+                sum[k] += entries[i].sum[k];
+            n += entries[i].count;
+        }
+        for (k = 0; k < 4; k++)
+            palette[b * 4 + k] = (unsigned char) (n > 0 ? sum[k] / n + 0.5 : 0);
+    }
+    *colors = nboxes;
+
+    czalloc_free(scratch);
+    czalloc_free(entries);
+    return 1;
+}
+
+static void czquant_internal_map_rows(unsigned index, void * priv) {
+    czquant_map_data * data = (czquant_map_data *) priv;
+    size_t begin = (size_t) index * CZQUANT_ROWS, end = begin + CZQUANT_ROWS, p = 0;
+    int distances[CZQUANT_MAX_COLORS];
+    unsigned last = 0, i = 0;
+    unsigned char lastindex = 0;
+    int haslast = 0;
+    if (end > data->count)
+        end = data->count;
+
+    for (p = begin; p < end; p++) {
+        unsigned color = czquant_internal_pixel(data->rgba + p * 4);
+        int r = (int) (color & 0xFF), g = (int) ((color >> 8) & 0xFF);
+        int b = (int) ((color >> 16) & 0xFF), a = (int) (color >> 24);
+        int best = 0;
+        if (haslast && color == last) {
+            data->indices[p] = lastindex;
+            continue;
+        }
+
+        for (i = 0; i < CZQUANT_MAX_COLORS; i++) {
+            int dr = data->palette[0][i] - r, dg = data->palette[1][i] - g;
+            int db = data->palette[2][i] - b, da = data->palette[3][i] - a;
+            distances[i] = dr * dr + dg * dg + db * db + da * da;
+        }
+        for (i = 1; i < data->colors; i++)
+            if (distances[i] < distances[best]) best = (int) i;
+
+        last = color;
+        lastindex = (unsigned char) best;
+        haslast = 1;
+        data->indices[p] = lastindex;
+    }
+}
+
+/*
+ * Sorts entries by one channel of their keys, which have CZQUANT_BITS, with
+ * a counting sort through scratch. Everything is local, so atlases can be
+ * quantized on several threads at once.
+ */
+static void czquant_internal_sort(czquant_entry * entries, unsigned count, int channel, czquant_entry * scratch) {
+    unsigned starts[1u << CZQUANT_BITS];
+    unsigned i = 0, total = 0;
+    memset(starts, 0, sizeof(starts));
+    for (i = 0; i < count; i++)
+        starts[entries[i].key[channel]]++;
+    for (i = 0; i < (1u << CZQUANT_BITS); i++) {
+        unsigned n = starts[i];
+        starts[i] = total;
+        total += n;
+    }
+    for (i = 0; i < count; i++)
+        scratch[starts[entries[i].key[channel]]++] = entries[i];
+    memcpy(entries, scratch, count * sizeof(czquant_entry));
+}
@@ -0,0 +1,181 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czsdf.h"
+#include "czalloc.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define CZSDF_INF 1e20f
+
+/* internal forward declarations */
+static void czsdf_internal_edt_1d(const float * f, float * d, int * v, float * z, int n);
+static int czsdf_internal_edt_2d(float * grid, int width, int height);
+
+/*
+ * Converts src into a single channel signed distance field.
+ *
+ * Distances are exact (Felzenszwalb & Huttenlocher) and computed at the
+ * resolution of src, then box filtered down by downscale. The result has a
+ * border of spread pixels on each side, and spread is also the distance
+ * (in output pixels) mapped to the full 0..255 range, with 128 on the edge
+ * and higher values inside the shape. Coverage comes from the alpha channel
+ * when there is one or from the first channel otherwise.
+ */
+czsurface * czsdf_create(czsurface * src, unsigned downscale, unsigned spread) {
+    czsize size = czsurface_size(src);
+    unsigned channels = czsurface_channels(src);
+    const unsigned char * pixels = czsurface_pixels(src);
+    unsigned coverage = (channels == 2 || channels == 4) ? channels - 1 : 0;
+    int pad = 0, w = 0, h = 0, ow = 0, oh = 0, x = 0, y = 0;
+    float * outside = NULL, * inside = NULL;
+    unsigned char * out = NULL;
+    czsurface * result = NULL;
+
+    if (czsurface_pixel_type(src) != CZSURFACE_UINT8)
+        return NULL;
+
+    if (downscale == 0) downscale = 1;
+    if (spread == 0) spread = 1;
+
+    pad = (int) (spread * downscale);
+    w = (int) size.w + 2 * pad;
+    h = (int) size.h + 2 * pad;
+    ow = (w + (int) downscale - 1) / (int) downscale;
+    oh = (h + (int) downscale - 1) / (int) downscale;
+
+    result = czsurface_create((unsigned) ow, (unsigned) oh, 1, CZSURFACE_UINT8);
+    outside = czalloc_malloc(sizeof(float) * w * h);
+    inside = czalloc_malloc(sizeof(float) * w * h);
+    if (result == NULL || outside == NULL || inside == NULL) {
+        czsurface_destroy(result);
+        czalloc_free(outside);
+        czalloc_free(inside);
+        return NULL;
+    }
+
+    /* outside holds the distance to the shape, inside the distance to the background */
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            int sx = x - pad, sy = y - pad, in = 0;
+            if (sx >= 0 && sy >= 0 && sx < (int) size.w && sy < (int) size.h)
+                in = pixels[(sy * size.w + sx) * channels + coverage] >= 128;
+            outside[y * w + x] = in ? 0 : CZSDF_INF;
+            inside[y * w + x] = in ? CZSDF_INF : 0;
+        }
+    }
+
+    if (!czsdf_internal_edt_2d(outside, w, h) || !czsdf_internal_edt_2d(inside, w, h)) {
+        czsurface_destroy(result);
+        czalloc_free(outside);
+        czalloc_free(inside);
+        return NULL;
+    }
+
+    /* average the signed distance of each downscale x downscale block */
+    out = czsurface_pixels(result);
+    for (y = 0; y < oh; y++) {
+        for (x = 0; x < ow; x++) {
+            int bx = 0, by = 0, n = 0;
+            float sum = 0, v = 0;
+            for (by = y * (int) downscale; by < (y + 1) * (int) downscale && by < h; by++) {
+                for (bx = x * (int) downscale; bx < (x + 1) * (int) downscale && bx < w; bx++) {
+                    int i = by * w + bx;
+                    if (outside[i] > 0)
+                        sum += sqrtf(outside[i]) - 0.5f;
+                    else
+                        sum -= sqrtf(inside[i]) - 0.5f;
+                    n++;
+                }
+            }
+            v = 127.5f - (sum / n / downscale) * 127.5f / spread;
+            if (v < 0) v = 0;
+            if (v > 255) v = 255;
+            out[y * ow + x] = (unsigned char) (v + 0.5f);
+        }
+    }
+
+    czalloc_free(outside);
+    czalloc_free(inside);
+    return result;
+}
+
+
+/* internal functions */
+
+/* squared distance transform of a sampled function, in place on rows then columns; 0 if out of memory */
+static int czsdf_internal_edt_2d(float * grid, int width, int height) {
+    int n = width > height ? width : height;
+    int x = 0, y = 0, ok = 0;
+    float * f = czalloc_malloc(sizeof(float) * n);
+    float * d = czalloc_malloc(sizeof(float) * n);
+    float * z = czalloc_malloc(sizeof(float) * (n + 1));
+    int * v = czalloc_malloc(sizeof(int) * n);
+
+    ok = f != NULL && d != NULL && z != NULL && v != NULL;
+    if (ok) {
+        for (x = 0; x < width; x++) {
+            for (y = 0; y < height; y++) f[y] = grid[y * width + x];
+            czsdf_internal_edt_1d(f, d, v, z, height);
+            for (y = 0; y < height; y++) grid[y * width + x] = d[y];
+        }
+        for (y = 0; y < height; y++) {
+            czsdf_internal_edt_1d(grid + y * width, d, v, z, width);
+            for (x = 0; x < width; x++) grid[y * width + x] = d[x];
+        }
+    }
+
+    czalloc_free(f);
+    czalloc_free(d);
+    czalloc_free(z);
+    czalloc_free(v);
+    return ok;
+}
+
+static void czsdf_internal_edt_1d(const float * f, float * d, int * v, float * z, int n) {
+    int k = 0, q = 0;
+    float s = 0;
+    v[0] = 0;
+    z[0] = -CZSDF_INF;
+    z[1] = CZSDF_INF;
+    for (q = 1; q < n; q++) {
+        s = ((f[q] + (float) q * q) - (f[v[k]] + (float) v[k] * v[k])) / (2.0f * q - 2.0f * v[k]);
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + (float) q * q) - (f[v[k]] + (float) v[k] * v[k])) / (2.0f * q - 2.0f * v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = CZSDF_INF;
+    }
+
+    k = 0;
+    for (q = 0; q < n; q++) {
+        while (z[k + 1] < q)
+            k++;
+        d[q] = (float) (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
@@ -0,0 +1,311 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czspec.h"
+#include "czalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Binary specs, meant to be mapped and used in place:
+ *
+ *  header    czspec_header
+ *  records   count czspec_record, sorted by name
+ *  hash      slots czspec_slot, open addressing with linear probing
+ *  strings   one entry per record, in the same order: the length of the
+ *            prefix shared with the previous name and of the rest (two
+ *            little endian 16 bit values each), then the rest. Every
+ *            CZSPEC_RESTART entries the whole name is stored.
+ *
+ * Numbers are in the byte order of the writer, told by the endian field.
+ * Reading needs no allocation: names are compared while being decoded from
+ * the closest restart, and czspec_open checks everything else reads.
+ */
+
+#define CZSPEC_VERSION 1
+#define CZSPEC_RESTART 16
+#define CZSPEC_MAX_NAME 65535
+
+/* data type declarations */
+
+typedef struct czspec_header {
+    char magic[4];
+    unsigned version;
+    unsigned endian;
+    unsigned count;
+    unsigned width, height;
+    unsigned packed;
+    unsigned slots;
+    unsigned records, hash, strings, stringbytes;
+} czspec_header;
+
+typedef struct czspec_record {
+    unsigned x, y, w, h;
+    unsigned channel;
+    unsigned string; /* offset of its entry in the strings */
+} czspec_record;
+
+typedef struct czspec_slot {
+    unsigned hash;
+    unsigned index; /* record + 1, 0 when free */
+} czspec_slot;
+
+static const char czspec_magic[4] = { 'C', 'Z', 'S', 'P' };
+
+/* internal forward declarations */
+
+static int czspec_internal_compare(const void * a, const void * b);
+static unsigned czspec_internal_hash(const char * name);
+static unsigned czspec_internal_shared(const char * a, const char * b);
+static const unsigned char * czspec_internal_entry(const czspec_header * header, unsigned index, unsigned * shared, unsigned * rest);
+static int czspec_internal_matches(const czspec_header * header, unsigned index, const char * name);
+
+/* sorts entries by name, then writes them. Returns 0 on failure */
+int czspec_write(FILE * out, czspec_entry * entries, unsigned count, unsigned width, unsigned height, int packed) {
+    czspec_header header;
+    czspec_record record;
+    czspec_slot * slots = NULL;
+    unsigned char lengths[4];
+    unsigned i = 0, j = 0, shared = 0, rest = 0, offset = 0;
+    int ok = 1;
+
+    qsort(entries, count, sizeof(czspec_entry), czspec_internal_compare);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, czspec_magic, sizeof(czspec_magic));
+    header.version = CZSPEC_VERSION;
+    header.endian = 0x01020304;
+    header.count = count;
+    header.width = width;
+    header.height = height;
+    header.packed = packed ? 1 : 0;
+    header.slots = 4;
+    while (header.slots < count * 2)
+        header.slots *= 2;
+    header.records = sizeof(czspec_header);
+    header.hash = header.records + count * sizeof(czspec_record);
+    header.strings = header.hash + header.slots * sizeof(czspec_slot);
+
+    slots = czalloc_calloc(header.slots, sizeof(czspec_slot));
+    if (slots == NULL)
+        return 0;
+    for (i = 0; i < count; i++) {
+        unsigned hash = czspec_internal_hash(entries[i].name);
+        if (strlen(entries[i].name) > CZSPEC_MAX_NAME) {
+            czalloc_free(slots);
+            return 0;
+        }
+        j = hash & (header.slots - 1);
+        while (slots[j].index != 0)
+            j = (j + 1) & (header.slots - 1);
+        slots[j].hash = hash;
+        slots[j].index = i + 1;
+        shared = i % CZSPEC_RESTART == 0 ? 0 : czspec_internal_shared(entries[i - 1].name, entries[i].name);
+        header.stringbytes += 4 + (unsigned) strlen(entries[i].name) - shared;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (i = 0; ok && i < count; i++) {
+        shared = i % CZSPEC_RESTART == 0 ? 0 : czspec_internal_shared(entries[i - 1].name, entries[i].name);
+        record.x = entries[i].x;
+        record.y = entries[i].y;
+        record.w = entries[i].w;
+        record.h = entries[i].h;
+        record.channel = entries[i].channel;
+        record.string = offset;
+        offset += 4 + (unsigned) strlen(entries[i].name) - shared;
+        ok = fwrite(&record, sizeof(record), 1, out) == 1;
+    }
+    if (ok)
+        ok = fwrite(slots, sizeof(czspec_slot), header.slots, out) == header.slots;
+    for (i = 0; ok && i < count; i++) {
+        shared = i % CZSPEC_RESTART == 0 ? 0 : czspec_internal_shared(entries[i - 1].name, entries[i].name);
+        rest = (unsigned) strlen(entries[i].name) - shared;
+        lengths[0] = (unsigned char) shared;
+        lengths[1] = (unsigned char) (shared >> 8);
+        lengths[2] = (unsigned char) rest;
+        lengths[3] = (unsigned char) (rest >> 8);
+        ok = fwrite(lengths, 4, 1, out) == 1 && (rest == 0 || fwrite(entries[i].name + shared, rest, 1, out) == 1);
+    }
+    czalloc_free(slots);
+    return ok;
+}
+
+/*
+ * Checks that data holds a whole spec that the other functions can read
+ * without going out of bounds. Returns 0 if not.
+ */
+int czspec_open(const void * data, size_t size, czspec_info * info) {
+    const czspec_header * header = (const czspec_header *) data;
+    const czspec_record * records = NULL;
+    const czspec_slot * slots = NULL;
+    unsigned long long end = 0;
+    unsigned i = 0, shared = 0, rest = 0, previous = 0, offset = 0;
+    if (data == NULL || size < sizeof(czspec_header) || ((size_t) data & 3) != 0
+            || memcmp(header->magic, czspec_magic, sizeof(czspec_magic)) != 0
+            || header->version != CZSPEC_VERSION || header->endian != 0x01020304
+            || header->slots == 0 || (header->slots & (header->slots - 1)) != 0 || header->slots < header->count
+            || header->records != sizeof(czspec_header)
+            || header->hash != header->records + (unsigned long long) header->count * sizeof(czspec_record)
+            || header->strings != header->hash + (unsigned long long) header->slots * sizeof(czspec_slot))
+        return 0;
+    end = (unsigned long long) header->strings + header->stringbytes;
+    if (end > size)
+        return 0;
+
+    records = (const czspec_record *) ((const unsigned char *) data + header->records);
+    slots = (const czspec_slot *) ((const unsigned char *) data + header->hash);
+    for (i = 0; i < header->slots; i++)
+        if (slots[i].index > header->count)
+            return 0;
+    for (i = 0; i < header->count; i++) {
+        if (records[i].string != offset || (unsigned long long) offset + 4 > header->stringbytes)
+            return 0;
+        czspec_internal_entry(header, i, &shared, &rest);
+        if (shared > previous || (i % CZSPEC_RESTART == 0 && shared != 0)
+                || (unsigned long long) offset + 4 + rest > header->stringbytes)
+            return 0;
+        previous = shared + rest;
+        offset += 4 + rest;
+    }
+
+    if (info != NULL) {
+        info->count = header->count;
+        info->width = header->width;
+        info->height = header->height;
+        info->packed = (int) header->packed;
+    }
+    return 1;
+}
+
+/* the index of the record named name, or CZSPEC_MISSING */
+unsigned czspec_find(const void * data, const char * name) {
+    const czspec_header * header = (const czspec_header *) data;
+    const czspec_slot * slots = (const czspec_slot *) ((const unsigned char *) data + header->hash);
+    unsigned hash = czspec_internal_hash(name), i = hash & (header->slots - 1), probes = 0;
+    while (slots[i].index != 0 && probes++ < header->slots) {
+        if (slots[i].hash == hash && czspec_internal_matches(header, slots[i].index - 1, name))
+            return slots[i].index - 1;
+        i = (i + 1) & (header->slots - 1);
+    }
+    return CZSPEC_MISSING;
+}
+
+/* the rect and channel of a record, entry->name is not set */
+void czspec_entry_at(const void * data, unsigned index, czspec_entry * entry) {
+    const czspec_header * header = (const czspec_header *) data;
+    const czspec_record * record = (const czspec_record *) ((const unsigned char *) data + header->records) + index;
+    entry->name = NULL;
+    entry->x = record->x;
+    entry->y = record->y;
+    entry->w = record->w;
+    entry->h = record->h;
+    entry->channel = record->channel;
+}
+
+/*
+ * Decodes the name of a record into name, truncated to size - 1 characters
+ * and NUL terminated if size > 0. Returns its whole length.
+ */
+unsigned czspec_name(const void * data, unsigned index, char * name, unsigned size) {
+    const czspec_header * header = (const czspec_header *) data;
+    const unsigned char * rest = NULL;
+    unsigned i = index - index % CZSPEC_RESTART, shared = 0, length = 0, n = 0, k = 0;
+    for (; i <= index; i++) {
+        rest = czspec_internal_entry(header, i, &shared, &n);
+        for (k = 0; k < n; k++)
+            if (shared + k + 1 < size)
+                name[shared + k] = (char) rest[k];
+        length = shared + n;
+    }
+    if (size > 0)
+        name[length < size ? length : size - 1] = 0;
+    return length;
+}
+
+
+/* internal functions */
+
+static int czspec_internal_compare(const void * a, const void * b) {
+    return strcmp(((const czspec_entry *) a)->name, ((const czspec_entry *) b)->name);
+}
+
+/* 32 bit FNV-1a */
+static unsigned czspec_internal_hash(const char * name) {
+    unsigned hash = 2166136261u;
+    const unsigned char * p = (const unsigned char *) name;
+    while (*p != 0) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned czspec_internal_shared(const char * a, const char * b) {
+    unsigned n = 0;
+    while (a[n] != 0 && a[n] == b[n] && n < CZSPEC_MAX_NAME)
+        n++;
+    return n;
+}
+
+/* the rest of the name of a record, and the lengths of its entry */
+static const unsigned char * czspec_internal_entry(const czspec_header * header, unsigned index, unsigned * shared, unsigned * rest) {
+    const unsigned char * strings = (const unsigned char *) header + header->strings;
+    const czspec_record * record = (const czspec_record *) ((const unsigned char *) header + header->records) + index;
+    const unsigned char * entry = strings + record->string;
+    *shared = entry[0] | (unsigned) entry[1] << 8;
+    *rest = entry[2] | (unsigned) entry[3] << 8;
+    return entry + 4;
+}
+
+/*
+ * Compares name with the name of a record, decoding from the previous
+ * restart. matched is how many leading characters of name the last decoded
+ * name has: a name sharing less than matched with it differs at matched.
+ */
+static int czspec_internal_matches(const czspec_header * header, unsigned index, const char * name) {
+    const unsigned char * rest = NULL;
+    unsigned i = index - index % CZSPEC_RESTART, shared = 0, n = 0, matched = 0, k = 0;
+    for (; i <= index; i++) {
+        rest = czspec_internal_entry(header, i, &shared, &n);
+        if (shared < matched) {
+            matched = shared;
+            if (i < index)
+                continue;
+            return 0;
+        }
+        /* shared >= matched: the first shared characters only match up to matched */
+        if (shared > matched) {
+            if (i == index)
+                return 0;
+            continue;
+        }
+        for (k = 0; k < n && name[matched] != 0 && (unsigned char) name[matched] == rest[k]; k++)
+            matched++;
+        if (i == index)
+            return k == n && name[matched] == 0;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef CZSPEC_H
+#define CZSPEC_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define CZSPEC_MISSING ((unsigned) -1)
+
+typedef struct czspec_entry {
+    const char * name;
+    unsigned x, y, w, h;
+    unsigned channel;
+} czspec_entry;
+
+typedef struct czspec_info {
+    unsigned count;
+    unsigned width, height;
+    int packed;
+} czspec_info;
+
+int czspec_write(FILE * out, czspec_entry * entries, unsigned count, unsigned width, unsigned height, int packed);
+
+int czspec_open(const void * data, size_t size, czspec_info * info);
+unsigned czspec_find(const void * data, const char * name);
+void czspec_entry_at(const void * data, unsigned index, czspec_entry * entry);
+unsigned czspec_name(const void * data, unsigned index, char * name, unsigned size);
+
+#endif
@@ -23,35 +23,137 @@ THE SOFTWARE.
 */
 
 #include "czsurface.h"
+#include "czquant.h"
+#include "czblit.h"
+#include "czalloc.h"
+#include "czthread.h"
 
+/* the codecs allocate through chizu_set_allocator too, and their buffers become surface pixels */
+#define STBIW_MALLOC(sz) czalloc_malloc(sz)
+#define STBIW_REALLOC(p, sz) czalloc_realloc(p, sz)
+#define STBIW_FREE(p) czalloc_free(p)
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#define STBI_MALLOC(sz) czalloc_malloc(sz)
+#define STBI_REALLOC(p, sz) czalloc_realloc(p, sz)
+#define STBI_FREE(p) czalloc_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define CZSURFACE_LINEAR_STEPS 4096
+#define CZSURFACE_GAMMA 2.2f
+
 struct czsurface {
     int width;
     int height;
+    int channels;
     int bpp;
+    czsurface_type type;
     unsigned char * pixels;
+    czsurface_release_func release; /* set when the pixels are not ours to free */
+    void * owner;
 };
 
+
 static czsurface * czsurface_internal_alloc();
 static void czsurface_internal_destroy(czsurface *);
 static void czsurface_internal_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where);
+static void czsurface_internal_convert_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where);
+static void czsurface_internal_init_gamma();
+static void czsurface_internal_build_gamma(void);
+static float czsurface_internal_scaled_coverage(czsurface * surface, czrect rect, float reference, float scale);
+static void czsurface_internal_resample_row(const float * src, int srcwidth, float * dst, int dstwidth, int channels);
+static void czsurface_internal_float_convert_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where);
+static void czsurface_internal_read_row(czsurface * surface, int x, int y, int count, float * out);
+static void czsurface_internal_write_row(czsurface * surface, int x, int y, int count, const float * in);
+static czsurface * czsurface_internal_convert(czsurface * surface, czsurface_type type);
+static unsigned short czsurface_internal_float_to_half(float f);
+static float czsurface_internal_half_to_float(unsigned short h);
+static unsigned czsurface_internal_type_size(czsurface_type type);
+static void czsurface_internal_write_u32(FILE * f, unsigned value);
+static void czsurface_internal_write_u64(FILE * f, unsigned long value);
+static void czsurface_internal_swizzle_row_rgba8(const unsigned char * src, unsigned char * dst, unsigned count, const unsigned * shifts);
+static czsurface_save_status czsurface_internal_save_indexed(czsurface * src, const char * dest, czsurface_save_format format);
+static int czsurface_internal_write_png_indexed(const unsigned char * indices, int width, int height, const unsigned char * palette, unsigned colors, const char * dest);
+static int czsurface_internal_write_png_chunk(FILE * f, const char * tag, const unsigned char * data, unsigned len);
+
+/* sRGB <-> linear tables used when downsampling color channels */
+static float czsurface_internal_to_linear[256];
+static unsigned char czsurface_internal_to_srgb[CZSURFACE_LINEAR_STEPS + 1];
+static czthread_once_flag czsurface_internal_gamma_once = CZTHREAD_ONCE_INIT;
+
+czsurface * czsurface_load(const char * file, unsigned channels, czsurface_type type) {
+    int filechannels = 0;
+    size_t i = 0, count = 0;
+    float * floats = NULL;
+    unsigned short * halves = NULL;
+    czsurface * r = NULL;
+    if (channels > 4)
+        return NULL;
+    r = czsurface_internal_alloc();
+    if (r == NULL)
+        return NULL;
+    r->type = type;
+
+    if (type == CZSURFACE_UINT8) {
+        r->pixels = stbi_load(file, &(r->width), &(r->height), &filechannels, (int) channels);
+    } else {
+        /* HDR files keep their range, LDR ones are linearized by stb_image */
+        floats = stbi_loadf(file, &(r->width), &(r->height), &filechannels, (int) channels);
+        if (floats != NULL && type == CZSURFACE_FLOAT16) {
+            count = (size_t) r->width * r->height * (channels != 0 ? channels : (unsigned) filechannels);
+            halves = czalloc_malloc(count * sizeof(unsigned short));
+            if (halves != NULL) {
+                for (i = 0; i < count; i++)
+                    halves[i] = czsurface_internal_float_to_half(floats[i]);
+            }
+            stbi_image_free(floats);
+            floats = NULL;
+            r->pixels = (unsigned char *) halves;
+        } else {
+            r->pixels = (unsigned char *) floats;
+        }
+    }
 
-czsurface * czsurface_load(const char * file) {
-    czsurface * r = czsurface_internal_alloc();
-    r->pixels = stbi_load(file, &(r->width), &(r->height), NULL, 4);
-    r->bpp = 4;
+    if (r->pixels == NULL) {
+        czsurface_internal_destroy(r);
+        return NULL;
+    }
+    r->channels = channels != 0 ? (int) channels : filechannels;
+    r->bpp = r->channels * (int) czsurface_internal_type_size(type);
     return r;
 }
 
+/* loads a single channel surface from the alpha of file or, if it has none, from its luminance */
+czsurface * czsurface_load_mask(const char * file) {
+    czsurface * r = czsurface_load(file, 0, CZSURFACE_UINT8);
+    czsurface * mask = NULL;
+    czpoint origin = { 0, 0 };
+    int i = 0;
+    if (r == NULL || r->channels == 1)
+        return r;
+
+    mask = czsurface_create((unsigned) r->width, (unsigned) r->height, 1, CZSURFACE_UINT8);
+    if (mask != NULL) {
+        if (r->channels == 2 || r->channels == 4) {
+            for (i = 0; i < r->width * r->height; i++)
+                mask->pixels[i] = r->pixels[i * r->bpp + r->channels - 1];
+        } else {
+            czsurface_blit(r, mask, origin);
+        }
+    }
+    czsurface_destroy(r);
+    return mask;
+}
+
 void czsurface_destroy(czsurface * surface) {
     if (surface == NULL)
         return;
-    free(surface->pixels);
+    if (surface->release != NULL)
+        surface->release(surface->owner);
+    else
+        czalloc_free(surface->pixels);
     czsurface_internal_destroy(surface);
 }
 
@@ -62,59 +164,900 @@ czsize czsurface_size(czsurface * surface) {
     return r;
 }
 
-czsurface * czsurface_create(unsigned width, unsigned height) {
-    czsurface * s = czsurface_internal_alloc();
-    s->pixels = calloc(height, width * 4);
+unsigned czsurface_channels(czsurface * surface) {
+    return (unsigned) surface->channels;
+}
+
+czsurface_type czsurface_pixel_type(czsurface * surface) {
+    return surface->type;
+}
+
+unsigned czsurface_bpp(czsurface * surface) {
+    return (unsigned) surface->bpp;
+}
+
+czsurface * czsurface_create(unsigned width, unsigned height, unsigned channels, czsurface_type type) {
+    czsurface * s = NULL;
+    unsigned bpp = channels * czsurface_internal_type_size(type);
+    if (channels == 0 || channels > 4 || bpp == 0)
+        return NULL;
+    s = czsurface_internal_alloc();
+    if (s == NULL)
+        return NULL;
+    s->pixels = czalloc_calloc(height, width * bpp);
+    if (s->pixels == NULL && width > 0 && height > 0) {
+        czsurface_internal_destroy(s);
+        return NULL;
+    }
+    s->width = width;
+    s->height = height;
+    s->channels = channels;
+    s->type = type;
+    s->bpp = bpp;
+    return s;
+}
+
+/*
+ * A surface over pixels allocated elsewhere (a mapped file, say), tightly
+ * packed. release(owner) is called instead of freeing them on destroy.
+ */
+czsurface * czsurface_wrap(void * pixels, unsigned width, unsigned height, unsigned channels, czsurface_type type, czsurface_release_func release, void * owner) {
+    czsurface * s = NULL;
+    unsigned bpp = channels * czsurface_internal_type_size(type);
+    if (pixels == NULL || channels == 0 || channels > 4 || bpp == 0)
+        return NULL;
+    s = czsurface_internal_alloc();
+    if (s == NULL)
+        return NULL;
+    s->pixels = pixels;
     s->width = width;
     s->height = height;
-    s->bpp = 4;
+    s->channels = channels;
+    s->type = type;
+    s->bpp = bpp;
+    s->release = release;
+    s->owner = owner;
     return s;
 }
 
+/*
+ * Copies area of surface to a new surface. With channel >= 0 only that
+ * channel of an 8 bit surface is copied, into a single channel surface.
+ */
+czsurface * czsurface_crop(czsurface * surface, czrect area, int channel) {
+    czsurface * result = NULL;
+    const unsigned char * src = NULL;
+    unsigned char * dst = NULL;
+    unsigned x = 0, y = 0;
+    if (area.x + area.w > (unsigned) surface->width || area.y + area.h > (unsigned) surface->height)
+        return NULL;
+    if (channel < 0) {
+        result = czsurface_create(area.w, area.h, surface->channels, surface->type);
+        if (result != NULL)
+            czsurface_read_swizzled(surface, area, result->pixels, area.w * surface->bpp, NULL);
+        return result;
+    }
+
+    if (channel >= surface->channels || surface->type != CZSURFACE_UINT8)
+        return NULL;
+    result = czsurface_create(area.w, area.h, 1, CZSURFACE_UINT8);
+    if (result == NULL)
+        return NULL;
+    dst = result->pixels;
+    for (y = 0; y < area.h; y++) {
+        src = surface->pixels + ((size_t) (area.y + y) * surface->width + area.x) * surface->bpp + channel;
+        for (x = 0; x < area.w; x++)
+            *dst++ = src[x * surface->bpp];
+    }
+    return result;
+}
+
 czsurface_blit_status czsurface_blit(czsurface * src, czsurface * dst, czpoint dstpoint) {
-    czsurface_internal_blit(src, dst, dstpoint);
+    if (src->channels == dst->channels && src->type == dst->type)
+        czsurface_internal_blit(src, dst, dstpoint);
+    else if (src->type == CZSURFACE_UINT8 && dst->type == CZSURFACE_UINT8)
+        czsurface_internal_convert_blit(src, dst, dstpoint);
+    else
+        czsurface_internal_float_convert_blit(src, dst, dstpoint);
+    return CZSURFACE_BLIT_OK;
+}
+
+/* copies the single channel src into one channel of dst, leaving the others untouched */
+czsurface_blit_status czsurface_blit_channel(czsurface * src, czsurface * dst, czpoint dstpoint, unsigned channel) {
+    const unsigned char * s = src->pixels;
+    unsigned char * d = dst->pixels + ((dstpoint.y * dst->width + dstpoint.x) * dst->bpp) + channel;
+    int i = 0, j = 0;
+    if (src->channels != 1 || channel >= (unsigned) dst->channels)
+        return CZSURFACE_BLIT_FAIL;
+    if (src->type != CZSURFACE_UINT8 || dst->type != CZSURFACE_UINT8)
+        return CZSURFACE_BLIT_FAIL;
+
+    for (i = 0; i < src->height; i++) {
+        for (j = 0; j < src->width; j++)
+            d[j * dst->bpp] = s[j];
+        s += src->width;
+        d += dst->width * dst->bpp;
+    }
     return CZSURFACE_BLIT_OK;
 }
 
 czsurface_save_status czsurface_save(czsurface * src, const char * dest, czsurface_save_format format) {
     int status = 0;
+    int comp = src->channels;
+    czsurface * converted = NULL;
     void * pixels = src->pixels;
+
+    if (format == CZSURFACE_FORMAT_KTX2)
+        return czsurface_save_ktx2(&src, 1, dest, 0);
+    if (format == CZSURFACE_FORMAT_PNG_INDEXED || format == CZSURFACE_FORMAT_INDEXED)
+        return czsurface_internal_save_indexed(src, dest, format);
+
+    /* radiance files take floats, everything else 8 bit values */
+    if (format == CZSURFACE_FORMAT_HDR && src->type != CZSURFACE_FLOAT32)
+        converted = czsurface_internal_convert(src, CZSURFACE_FLOAT32);
+    else if (format != CZSURFACE_FORMAT_HDR && src->type != CZSURFACE_UINT8)
+        converted = czsurface_internal_convert(src, CZSURFACE_UINT8);
+    if (converted != NULL)
+        pixels = converted->pixels;
+    else if (src->type != (format == CZSURFACE_FORMAT_HDR ? CZSURFACE_FLOAT32 : CZSURFACE_UINT8))
+        return CZSURFACE_SAVE_FAIL;
+
     switch (format) {
-        case CZSURFACE_FORMAT_PNG: status = stbi_write_png(dest, src->width, src->height, 4, pixels, src->width * 4); break;
-        case CZSURFACE_FORMAT_BMP: status = stbi_write_bmp(dest, src->width, src->height, 4, pixels); break;
-        case CZSURFACE_FORMAT_TGA: status = stbi_write_tga(dest, src->width, src->height, 4, pixels); break;
-        case CZSURFACE_FORMAT_HDR: status = stbi_write_hdr(dest, src->width, src->height, 4, pixels); break;
+        case CZSURFACE_FORMAT_PNG: status = stbi_write_png(dest, src->width, src->height, comp, pixels, src->width * comp); break;
+        case CZSURFACE_FORMAT_BMP: status = stbi_write_bmp(dest, src->width, src->height, comp, pixels); break;
+        case CZSURFACE_FORMAT_TGA: status = stbi_write_tga(dest, src->width, src->height, comp, pixels); break;
+        case CZSURFACE_FORMAT_HDR: status = stbi_write_hdr(dest, src->width, src->height, comp, (const float *) pixels); break;
+        default: break;
     }
+    czsurface_destroy(converted);
 
-    if (status > 0) {
+    /* stbi_write_* returns 0 on failure */
+    if (status == 0) {
         return CZSURFACE_SAVE_FAIL;
     }
     return CZSURFACE_SAVE_OK;
 }
 
+/*
+ * Copies area of surface to dst, whose rows are pitch bytes apart. Channel i
+ * of each destination pixel is channel swizzle[i] of the source pixel, or
+ * the same channel if swizzle is NULL. area must be inside the surface.
+ */
+void czsurface_read_swizzled(czsurface * surface, czrect area, void * dst, unsigned pitch, const unsigned char * swizzle) {
+    unsigned typesize = czsurface_internal_type_size(surface->type);
+    size_t srcpitch = (size_t) surface->width * surface->bpp, rowsize = (size_t) area.w * surface->bpp;
+    const unsigned char * src = surface->pixels + area.y * srcpitch + (size_t) area.x * surface->bpp;
+    unsigned char * out = (unsigned char *) dst;
+    unsigned shifts[8], identity = 1, c = 0, x = 0, y = 0, t = 0;
+    unsigned endian = 1;
+    int little = *(unsigned char *) &endian == 1;
+
+    for (c = 0; swizzle != NULL && c < (unsigned) surface->channels; c++)
+        if (swizzle[c] != c)
+            identity = 0;
+
+    if (identity) {
+        czblit_rows(src, srcpitch, out, pitch, rowsize, area.h, 0);
+        return;
+    }
+
+    if (surface->bpp == 4 && typesize == 1) {
+        /* whole pixels are shuffled with shifts, which vectorizes well */
+        for (c = 0; c < 4; c++) {
+            shifts[c] = 8 * (little ? swizzle[c] : 3 - swizzle[c]);
+            shifts[4 + c] = 8 * (little ? c : 3 - c);
+        }
+        for (y = 0; y < area.h; y++)
+            czsurface_internal_swizzle_row_rgba8(src + y * srcpitch, out + (size_t) y * pitch, area.w, shifts);
+        return;
+    }
+
+    for (y = 0; y < area.h; y++) {
+        const unsigned char * s = src + y * srcpitch;
+        unsigned char * d = out + (size_t) y * pitch;
+        for (x = 0; x < area.w; x++, s += surface->bpp, d += surface->bpp)
+            for (c = 0; c < (unsigned) surface->channels; c++)
+                for (t = 0; t < typesize; t++)
+                    d[c * typesize + t] = s[swizzle[c] * typesize + t];
+    }
+}
+
+/*
+ * Writes levels (a full size surface followed by its mip levels, all with
+ * the same format) as an uncompressed KTX2 texture. 8 bit surfaces with
+ * color are flagged as sRGB if srgb is set.
+ */
+czsurface_save_status czsurface_save_ktx2(czsurface ** levels, unsigned count, const char * dest, int srgb) {
+    static const unsigned char identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    static const unsigned formats[3][4] = {
+        { 9, 16, 23, 37 },      /* VK_FORMAT_R8_UNORM ... VK_FORMAT_R8G8B8A8_UNORM */
+        { 76, 83, 90, 97 },     /* VK_FORMAT_R16_SFLOAT ... VK_FORMAT_R16G16B16A16_SFLOAT */
+        { 100, 103, 106, 109 }  /* VK_FORMAT_R32_SFLOAT ... VK_FORMAT_R32G32B32A32_SFLOAT */
+    };
+    static const unsigned srgbformats[4] = { 15, 22, 29, 43 }; /* VK_FORMAT_R8_SRGB ... VK_FORMAT_R8G8B8A8_SRGB */
+    static const unsigned channelids[4][4] = { { 0 }, { 0, 1 }, { 0, 1, 2 }, { 0, 1, 2, 15 } };
+    czsurface * base = levels[0];
+    unsigned c = (unsigned) base->channels, typesize = czsurface_internal_type_size(base->type);
+    unsigned dfdsize = 4 + 24 + 16 * c, i = 0, vkformat = 0;
+    unsigned long offset = 0, align = (unsigned long) base->bpp;
+    unsigned long * offsets = NULL;
+    unsigned char zeros[16] = { 0 };
+    int flagsrgb = srgb && base->type == CZSURFACE_UINT8 && c >= 3;
+    FILE * f = NULL;
+    czsurface_save_status status = CZSURFACE_SAVE_OK;
+
+    if (count == 0 || count > 32)
+        return CZSURFACE_SAVE_FAIL;
+    vkformat = flagsrgb ? srgbformats[c - 1] : formats[base->type][c - 1];
+
+    /* level data is aligned to lcm(texel size, 4) and stored smallest level first */
+    while (align % 4 != 0) align *= 2;
+    offsets = czalloc_calloc(count, sizeof(unsigned long));
+    if (offsets == NULL)
+        return CZSURFACE_SAVE_FAIL;
+    offset = 80 + 24 * count + dfdsize;
+    for (i = count; i-- > 0;) {
+        offset = (offset + align - 1) / align * align;
+        offsets[i] = offset;
+        offset += (unsigned long) levels[i]->width * levels[i]->height * levels[i]->bpp;
+    }
+
+    f = fopen(dest, "wb");
+    if (f == NULL) {
+        czalloc_free(offsets);
+        return CZSURFACE_SAVE_OPEN_FAIL;
+    }
+
+    /* header and index */
+    fwrite(identifier, 1, sizeof(identifier), f);
+    czsurface_internal_write_u32(f, vkformat);
+    czsurface_internal_write_u32(f, typesize);
+    czsurface_internal_write_u32(f, (unsigned) base->width);
+    czsurface_internal_write_u32(f, (unsigned) base->height);
+    czsurface_internal_write_u32(f, 0); /* pixelDepth */
+    czsurface_internal_write_u32(f, 0); /* layerCount */
+    czsurface_internal_write_u32(f, 1); /* faceCount */
+    czsurface_internal_write_u32(f, count);
+    czsurface_internal_write_u32(f, 0); /* supercompressionScheme */
+    czsurface_internal_write_u32(f, 80 + 24 * count);
+    czsurface_internal_write_u32(f, dfdsize);
+    czsurface_internal_write_u32(f, 0); /* kvdByteOffset */
+    czsurface_internal_write_u32(f, 0); /* kvdByteLength */
+    czsurface_internal_write_u64(f, 0); /* sgdByteOffset */
+    czsurface_internal_write_u64(f, 0); /* sgdByteLength */
+    for (i = 0; i < count; i++) {
+        unsigned long length = (unsigned long) levels[i]->width * levels[i]->height * levels[i]->bpp;
+        czsurface_internal_write_u64(f, offsets[i]);
+        czsurface_internal_write_u64(f, length);
+        czsurface_internal_write_u64(f, length);
+    }
+
+    /* basic data format descriptor */
+    czsurface_internal_write_u32(f, dfdsize);
+    czsurface_internal_write_u32(f, 0); /* vendorId, descriptorType */
+    czsurface_internal_write_u32(f, 2 | ((24 + 16 * c) << 16)); /* versionNumber, descriptorBlockSize */
+    czsurface_internal_write_u32(f, 1 | (1 << 8) | ((flagsrgb ? 2u : 1u) << 16)); /* RGBSDA, BT709, transfer */
+    czsurface_internal_write_u32(f, 0); /* texelBlockDimension */
+    czsurface_internal_write_u32(f, (unsigned) base->bpp); /* bytesPlane0 */
+    czsurface_internal_write_u32(f, 0);
+    for (i = 0; i < c; i++) {
+        unsigned qualifiers = base->type == CZSURFACE_UINT8 ? 0 : 0x80 | 0x40;
+        if (flagsrgb && channelids[c - 1][i] == 15)
+            qualifiers |= 0x10; /* alpha stays linear */
+        czsurface_internal_write_u32(f, (i * typesize * 8) | ((typesize * 8 - 1) << 16) | ((channelids[c - 1][i] | qualifiers) << 24));
+        czsurface_internal_write_u32(f, 0); /* samplePosition */
+        czsurface_internal_write_u32(f, base->type == CZSURFACE_UINT8 ? 0 : 0xBF800000u);
+        czsurface_internal_write_u32(f, base->type == CZSURFACE_UINT8 ? 255 : 0x3F800000u);
+    }
+
+    /* levels */
+    offset = 80 + 24 * count + dfdsize;
+    for (i = count; i-- > 0;) {
+        size_t length = (size_t) levels[i]->width * levels[i]->height * levels[i]->bpp;
+        fwrite(zeros, 1, offsets[i] - offset, f);
+        if (fwrite(levels[i]->pixels, 1, length, f) != length)
+            status = CZSURFACE_SAVE_FAIL;
+        offset = offsets[i] + length;
+    }
+
+    if (fclose(f) != 0)
+        status = CZSURFACE_SAVE_FAIL;
+    czalloc_free(offsets);
+    return status;
+}
+
 void * czsurface_pixels(czsurface * surface) {
     return surface->pixels;
 }
 
+/*
+ * Creates a surface of half the size of surface (rounded up), each pixel the
+ * average of a 2x2 block. If srgb is set, RGB channels are averaged in linear
+ * space. Alpha and the channels of L/LA surfaces (masks and distance fields)
+ * are always averaged as they are.
+ */
+czsurface * czsurface_downsample(czsurface * surface, int srgb) {
+    unsigned w = surface->width > 1 ? (unsigned) (surface->width + 1) / 2 : 1;
+    unsigned h = surface->height > 1 ? (unsigned) (surface->height + 1) / 2 : 1;
+    int c = surface->channels, gammachannels = (srgb && c >= 3) ? 3 : 0;
+    int x = 0, y = 0, k = 0;
+    float * rows = NULL, * bottomrow = NULL;
+    czsurface * result = czsurface_create(w, h, (unsigned) c, surface->type);
+    if (result == NULL)
+        return NULL;
+
+    czsurface_internal_init_gamma();
+    rows = czalloc_malloc(sizeof(float) * surface->width * c * 2);
+    if (rows == NULL) {
+        czsurface_destroy(result);
+        return NULL;
+    }
+
+    /* float surfaces are linear already */
+    if (surface->type != CZSURFACE_UINT8) {
+        bottomrow = rows + surface->width * c;
+        for (y = 0; y < (int) h; y++) {
+            czsurface_internal_read_row(surface, 0, 2 * y, surface->width, rows);
+            czsurface_internal_read_row(surface, 0, 2 * y + 1 < surface->height ? 2 * y + 1 : 2 * y, surface->width, bottomrow);
+            for (k = 0; k < surface->width * c; k++)
+                rows[k] += bottomrow[k];
+            for (x = 0; x < (int) w; x++) {
+                int x0 = 2 * x, x1 = 2 * x + 1 < surface->width ? 2 * x + 1 : 2 * x;
+                for (k = 0; k < c; k++)
+                    bottomrow[x * c + k] = (rows[x0 * c + k] + rows[x1 * c + k]) * 0.25f;
+            }
+            czsurface_internal_write_row(result, 0, y, (int) w, bottomrow);
+        }
+        czalloc_free(rows);
+        return result;
+    }
+
+    for (y = 0; y < (int) h; y++) {
+        const unsigned char * top = surface->pixels + (2 * y) * surface->width * c;
+        const unsigned char * bottom = 2 * y + 1 < surface->height ? top + surface->width * c : top;
+        unsigned char * out = result->pixels + y * w * c;
+        int n = surface->width * c;
+
+        /* vertical pass into floats, in a form the compiler can vectorize */
+        for (k = 0; k < n; k++) {
+            if (k % c < gammachannels)
+                rows[k] = czsurface_internal_to_linear[top[k]] + czsurface_internal_to_linear[bottom[k]];
+            else
+                rows[k] = (top[k] + bottom[k]) * (1.0f / 255.0f);
+        }
+
+        /* horizontal pass and back to 8 bits */
+        for (x = 0; x < (int) w; x++) {
+            int x0 = 2 * x, x1 = 2 * x + 1 < surface->width ? 2 * x + 1 : 2 * x;
+            for (k = 0; k < c; k++) {
+                float v = (rows[x0 * c + k] + rows[x1 * c + k]) * 0.25f;
+                if (k < gammachannels)
+                    out[x * c + k] = czsurface_internal_to_srgb[(int) (v * CZSURFACE_LINEAR_STEPS + 0.5f)];
+                else
+                    out[x * c + k] = (unsigned char) (v * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    czalloc_free(rows);
+    return result;
+}
+
+/*
+ * Resamples surface to width x height with a separable area filter: each
+ * output pixel is the average of the source area it covers. Colors are
+ * weighted by alpha so transparent pixels do not bleed into the edges.
+ */
+czsurface * czsurface_resize(czsurface * surface, unsigned width, unsigned height) {
+    int c = surface->channels, alpha = (c == 2 || c == 4) ? c - 1 : -1;
+    int sw = surface->width, sh = surface->height;
+    int x = 0, y = 0, k = 0;
+    float * premultiplied = NULL, * columns = NULL, * acc = NULL;
+    czsurface * result = NULL;
+    if (width == 0 || height == 0)
+        return NULL;
+
+    result = czsurface_create(width, height, (unsigned) c, surface->type);
+    premultiplied = czalloc_malloc(sizeof(float) * sw * c);
+    columns = czalloc_malloc(sizeof(float) * sh * width * c);
+    acc = czalloc_malloc(sizeof(float) * width * c);
+    if (result == NULL || premultiplied == NULL || columns == NULL || acc == NULL) {
+        czsurface_destroy(result);
+        result = NULL;
+        goto cleanup;
+    }
+
+    /* horizontal pass, one source row at a time */
+    for (y = 0; y < sh; y++) {
+        czsurface_internal_read_row(surface, 0, y, sw, premultiplied);
+        if (alpha >= 0) {
+            for (x = 0; x < sw; x++) {
+                float a = premultiplied[x * c + alpha];
+                for (k = 0; k < c; k++)
+                    if (k != alpha) premultiplied[x * c + k] *= a;
+            }
+        }
+        czsurface_internal_resample_row(premultiplied, sw, columns + y * width * c, (int) width, c);
+    }
+
+    /* vertical pass, accumulating whole rows so the inner loop is contiguous */
+    for (y = 0; y < (int) height; y++) {
+        float start = (float) y * sh / height, end = (float) (y + 1) * sh / height;
+        int first = (int) start, last = (int) end;
+        int n = (int) width * c;
+        if (last >= sh) last = sh - 1;
+        for (k = 0; k < n; k++)
+            acc[k] = 0;
+        for (x = first; x <= last; x++) {
+            float lo = x > start ? (float) x : start, hi = x + 1 < end ? (float) (x + 1) : end;
+            float weight = (hi - lo) / (end - start);
+            const float * src = columns + x * n;
+            if (weight <= 0)
+                continue;
+            for (k = 0; k < n; k++)
+                acc[k] += src[k] * weight;
+        }
+        if (alpha >= 0) {
+            for (x = 0; x < (int) width; x++) {
+                float a = acc[x * c + alpha];
+                for (k = 0; k < c; k++)
+                    if (k != alpha) acc[x * c + k] = a > 0 ? acc[x * c + k] / a : 0;
+            }
+        }
+        czsurface_internal_write_row(result, 0, y, (int) width, acc);
+    }
+
+cleanup:
+    czalloc_free(premultiplied);
+    czalloc_free(columns);
+    czalloc_free(acc);
+    return result;
+}
+
+/* fraction of pixels inside rect whose alpha is at least reference */
+float czsurface_coverage(czsurface * surface, czrect rect, float reference) {
+    return czsurface_internal_scaled_coverage(surface, rect, reference, 1.0f);
+}
+
+/*
+ * Scales the alpha of the pixels inside rect so that their coverage for
+ * reference gets as close as possible to coverage. Used to keep alpha tested
+ * sprites from thinning out in smaller mip levels.
+ */
+void czsurface_fit_coverage(czsurface * surface, czrect rect, float reference, float coverage) {
+    float low = 0, high = 4, scale = 1;
+    int i = 0;
+    unsigned x = 0, y = 0;
+    int a = surface->channels - 1;
+    if ((surface->channels != 2 && surface->channels != 4) || surface->type != CZSURFACE_UINT8)
+        return;
+
+    for (i = 0; i < 10; i++) {
+        scale = (low + high) * 0.5f;
+        if (czsurface_internal_scaled_coverage(surface, rect, reference, scale) > coverage)
+            high = scale;
+        else
+            low = scale;
+    }
+
+    for (y = rect.y; y < rect.y + rect.h; y++) {
+        unsigned char * p = surface->pixels + (y * surface->width + rect.x) * surface->bpp;
+        for (x = 0; x < rect.w; x++, p += surface->bpp) {
+            float v = p[a] * scale;
+            p[a] = (unsigned char) (v > 255 ? 255 : v + 0.5f);
+        }
+    }
+}
+
 /* internal stuff */
 static czsurface * czsurface_internal_alloc() {
-    czsurface * cz = calloc(sizeof(czsurface), 1);
+    czsurface * cz = czalloc_calloc(sizeof(czsurface), 1);
     return cz;
 }
 
 static void czsurface_internal_destroy(czsurface * surface) {
-    free(surface);
+    czalloc_free(surface);
 }
 
 static void czsurface_internal_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where) {
     unsigned char * src = srcsurface->pixels;
     unsigned char * dst = dstsurface->pixels + ((where.y * dstsurface->width + where.x) * dstsurface->bpp);
-    unsigned i = 0;
+    size_t srcpitch = (size_t) srcsurface->width * srcsurface->bpp;
+    size_t dstpitch = (size_t) dstsurface->width * dstsurface->bpp;
+    int stream = dstpitch * dstsurface->height >= czblit_stream_bytes();
+    czblit_rows(src, srcpitch, dst, dstpitch, srcpitch, srcsurface->height, stream);
+}
+
+/* Converts between channel counts following stb_image rules: gray expands to
+ * rgb, missing alpha becomes opaque and rgb collapses to its luminance. */
+static void czsurface_internal_convert_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where) {
+    unsigned char * src = srcsurface->pixels;
+    unsigned char * dst = dstsurface->pixels + ((where.y * dstsurface->width + where.x) * dstsurface->bpp);
     int srcpitch = srcsurface->width * srcsurface->bpp;
     int dstpitch = dstsurface->width * dstsurface->bpp;
+    int sc = srcsurface->channels, dc = dstsurface->channels;
+    int i = 0, j = 0;
     for (i = 0; i < srcsurface->height; i++) {
-        memcpy(dst, src, (unsigned) dstsurface->bpp * srcsurface->width);
+        const unsigned char * s = src;
+        unsigned char * d = dst;
+        for (j = 0; j < srcsurface->width; j++, s += sc, d += dc) {
+            unsigned char r, g, b, a = 255;
+            if (sc < 3) {
+                r = g = b = s[0];
+                if (sc == 2) a = s[1];
+            } else {
+                r = s[0]; g = s[1]; b = s[2];
+                if (sc == 4) a = s[3];
+            }
+            if (dc < 3) {
+                d[0] = sc < 3 ? r : (unsigned char) ((r * 77 + g * 150 + b * 29) >> 8);
+                if (dc == 2) d[1] = a;
+            } else {
+                d[0] = r; d[1] = g; d[2] = b;
+                if (dc == 4) d[3] = a;
+            }
+        }
         dst += dstpitch;
         src += srcpitch;
     }
 }
+
+/* builds the tables once, safe to call from any thread */
+static void czsurface_internal_init_gamma() {
+    czthread_once(&czsurface_internal_gamma_once, czsurface_internal_build_gamma);
+}
+
+static void czsurface_internal_build_gamma(void) {
+    int i = 0;
+    for (i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        czsurface_internal_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (i = 0; i <= CZSURFACE_LINEAR_STEPS; i++) {
+        float l = (float) i / CZSURFACE_LINEAR_STEPS;
+        float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        czsurface_internal_to_srgb[i] = (unsigned char) (c * 255.0f + 0.5f);
+    }
+}
+
+static float czsurface_internal_scaled_coverage(czsurface * surface, czrect rect, float reference, float scale) {
+    unsigned x = 0, y = 0, covered = 0;
+    int a = surface->channels - 1;
+    float threshold = reference * 255.0f / scale;
+    if ((surface->channels != 2 && surface->channels != 4) || surface->type != CZSURFACE_UINT8)
+        return 1.0f;
+    if (rect.w == 0 || rect.h == 0)
+        return 0.0f;
+
+    for (y = rect.y; y < rect.y + rect.h; y++) {
+        const unsigned char * p = surface->pixels + (y * surface->width + rect.x) * surface->bpp;
+        for (x = 0; x < rect.w; x++, p += surface->bpp)
+            covered += p[a] >= threshold;
+    }
+    return (float) covered / (rect.w * rect.h);
+}
+
+/* area resampling of a row of interleaved float pixels */
+static void czsurface_internal_resample_row(const float * src, int srcwidth, float * dst, int dstwidth, int channels) {
+    int x = 0, i = 0, k = 0;
+    for (x = 0; x < dstwidth; x++) {
+        float start = (float) x * srcwidth / dstwidth, end = (float) (x + 1) * srcwidth / dstwidth;
+        int first = (int) start, last = (int) end;
+        float * out = dst + x * channels;
+        if (last >= srcwidth) last = srcwidth - 1;
+        for (k = 0; k < channels; k++)
+            out[k] = 0;
+        for (i = first; i <= last; i++) {
+            float lo = i > start ? (float) i : start, hi = i + 1 < end ? (float) (i + 1) : end;
+            float weight = (hi - lo) / (end - start);
+            if (weight <= 0)
+                continue;
+            for (k = 0; k < channels; k++)
+                out[k] += src[i * channels + k] * weight;
+        }
+    }
+}
+
+/*
+ * Converts pixels of any format and channel count: gray expands to rgb,
+ * missing alpha becomes opaque and rgb collapses to its luminance, while
+ * color moves between gamma encoded 8 bit and linear float.
+ */
+static void czsurface_internal_float_convert_blit(czsurface * srcsurface, czsurface * dstsurface, czpoint where) {
+    int sc = srcsurface->channels, dc = dstsurface->channels;
+    int tolinear = srcsurface->type == CZSURFACE_UINT8 && dstsurface->type != CZSURFACE_UINT8;
+    int togamma = srcsurface->type != CZSURFACE_UINT8 && dstsurface->type == CZSURFACE_UINT8;
+    int y = 0, x = 0, k = 0;
+    float * in = czalloc_malloc(sizeof(float) * srcsurface->width * 4 * 2);
+    float * out = in + srcsurface->width * 4;
+    if (in == NULL)
+        return;
+
+    for (y = 0; y < srcsurface->height; y++) {
+        czsurface_internal_read_row(srcsurface, 0, y, srcsurface->width, in);
+        for (x = 0; x < srcsurface->width; x++) {
+            const float * s = in + x * sc;
+            float * d = out + x * dc;
+            float rgba[4];
+            rgba[3] = 1.0f;
+            if (sc < 3) {
+                rgba[0] = rgba[1] = rgba[2] = s[0];
+                if (sc == 2) rgba[3] = s[1];
+            } else {
+                rgba[0] = s[0]; rgba[1] = s[1]; rgba[2] = s[2];
+                if (sc == 4) rgba[3] = s[3];
+            }
+            for (k = 0; k < 3; k++) {
+                if (tolinear) rgba[k] = powf(rgba[k], CZSURFACE_GAMMA);
+                if (togamma) rgba[k] = powf(rgba[k] > 0 ? rgba[k] : 0, 1.0f / CZSURFACE_GAMMA);
+            }
+            if (dc < 3) {
+                d[0] = sc < 3 ? rgba[0] : (rgba[0] * 77 + rgba[1] * 150 + rgba[2] * 29) / 256.0f;
+                if (dc == 2) d[1] = rgba[3];
+            } else {
+                d[0] = rgba[0]; d[1] = rgba[1]; d[2] = rgba[2];
+                if (dc == 4) d[3] = rgba[3];
+            }
+        }
+        czsurface_internal_write_row(dstsurface, (int) where.x, (int) where.y + y, srcsurface->width, out);
+    }
+    czalloc_free(in);
+}
+
+/* reads count pixels as floats, 8 bit values normalized to 0..1 */
+static void czsurface_internal_read_row(czsurface * surface, int x, int y, int count, float * out) {
+    int n = count * surface->channels, i = 0;
+    size_t start = ((size_t) y * surface->width + x) * surface->channels;
+    switch (surface->type) {
+        case CZSURFACE_UINT8: {
+            const unsigned char * p = surface->pixels + start;
+            for (i = 0; i < n; i++) out[i] = p[i] * (1.0f / 255.0f);
+            break;
+        }
+        case CZSURFACE_FLOAT16: {
+            const unsigned short * p = (const unsigned short *) surface->pixels + start;
+            for (i = 0; i < n; i++) out[i] = czsurface_internal_half_to_float(p[i]);
+            break;
+        }
+        case CZSURFACE_FLOAT32:
+            memcpy(out, (const float *) surface->pixels + start, sizeof(float) * n);
+            break;
+    }
+}
+
+/* writes count pixels from floats, clamping 8 bit values */
+static void czsurface_internal_write_row(czsurface * surface, int x, int y, int count, const float * in) {
+    int n = count * surface->channels, i = 0;
+    size_t start = ((size_t) y * surface->width + x) * surface->channels;
+    switch (surface->type) {
+        case CZSURFACE_UINT8: {
+            unsigned char * p = surface->pixels + start;
+            for (i = 0; i < n; i++) {
+                float v = in[i] * 255.0f + 0.5f;
+                p[i] = (unsigned char) (v > 255 ? 255 : (v < 0 ? 0 : v));
+            }
+            break;
+        }
+        case CZSURFACE_FLOAT16: {
+            unsigned short * p = (unsigned short *) surface->pixels + start;
+            for (i = 0; i < n; i++) p[i] = czsurface_internal_float_to_half(in[i]);
+            break;
+        }
+        case CZSURFACE_FLOAT32:
+            memcpy((float *) surface->pixels + start, in, sizeof(float) * n);
+            break;
+    }
+}
+
+static czsurface * czsurface_internal_convert(czsurface * surface, czsurface_type type) {
+    czpoint origin = { 0, 0 };
+    czsurface * result = czsurface_create((unsigned) surface->width, (unsigned) surface->height, (unsigned) surface->channels, type);
+    if (result != NULL)
+        czsurface_blit(surface, result, origin);
+    return result;
+}
+
+/* IEEE 754 binary16 conversions, rounding to nearest even */
+static unsigned short czsurface_internal_float_to_half(float f) {
+    union { float f; unsigned u; } v;
+    unsigned sign = 0, exponent = 0, mantissa = 0;
+    v.f = f;
+    sign = (v.u >> 16) & 0x8000u;
+    exponent = (v.u >> 23) & 0xFFu;
+    mantissa = v.u & 0x7FFFFFu;
+
+    if (exponent == 0xFF) /* inf and nan */
+        return (unsigned short) (sign | 0x7C00u | (mantissa ? 0x200u : 0));
+    if (exponent > 142) /* overflows to inf */
+        return (unsigned short) (sign | 0x7C00u);
+    if (exponent < 113) { /* subnormal or zero */
+        unsigned shift = 0;
+        if (exponent < 102)
+            return (unsigned short) sign;
+        mantissa |= 0x800000u;
+        shift = 126 - exponent;
+        exponent = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u && ((mantissa & ((1u << (shift - 1)) - 1)) || (exponent & 1u)))
+            exponent++;
+        return (unsigned short) (sign | exponent);
+    }
+
+    v.u = ((exponent - 112) << 10) | (mantissa >> 13);
+    if ((mantissa & 0x1000u) && ((mantissa & 0x2FFFu) != 0))
+        v.u++; /* may carry into the exponent, which correctly rounds up to inf */
+    return (unsigned short) (sign | v.u);
+}
+
+static float czsurface_internal_half_to_float(unsigned short h) {
+    union { float f; unsigned u; } v;
+    unsigned sign = (unsigned) (h & 0x8000u) << 16;
+    unsigned exponent = (h >> 10) & 0x1Fu;
+    unsigned mantissa = h & 0x3FFu;
+
+    if (exponent == 0x1F) {
+        v.u = sign | 0x7F800000u | (mantissa << 13);
+    } else if (exponent != 0) {
+        v.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa != 0) {
+        v.f = mantissa * (1.0f / 16777216.0f); /* 2^-24 */
+        v.u |= sign;
+    } else {
+        v.u = sign;
+    }
+    return v.f;
+}
+
+static unsigned czsurface_internal_type_size(czsurface_type type) {
+    switch (type) {
+        case CZSURFACE_UINT8: return 1;
+        case CZSURFACE_FLOAT16: return 2;
+        case CZSURFACE_FLOAT32: return 4;
+    }
+    return 0;
+}
+
+static void czsurface_internal_write_u32(FILE * f, unsigned value) {
+    unsigned char b[4];
+    b[0] = (unsigned char) value;
+    b[1] = (unsigned char) (value >> 8);
+    b[2] = (unsigned char) (value >> 16);
+    b[3] = (unsigned char) (value >> 24);
+    fwrite(b, 1, 4, f);
+}
+
+static void czsurface_internal_write_u64(FILE * f, unsigned long value) {
+    czsurface_internal_write_u32(f, (unsigned) (value & 0xFFFFFFFFu));
+    czsurface_internal_write_u32(f, (unsigned) ((unsigned long long) value >> 32));
+}
+
+/*
+ * Quantizes src to at most 256 colors. PNG_INDEXED writes a paletted png,
+ * INDEXED writes one index byte per pixel to dest and the RGBA palette
+ * entries to dest.pal.
+ */
+static czsurface_save_status czsurface_internal_save_indexed(czsurface * src, const char * dest, czsurface_save_format format) {
+    unsigned char palette[CZQUANT_MAX_COLORS * 4];
+    unsigned colors = 0;
+    unsigned char * indices = NULL;
+    czsurface * rgba = czsurface_create(src->width, src->height, 4, CZSURFACE_UINT8);
+    czpoint origin = { 0, 0 };
+    size_t count = (size_t) src->width * src->height;
+    int status = 0;
+
+    if (rgba == NULL)
+        return CZSURFACE_SAVE_FAIL;
+    czsurface_blit(src, rgba, origin);
+    indices = czquant_quantize(rgba->pixels, count, palette, &colors);
+    czsurface_destroy(rgba);
+    if (indices == NULL)
+        return CZSURFACE_SAVE_FAIL;
+
+    if (format == CZSURFACE_FORMAT_PNG_INDEXED) {
+        status = czsurface_internal_write_png_indexed(indices, src->width, src->height, palette, colors, dest);
+    } else {
+        size_t len = strlen(dest);
+        char * palfile = czalloc_malloc(len + 5);
+        FILE * f = fopen(dest, "wb");
+        if (f != NULL) {
+            status = fwrite(indices, 1, count, f) == count;
+            status = fclose(f) == 0 && status;
+        }
+        if (palfile != NULL && status) {
+            memcpy(palfile, dest, len);
+            memcpy(palfile + len, ".pal", 5);
+            f = fopen(palfile, "wb");
+            status = f != NULL && fwrite(palette, 4, colors, f) == colors;
+            if (f != NULL)
+                status = fclose(f) == 0 && status;
+        } else {
+            status = 0;
+        }
+        czalloc_free(palfile);
+    }
+    czalloc_free(indices);
+
+    if (status == 0)
+        return CZSURFACE_SAVE_FAIL;
+    return CZSURFACE_SAVE_OK;
+}
+
+/* 8 bit color type 3 png, with a tRNS chunk if any entry is not opaque */
+static int czsurface_internal_write_png_indexed(const unsigned char * indices, int width, int height, const unsigned char * palette, unsigned colors, const char * dest) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char header[13] = { 0 }, rgb[CZQUANT_MAX_COLORS * 3], alpha[CZQUANT_MAX_COLORS];
+    unsigned char * filtered = czalloc_malloc((size_t) (width + 1) * height);
+    unsigned char * zlib = NULL;
+    unsigned i = 0, alphas = 0;
+    int y = 0, zlen = 0, status = 0;
+    FILE * f = NULL;
+
+    if (filtered == NULL)
+        return 0;
+    /* filter type none: each index row is already as small as it gets */
+    for (y = 0; y < height; y++) {
+        filtered[(size_t) y * (width + 1)] = 0;
+        memcpy(filtered + (size_t) y * (width + 1) + 1, indices + (size_t) y * width, width);
+    }
+    zlib = stbi_zlib_compress(filtered, (width + 1) * height, &zlen, 8);
+    czalloc_free(filtered);
+    if (zlib == NULL)
+        return 0;
+
+    for (i = 0; i < 4; i++) {
+        header[i] = (unsigned char) ((unsigned) width >> (24 - 8 * i));
+        header[4 + i] = (unsigned char) ((unsigned) height >> (24 - 8 * i));
+    }
+    header[8] = 8;
+    header[9] = 3;
+    for (i = 0; i < colors; i++) {
+        memcpy(rgb + i * 3, palette + i * 4, 3);
+        alpha[i] = palette[i * 4 + 3];
+        if (alpha[i] != 255)
+            alphas = i + 1;
+    }
+
+    f = fopen(dest, "wb");
+    if (f != NULL) {
+        status = fwrite(signature, 1, 8, f) == 8
+            && czsurface_internal_write_png_chunk(f, "IHDR", header, 13)
+            && czsurface_internal_write_png_chunk(f, "PLTE", rgb, colors * 3)
+            && (alphas == 0 || czsurface_internal_write_png_chunk(f, "tRNS", alpha, alphas))
+            && czsurface_internal_write_png_chunk(f, "IDAT", zlib, (unsigned) zlen)
+            && czsurface_internal_write_png_chunk(f, "IEND", NULL, 0);
+        status = fclose(f) == 0 && status;
+    }
+    STBIW_FREE(zlib);
+    return status;
+}
+
+static int czsurface_internal_write_png_chunk(FILE * f, const char * tag, const unsigned char * data, unsigned len) {
+    unsigned char * chunk = czalloc_malloc(len + 12);
+    unsigned crc = 0, i = 0;
+    int status = 0;
+    if (chunk == NULL)
+        return 0;
+    for (i = 0; i < 4; i++)
+        chunk[i] = (unsigned char) (len >> (24 - 8 * i));
+    memcpy(chunk + 4, tag, 4);
+    if (len > 0)
+        memcpy(chunk + 8, data, len);
+    crc = stbiw__crc32(chunk + 4, (int) len + 4);
+    for (i = 0; i < 4; i++)
+        chunk[len + 8 + i] = (unsigned char) (crc >> (24 - 8 * i));
+    status = fwrite(chunk, 1, len + 12, f) == len + 12;
+    czalloc_free(chunk);
+    return status;
+}
+
+/* texels go through memcpy, any alignment works and compilers still emit plain loads */
+static void czsurface_internal_swizzle_row_rgba8(const unsigned char * src, unsigned char * dst, unsigned count, const unsigned * shifts) {
+    unsigned s0 = shifts[0], s1 = shifts[1], s2 = shifts[2], s3 = shifts[3];
+    unsigned d0 = shifts[4], d1 = shifts[5], d2 = shifts[6], d3 = shifts[7];
+    unsigned x = 0, p = 0;
+    for (x = 0; x < count; x++, src += 4, dst += 4) {
+        memcpy(&p, src, 4);
+        p = ((p >> s0) & 0xFF) << d0 | ((p >> s1) & 0xFF) << d1
+            | ((p >> s2) & 0xFF) << d2 | ((p >> s3) & 0xFF) << d3;
+        memcpy(dst, &p, 4);
+    }
+}
@@ -27,6 +27,7 @@ THE SOFTWARE.
 
 #include "czsize.h"
 #include "czpoint.h"
+#include "czrect.h"
 
 struct czsurface;
 typedef struct czsurface czsurface;
@@ -46,16 +47,41 @@ typedef enum czsurface_save_format {
     CZSURFACE_FORMAT_PNG,
     CZSURFACE_FORMAT_BMP,
     CZSURFACE_FORMAT_TGA,
-    CZSURFACE_FORMAT_HDR
+    CZSURFACE_FORMAT_HDR,
+    CZSURFACE_FORMAT_KTX2,
+    CZSURFACE_FORMAT_PNG_INDEXED,
+    CZSURFACE_FORMAT_INDEXED
 } czsurface_save_format;
 
-czsurface * czsurface_load(const char * file);
-czsurface * czsurface_create(unsigned width, unsigned height);
+/* 8 bit values are gamma encoded, float values are linear (like in stb_image) */
+typedef enum czsurface_type {
+    CZSURFACE_UINT8 = 0,
+    CZSURFACE_FLOAT16,
+    CZSURFACE_FLOAT32
+} czsurface_type;
+
+typedef void (*czsurface_release_func)(void * owner);
+
+czsurface * czsurface_load(const char * file, unsigned channels, czsurface_type type);
+czsurface * czsurface_load_mask(const char * file);
+czsurface * czsurface_create(unsigned width, unsigned height, unsigned channels, czsurface_type type);
+czsurface * czsurface_wrap(void * pixels, unsigned width, unsigned height, unsigned channels, czsurface_type type, czsurface_release_func release, void * owner);
+czsurface * czsurface_crop(czsurface * surface, czrect area, int channel);
 czsurface_blit_status czsurface_blit(czsurface * src, czsurface * dst, czpoint dstpoint);
+czsurface_blit_status czsurface_blit_channel(czsurface * src, czsurface * dst, czpoint dstpoint, unsigned channel);
 czsurface_save_status czsurface_save(czsurface * src, const char * dest, czsurface_save_format format);
+czsurface_save_status czsurface_save_ktx2(czsurface ** levels, unsigned count, const char * dest, int srgb);
 void czsurface_destroy(czsurface * surface);
 czsize czsurface_size(czsurface * surface);
+unsigned czsurface_channels(czsurface * surface);
+czsurface_type czsurface_pixel_type(czsurface * surface);
+unsigned czsurface_bpp(czsurface * surface);
 void * czsurface_pixels(czsurface * surface);
+void czsurface_read_swizzled(czsurface * surface, czrect area, void * dst, unsigned pitch, const unsigned char * swizzle);
+czsurface * czsurface_downsample(czsurface * surface, int srgb);
+czsurface * czsurface_resize(czsurface * surface, unsigned width, unsigned height);
+float czsurface_coverage(czsurface * surface, czrect rect, float reference);
+void czsurface_fit_coverage(czsurface * surface, czrect rect, float reference, float coverage);
 
 
 #endif
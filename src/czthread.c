@@ -0,0 +1,373 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include "czthread.h"
+#include "czalloc.h"
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+#   include <unistd.h>
+#endif
+
+#define CZTHREAD_MAX_WORKERS 64
+
+typedef struct czthread_for_data {
+    czthread_func func;
+    void * priv;
+    unsigned count;
+    volatile long next;
+} czthread_for_data;
+
+typedef struct czthread_start_data {
+    czthread_entry entry;
+    void * priv;
+} czthread_start_data;
+
+typedef struct czthread_once_data {
+    czthread_once_func func;
+} czthread_once_data;
+
+static long czthread_internal_fetch_inc(volatile long * value);
+static void czthread_internal_for_worker(czthread_for_data * data);
+static void czthread_internal_run(czthread_start_data * data);
+
+unsigned czthread_cpu_count() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned) info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned) n : 1;
+#endif
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI czthread_internal_for_entry(LPVOID p) {
+    czthread_internal_for_worker((czthread_for_data *) p);
+    return 0;
+}
+#else
+static void * czthread_internal_for_entry(void * p) {
+    czthread_internal_for_worker((czthread_for_data *) p);
+    return NULL;
+}
+#endif
+
+void czthread_parallel_for(unsigned count, czthread_func func, void * priv) {
+    czthread_for_data data;
+    unsigned workers = czthread_cpu_count();
+    unsigned started = 0, i = 0;
+#if defined(_WIN32)
+    HANDLE threads[CZTHREAD_MAX_WORKERS];
+#else
+    pthread_t threads[CZTHREAD_MAX_WORKERS];
+#endif
+
+    data.func = func;
+    data.priv = priv;
+    data.count = count;
+    data.next = 0;
+
+    if (workers > count) workers = count;
+    if (workers > CZTHREAD_MAX_WORKERS) workers = CZTHREAD_MAX_WORKERS;
+
+    /* the calling thread is a worker too, so spawn one less */
+    for (i = 1; i < workers; i++) {
+#if defined(_WIN32)
+        threads[started] = CreateThread(NULL, 0, czthread_internal_for_entry, &data, 0, NULL);
+        if (threads[started] == NULL)
+            break;
+#else
+        if (pthread_create(&threads[started], NULL, czthread_internal_for_entry, &data) != 0)
+            break;
+#endif
+        started++;
+    }
+
+    czthread_internal_for_worker(&data);
+
+    for (i = 0; i < started; i++) {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI czthread_internal_start_entry(LPVOID p) {
+    czthread_internal_run((czthread_start_data *) p);
+    return 0;
+}
+#else
+static void * czthread_internal_start_entry(void * p) {
+    czthread_internal_run((czthread_start_data *) p);
+    return NULL;
+}
+#endif
+
+/* runs entry(priv) on a new thread, returns 0 on success */
+int czthread_start(czthread_handle * thread, czthread_entry entry, void * priv) {
+    czthread_start_data * data = czalloc_malloc(sizeof(czthread_start_data));
+    if (data == NULL)
+        return -1;
+    data->entry = entry;
+    data->priv = priv;
+#if defined(_WIN32)
+    *thread = CreateThread(NULL, 0, czthread_internal_start_entry, data, 0, NULL);
+    if (*thread != NULL)
+        return 0;
+#else
+    if (pthread_create(thread, NULL, czthread_internal_start_entry, data) == 0)
+        return 0;
+#endif
+    czalloc_free(data);
+    return -1;
+}
+
+void czthread_join(czthread_handle thread) {
+#if defined(_WIN32)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+#if defined(_WIN32)
+static BOOL CALLBACK czthread_internal_once_entry(PINIT_ONCE flag, PVOID p, PVOID * context) {
+    (void) flag;
+    (void) context;
+    ((czthread_once_data *) p)->func();
+    return TRUE;
+}
+#endif
+
+void czthread_once(czthread_once_flag * flag, czthread_once_func func) {
+#if defined(_WIN32)
+    czthread_once_data data;
+    data.func = func;
+    InitOnceExecuteOnce(flag, czthread_internal_once_entry, &data, NULL);
+#else
+    pthread_once(flag, func);
+#endif
+}
+
+/* loads only read, so they work on read only (shared) memory too */
+long czthread_atomic_load(volatile long * p) {
+#if defined(_WIN32)
+    long value = *p;
+    MemoryBarrier();
+    return value;
+#else
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void czthread_atomic_store(volatile long * p, long value) {
+#if defined(_WIN32)
+    InterlockedExchange(p, value);
+#else
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* returns non zero if *p was expected and is now desired */
+int czthread_atomic_cas(volatile long * p, long expected, long desired) {
+#if defined(_WIN32)
+    return InterlockedCompareExchange(p, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void * czthread_atomic_load_ptr(void * volatile * p) {
+#if defined(_WIN32)
+    void * value = *p;
+    MemoryBarrier();
+    return value;
+#else
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void czthread_atomic_store_ptr(void * volatile * p, void * value) {
+#if defined(_WIN32)
+    InterlockedExchangePointer(p, value);
+#else
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/* returns 0 on success */
+int czthread_mutex_init(czthread_mutex * mutex) {
+#if defined(_WIN32)
+    InitializeCriticalSection(mutex);
+    return 0;
+#else
+    return pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void czthread_mutex_destroy(czthread_mutex * mutex) {
+#if defined(_WIN32)
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+void czthread_mutex_lock(czthread_mutex * mutex) {
+#if defined(_WIN32)
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void czthread_mutex_unlock(czthread_mutex * mutex) {
+#if defined(_WIN32)
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+/* returns 0 on success */
+int czthread_rwlock_init(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    InitializeSRWLock(lock);
+    return 0;
+#else
+    return pthread_rwlock_init(lock, NULL);
+#endif
+}
+
+void czthread_rwlock_destroy(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    (void) lock;
+#else
+    pthread_rwlock_destroy(lock);
+#endif
+}
+
+void czthread_rwlock_read_lock(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    AcquireSRWLockShared(lock);
+#else
+    pthread_rwlock_rdlock(lock);
+#endif
+}
+
+void czthread_rwlock_read_unlock(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    ReleaseSRWLockShared(lock);
+#else
+    pthread_rwlock_unlock(lock);
+#endif
+}
+
+void czthread_rwlock_write_lock(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(lock);
+#else
+    pthread_rwlock_wrlock(lock);
+#endif
+}
+
+void czthread_rwlock_write_unlock(czthread_rwlock * lock) {
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(lock);
+#else
+    pthread_rwlock_unlock(lock);
+#endif
+}
+
+/* returns 0 on success */
+int czthread_cond_init(czthread_cond * cond) {
+#if defined(_WIN32)
+    InitializeConditionVariable(cond);
+    return 0;
+#else
+    return pthread_cond_init(cond, NULL);
+#endif
+}
+
+void czthread_cond_destroy(czthread_cond * cond) {
+#if defined(_WIN32)
+    (void) cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+void czthread_cond_wait(czthread_cond * cond, czthread_mutex * mutex) {
+#if defined(_WIN32)
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void czthread_cond_signal(czthread_cond * cond) {
+#if defined(_WIN32)
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+void czthread_cond_broadcast(czthread_cond * cond) {
+#if defined(_WIN32)
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+/* internal stuff */
+
+static long czthread_internal_fetch_inc(volatile long * value) {
+#if defined(_WIN32)
+    return InterlockedIncrement(value) - 1;
+#else
+    return __sync_fetch_and_add(value, 1);
+#endif
+}
+
+static void czthread_internal_for_worker(czthread_for_data * data) {
+    long i = 0;
+    while ((i = czthread_internal_fetch_inc(&data->next)) < (long) data->count)
+        data->func((unsigned) i, data->priv);
+}
+
+static void czthread_internal_run(czthread_start_data * data) {
+    czthread_start_data copy = *data;
+    czalloc_free(data);
+    copy.entry(copy.priv);
+}
@@ -0,0 +1,85 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Leonardo G. de Freitas
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef CZTHREAD_H
+#define CZTHREAD_H
+
+#if defined(_WIN32)
+#   include <windows.h>
+typedef CRITICAL_SECTION czthread_mutex;
+typedef SRWLOCK czthread_rwlock;
+typedef CONDITION_VARIABLE czthread_cond;
+typedef HANDLE czthread_handle;
+typedef INIT_ONCE czthread_once_flag;
+#   define CZTHREAD_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+#   include <pthread.h>
+typedef pthread_mutex_t czthread_mutex;
+typedef pthread_rwlock_t czthread_rwlock;
+typedef pthread_cond_t czthread_cond;
+typedef pthread_t czthread_handle;
+typedef pthread_once_t czthread_once_flag;
+#   define CZTHREAD_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+typedef void (*czthread_func)(unsigned index, void * priv);
+typedef void (*czthread_entry)(void * priv);
+typedef void (*czthread_once_func)(void);
+
+unsigned czthread_cpu_count();
+void czthread_parallel_for(unsigned count, czthread_func func, void * priv);
+
+int czthread_start(czthread_handle * thread, czthread_entry entry, void * priv);
+void czthread_join(czthread_handle thread);
+
+/* runs func exactly once per flag; later callers wait for it to finish */
+void czthread_once(czthread_once_flag * flag, czthread_once_func func);
+
+/* sequentially consistent atomics */
+long czthread_atomic_load(volatile long * p);
+void czthread_atomic_store(volatile long * p, long value);
+int czthread_atomic_cas(volatile long * p, long expected, long desired);
+void * czthread_atomic_load_ptr(void * volatile * p);
+void czthread_atomic_store_ptr(void * volatile * p, void * value);
+
+int czthread_mutex_init(czthread_mutex * mutex);
+void czthread_mutex_destroy(czthread_mutex * mutex);
+void czthread_mutex_lock(czthread_mutex * mutex);
+void czthread_mutex_unlock(czthread_mutex * mutex);
+
+int czthread_rwlock_init(czthread_rwlock * lock);
+void czthread_rwlock_destroy(czthread_rwlock * lock);
+void czthread_rwlock_read_lock(czthread_rwlock * lock);
+void czthread_rwlock_read_unlock(czthread_rwlock * lock);
+void czthread_rwlock_write_lock(czthread_rwlock * lock);
+void czthread_rwlock_write_unlock(czthread_rwlock * lock);
+
+int czthread_cond_init(czthread_cond * cond);
+void czthread_cond_destroy(czthread_cond * cond);
+void czthread_cond_wait(czthread_cond * cond, czthread_mutex * mutex);
+void czthread_cond_signal(czthread_cond * cond);
+void czthread_cond_broadcast(czthread_cond * cond);
+
+#endif
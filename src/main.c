@@ -28,10 +28,39 @@ THE SOFTWARE.
 
 #include "chizu.h"
 
+#define MAX_VARIANTS 16
+
+static void print_insert_status(const char * file, chizu_insert_status status) {
+    printf("Inserting %s... ", file);
+    switch(status) {
+        case CHIZU_INSERT_FILEOPEN_FAIL:
+            printf("FAILED: Failed to open file.\n");
+        break;
+        case CHIZU_INSERT_NOSPACE:
+            printf("FAILED: Not enough space for it.\n");
+        break;
+        case CHIZU_INSERT_OK:
+            printf("OK\n");
+        break;
+        case CHIZU_INSERT_FAIL:
+        default:
+            printf("FAILED\n");
+        break;
+    }
+}
+
+/* the base name of a variant */
+static void output_name(char * name, const char * base, int scaled, float scale) {
+    if (scaled)
+        sprintf(name, "%s@%gx", base, scale);
+    else
+        strcpy(name, base);
+}
+
 /*
  * Chizu atlas generator, to demonstrate libchizu.
  * Usage:
- *  ./chizu <width> <height> <spec-output> <texture-output> <file 1> <file 2> [<file 3> ...]
+ *  ./chizu [options] <output-base-name> <file 1> <file 2> [<file 3> ...]
  *
  * Chizu uses http://www.blackpawn.com/texts/lightmaps/ as its algorthimg.
  */
@@ -39,64 +68,277 @@ int main(int argc, char ** argv) {
     const char * helptext =
         "Chizu atlas generator, to demonstrate libchizu.\n"
         "Usage:\n"
-        "  ./chizu <output-base-name> <file 1> <file 2> [<file 3> ...]\n"
+        "  ./chizu [options] <output-base-name> <file 1> <file 2> [<file 3> ...]\n"
+        "\n"
+        "Options:\n"
+        "  -f <format>  pixel format of the atlas: rgba (default), rgb, la, l,\n"
+        "               rgba16f or rgba32f\n"
+        "  -t <type>    texture file type: png (default), tga, bmp, hdr, ktx2,\n"
+        "               png8 (paletted png) or idx (raw indices + .pal)\n"
+        "  -sdf <downscale>,<spread>\n"
+        "               insert images as signed distance fields, downscale times\n"
+        "               smaller and spread pixels wide\n"
+        "  -p           pack grayscale masks into the R, G, B and A channels\n"
+        "               independently (the spec gets a sixth column: the channel)\n"
+        "  -b           write a binary spec, <output-base-name>.czs, instead of the\n"
+        "               text one (see chizu_spec_open)\n"
+        "  -H           also write a C/C++ header, <output-base-name>.h, with an enum\n"
+        "               of the images, their rects and a perfect hash of their names\n"
+        "  -e <raw|lz4> also write a C source, <output-base-name>.c, embedding the\n"
+        "               texture (raw or LZ4 compressed) and the layout\n"
+        "  -c <dir>[,<megabytes>]\n"
+        "               cache decoded images in dir (created if needed), so the\n"
+        "               next runs only decode what changed; 1024 MB at most\n"
+        "               unless told otherwise\n"
+        "  -a           append to the atlas already in <output-base-name>: open its\n"
+        "               spec and texture, add the files to its free space and\n"
+        "               export it again\n"
+        "  -k           keep the layout of the atlas previously exported as\n"
+        "               <output-base-name>: unchanged images stay where they were,\n"
+        "               and <output-base-name>.delta.txt lists what changed\n"
+        "  -m <levels>  also export <levels> mip levels, as <output-base-name>.N.png\n"
+        "               or inside the file for ktx2\n"
+        "  -s <scale>[,<scale>...]\n"
+        "               export one atlas per scale factor, named\n"
+        "               <output-base-name>@<scale>x, decoding every file once\n"
         "\n"
         "Example:\n"
         "  ./chizu my-atlas sprite1.png sprite2.png sprite3.png sprite4.png\n"
+        "  ./chizu -f l my-glyphs a.png b.png\n"
+        "  ./chizu -f l -sdf 8,4 my-icons big-icon1.png big-icon2.png\n"
+        "  ./chizu -s 1,0.5,0.25 my-atlas sprite1@4x.png sprite2@4x.png\n"
         "\n"
         "Chizu uses http://www.blackpawn.com/texts/lightmaps/ as its algorthimg.\n";
     int i = 0;
-    chizu * atlas = NULL;
+    int first = 1;
+    unsigned v = 0;
+    chizu * atlases[MAX_VARIANTS] = {0};
+    float scales[MAX_VARIANTS] = {1.0f};
+    unsigned variants = 1;
+    int scaled = 0;
+    int packed = 0;
+    chizu_pixel_format format = CHIZU_PIXEL_RGBA8;
+    chizu_export_format texformat = CHIZU_FORMAT_PNG;
+    const char * texext = "png";
+    unsigned sdfdownscale = 0, sdfspread = 0;
+    unsigned miplevels = 0;
+    chizu_spec_format specformat = CHIZU_SPEC_TEXT;
+    int header = 0, embed = 0, append = 0, keep = 0;
+    chizu_embed_compression compression = CHIZU_EMBED_RAW;
+    chizu_cache * cache = NULL;
+
+    /* parse options */
+    for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "-f") == 0 && first + 1 < argc) {
+            const char * name = argv[++first];
+            if (strcmp(name, "rgba") == 0) format = CHIZU_PIXEL_RGBA8;
+            else if (strcmp(name, "rgb") == 0) format = CHIZU_PIXEL_RGB8;
+            else if (strcmp(name, "la") == 0) format = CHIZU_PIXEL_LA8;
+            else if (strcmp(name, "l") == 0) format = CHIZU_PIXEL_L8;
+            else if (strcmp(name, "rgba16f") == 0) format = CHIZU_PIXEL_RGBA16F;
+            else if (strcmp(name, "rgba32f") == 0) format = CHIZU_PIXEL_RGBA32F;
+            else {
+                printf("Unknown pixel format %s\n", name);
+                return 0;
+            }
+        } else if (strcmp(argv[first], "-sdf") == 0 && first + 1 < argc) {
+            if (sscanf(argv[++first], "%u,%u", &sdfdownscale, &sdfspread) != 2 || sdfdownscale == 0) {
+                printf("Invalid distance field parameters %s\n", argv[first]);
+                return 0;
+            }
+        } else if (strcmp(argv[first], "-t") == 0 && first + 1 < argc) {
+            texext = argv[++first];
+            if (strcmp(texext, "png") == 0) texformat = CHIZU_FORMAT_PNG;
+            else if (strcmp(texext, "tga") == 0) texformat = CHIZU_FORMAT_TGA;
+            else if (strcmp(texext, "bmp") == 0) texformat = CHIZU_FORMAT_BMP;
+            else if (strcmp(texext, "hdr") == 0) texformat = CHIZU_FORMAT_HDR;
+            else if (strcmp(texext, "ktx2") == 0) texformat = CHIZU_FORMAT_KTX2;
+            else if (strcmp(texext, "png8") == 0) {
+                texformat = CHIZU_FORMAT_PNG_INDEXED;
+                texext = "png";
+            } else if (strcmp(texext, "idx") == 0) texformat = CHIZU_FORMAT_INDEXED;
+            else {
+                printf("Unknown texture type %s\n", texext);
+                return 0;
+            }
+        } else if (strcmp(argv[first], "-p") == 0) {
+            packed = 1;
+        } else if (strcmp(argv[first], "-a") == 0) {
+            append = 1;
+        } else if (strcmp(argv[first], "-k") == 0) {
+            keep = 1;
+        } else if (strcmp(argv[first], "-b") == 0) {
+            specformat = CHIZU_SPEC_BINARY;
+        } else if (strcmp(argv[first], "-H") == 0) {
+            header = 1;
+        } else if (strcmp(argv[first], "-e") == 0 && first + 1 < argc) {
+            const char * name = argv[++first];
+            if (strcmp(name, "raw") == 0) compression = CHIZU_EMBED_RAW;
+            else if (strcmp(name, "lz4") == 0) compression = CHIZU_EMBED_LZ4;
+            else {
+                printf("Unknown compression %s\n", name);
+                return 0;
+            }
+            embed = 1;
+        } else if (strcmp(argv[first], "-c") == 0 && first + 1 < argc) {
+            char dir[1024] = {0};
+            unsigned megabytes = 1024;
+            const char * comma = strrchr(argv[++first], ',');
+            size_t length = comma != NULL ? (size_t) (comma - argv[first]) : strlen(argv[first]);
+            if (length >= sizeof(dir) || (comma != NULL && sscanf(comma + 1, "%u", &megabytes) != 1)) {
+                printf("Invalid cache %s\n", argv[first]);
+                return 0;
+            }
+            memcpy(dir, argv[first], length);
+            chizu_cache_close(cache);
+            cache = chizu_cache_open(dir, (unsigned long long) megabytes << 20);
+            if (cache == NULL)
+                printf("Could not open the cache in %s, decoding everything\n", dir);
+        } else if (strcmp(argv[first], "-m") == 0 && first + 1 < argc) {
+            char * end = NULL;
+            unsigned long levels = strtoul(argv[++first], &end, 10);
+            if (*end != '\0' || end == argv[first] || levels > CHIZU_MAX_MIPLEVELS) {
+                printf("Invalid mip levels %s, at most %d\n", argv[first], CHIZU_MAX_MIPLEVELS);
+                return 0;
+            }
+            miplevels = (unsigned) levels;
+        } else if (strcmp(argv[first], "-s") == 0 && first + 1 < argc) {
+            char * list = argv[++first];
+            for (variants = 0; variants < MAX_VARIANTS && *list != '\0'; variants++) {
+                scales[variants] = strtof(list, &list);
+                if (scales[variants] <= 0 || (*list != ',' && *list != '\0')) {
+                    printf("Invalid scale list %s\n", argv[first]);
+                    return 0;
+                }
+                if (*list == ',') list++;
+            }
+            scaled = 1;
+        } else {
+            printf("%s\n", helptext);
+            return 0;
+        }
+    }
 
     /* check if minimum number of arguments supplied */
-    if (argc < 6) {
+    if (argc - first < (append ? 2 : 3) || variants == 0) {
         printf("%s\n", helptext);
         return 0;
     }
 
-    const char * base = argv[1];
-    if (strlen(base) > 1019) {
-        printf("Output base filename too big!");
+    if (scaled && sdfdownscale > 0) {
+        printf("Distance fields can not be exported in several scales\n");
         return 0;
     }
 
-    /* generate outputs */
-    char spec[1024] = {0};
-    char tex[1024] = {0};
-    strcpy(spec, base);
-    strcat(spec, ".txt");
+    if (scaled && append) {
+        printf("Several scales can not be appended to\n");
+        return 0;
+    }
 
-    strcpy(tex, base);
-    strcat(tex, ".png");
+    if (keep && append) {
+        printf("Appending already keeps the layout\n");
+        return 0;
+    }
 
-    /* Creates a new chizu atlas */
-    atlas = chizu_create();
+    const char * base = argv[first];
+    if (strlen(base) > 1000) {
+        printf("Output base filename too big!");
+        return 0;
+    }
 
-    /* Insert every file passed in in the atlas*/
-    for (i = 2; i < argc; i++) {
-        printf("Inserting %s... ", argv[i]);
-        chizu_insert_status status = chizu_insert(atlas, argv[i]);
-        switch(status) {
-            case CHIZU_INSERT_FILEOPEN_FAIL:
-                printf("FAILED: Failed to open file.\n");
-            break;
-            case CHIZU_INSERT_NOSPACE:
-                printf("FAILED: Not enough space for it.\n");
-            break;
-            case CHIZU_INSERT_OK:
-                printf("OK\n");
-            break;
-            case CHIZU_INSERT_FAIL:
-            default:
-                printf("FAILED\n");
-            break;
+    /* Creates a new chizu atlas for each variant, or opens the existing one */
+    if (append) {
+        char spec[1024] = {0};
+        char tex[1024] = {0};
+        sprintf(spec, "%s.%s", base, specformat == CHIZU_SPEC_BINARY ? "czs" : "txt");
+        sprintf(tex, "%s.%s", base, texext);
+        atlases[0] = chizu_open(spec, tex);
+        if (atlases[0] == NULL) {
+            printf("Could not open %s and %s\n", spec, tex);
+            return 0;
+        }
+    }
+    for (v = 0; v < variants; v++) {
+        if (!append)
+            atlases[v] = packed ? chizu_create_channel_packed() : chizu_create_format(format);
+        chizu_set_mipmaps(atlases[v], miplevels);
+        chizu_set_spec_format(atlases[v], specformat);
+        chizu_set_cache(atlases[v], cache);
+        if (keep) {
+            /* read before the new outputs replace them */
+            char name[1024] = {0};
+            char spec[1024] = {0};
+            char tex[1024] = {0};
+            output_name(name, base, scaled, scales[v]);
+            strcpy(spec, name);
+            strcat(spec, specformat == CHIZU_SPEC_BINARY ? ".czs" : ".txt");
+            strcpy(tex, name);
+            strcat(tex, ".");
+            strcat(tex, texext);
+            if (!chizu_set_stable_layout(atlases[v], spec, tex))
+                printf("No previous layout in %s, packing anew\n", spec);
         }
     }
 
-    printf("Exporting to %s and %s... ", spec, tex);
-    chizu_export(atlas, spec, tex, CHIZU_FORMAT_PNG);
-    chizu_destroy(atlas);
+    /* Insert every file passed in in the atlas*/
+    if (sdfdownscale > 0) {
+        unsigned count = (unsigned) (argc - first - 1);
+        chizu_insert_status * statuses = calloc(count, sizeof(chizu_insert_status));
+        chizu_insert_sdf_many(atlases[0], (const char **) argv + first + 1, count, sdfdownscale, sdfspread, statuses);
+        for (i = 0; i < (int) count; i++)
+            print_insert_status(argv[first + 1 + i], statuses[i]);
+        free(statuses);
+    } else if (scaled) {
+        for (i = first + 1; i < argc; i++)
+            print_insert_status(argv[i], chizu_insert_scaled(atlases, scales, variants, argv[i]));
+    } else {
+        for (i = first + 1; i < argc; i++)
+            print_insert_status(argv[i], chizu_insert(atlases[0], argv[i]));
+    }
+
+    for (v = 0; v < variants; v++) {
+        /* generate outputs */
+        char name[1024] = {0};
+        char spec[1024] = {0};
+        char tex[1024] = {0};
+        output_name(name, base, scaled, scales[v]);
+
+        strcpy(spec, name);
+        strcat(spec, specformat == CHIZU_SPEC_BINARY ? ".czs" : ".txt");
+
+        strcpy(tex, name);
+        strcat(tex, ".");
+        strcat(tex, texext);
+
+        printf("Exporting to %s and %s... ", spec, tex);
+        chizu_export(atlases[v], spec, tex, texformat);
+        /* generated code is named after the file name, without directories */
+        const char * prefix = name + strlen(name);
+        while (prefix > name && prefix[-1] != '/' && prefix[-1] != '\\')
+            prefix--;
+        if (header) {
+            strcpy(tex, name);
+            strcat(tex, ".h");
+            if (chizu_export_header(atlases[v], tex, prefix) != CHIZU_EXPORT_OK)
+                printf("(no header) ");
+        }
+        if (embed) {
+            strcpy(tex, name);
+            strcat(tex, ".c");
+            if (chizu_export_source(atlases[v], tex, prefix, compression) != CHIZU_EXPORT_OK)
+                printf("(no source) ");
+        }
+        if (keep) {
+            strcpy(tex, name);
+            strcat(tex, ".delta.txt");
+            if (chizu_export_delta(atlases[v], tex) != CHIZU_EXPORT_OK)
+                printf("(no delta) ");
+        }
+        chizu_destroy(atlases[v]);
+        printf(" OK\n");
+    }
 
-    printf(" OK\n");
+    /* prunes it to its size */
+    chizu_cache_close(cache);
     return 0;
 }